@@ -0,0 +1,322 @@
+/**
+ * @file main.cpp
+ * @brief This is a loopback benchmark of the socket factory presets (\see asyncurl::socket_factory).
+ * Basically, the workflow is supposed to look like this :
+ * <ul>
+ * <li>1 - Start a minimal HTTP server on the loopback, in its own thread and loop </li>
+ * <li>2 - For each preset, setup a session using a socket factory with the preset options </li>
+ * <li>3 - Measure the latency of small sequential requests, then the throughput of large parallel downloads </li>
+ * <li>4 - Measure the latency of the small requests again, with and without busy polling (\see
+ * asyncurl::mhandle::set_busy_poll), along with the CPU time of the client thread </li>
+ * </ul>
+ *
+ * Every request uses a new connection (CURLOPT_FORBID_REUSE), so that every socket goes through the factory.
+ * Usage : loopback-bench [requests] [download size (MB)] [busy polling spin (us) - 0 to skip]
+ */
+
+#include <asyncurl/asyncurl.hpp>
+#include <miniLoop/Loop.h>
+
+#include <curl/curl.h> // Convenient to get access to handle options (CURLOPT)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace asyncurl;
+using namespace loop;
+
+#define SMALL_SIZE 64          // Body size of the latency requests (bytes)
+#define PARALLEL_DOWNLOADS 4   // Number of simultaneous downloads of the throughput test
+#define SERVER_CHUNK 65536     // Size of the server writes (bytes)
+#define SERVER_HOUSEKEEPING 50 // Period of the server housekeeping (milliseconds)
+
+//---------------------------------------------------------------------------------------------------------------------
+// SERVER
+// Answers "GET /<size>" with <size> bytes, then closes the connection.
+//---------------------------------------------------------------------------------------------------------------------
+
+struct connection
+{
+    int                       fd;
+    std::unique_ptr<Loop::IO> io;
+    std::string               request{};
+    std::string               header{};
+    size_t                    remaining{ 0 };
+    bool                      answering{ false };
+    bool                      closed{ false };
+};
+
+static void
+serve(int listener, std::atomic<bool>& stop)
+{
+    Loop                                       serverLoop;
+    std::map<int, std::unique_ptr<connection>> conns;
+    static const std::string                   zeros(SERVER_CHUNK, '\0');
+
+    Loop::IO acceptor(listener, serverLoop);
+    acceptor.setRequestedEvents(Loop::IO::READ);
+    acceptor.onEvent([&](int) {
+        int fd;
+        while (0 <= (fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)))
+        {
+            auto  c{ std::make_unique<connection>() };
+            auto* raw{ c.get() };
+
+            c->fd = fd;
+            c->io = std::make_unique<Loop::IO>(fd, serverLoop);
+            c->io->setRequestedEvents(Loop::IO::READ);
+            c->io->onEvent([raw](int evt) {
+                if (raw->closed) return;
+
+                if (!raw->answering && (evt & Loop::IO::READ))
+                {
+                    char buf[4096];
+                    auto n{ ::read(raw->fd, buf, sizeof(buf)) };
+                    if (n <= 0)
+                    {
+                        raw->closed = true;
+                        raw->io->setRequestedEvents(0);
+                        return;
+                    }
+                    raw->request.append(buf, static_cast<size_t>(n));
+                    if (std::string::npos == raw->request.find("\r\n\r\n")) return;
+
+                    // "GET /<size> HTTP/1.1"
+                    raw->remaining = std::strtoul(raw->request.c_str() + raw->request.find('/') + 1, nullptr, 10);
+                    raw->header    = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(raw->remaining) +
+                                  "\r\nConnection: close\r\n\r\n";
+                    raw->answering = true;
+                    raw->io->setRequestedEvents(Loop::IO::WRITE);
+                }
+
+                while (raw->answering)
+                {
+                    ssize_t n;
+                    if (!raw->header.empty())
+                    {
+                        if (0 < (n = ::write(raw->fd, raw->header.data(), raw->header.size())))
+                            raw->header.erase(0, static_cast<size_t>(n));
+                    }
+                    else if (0 < raw->remaining)
+                    {
+                        if (0 < (n = ::write(raw->fd, zeros.data(), std::min(raw->remaining, zeros.size()))))
+                            raw->remaining -= static_cast<size_t>(n);
+                    }
+                    else
+                    {
+                        raw->closed = true;
+                        raw->io->setRequestedEvents(0);
+                        return;
+                    }
+                    if (n <= 0) return; // Socket buffer full : wait for the next WRITE event
+                }
+            });
+            conns[fd] = std::move(c);
+        }
+    });
+
+    // The connections are destroyed out of their own callbacks
+    Loop::Timeout housekeeping(serverLoop);
+    housekeeping.onTimeout([&]() {
+        for (auto it{ conns.begin() }; conns.end() != it;)
+        {
+            if (!it->second->closed)
+            {
+                ++it;
+                continue;
+            }
+            it->second->io.reset();
+            ::close(it->first);
+            it = conns.erase(it);
+        }
+
+        if (stop)
+            serverLoop.exit();
+        else
+            housekeeping.set(SERVER_HOUSEKEEPING);
+    });
+    housekeeping.set(SERVER_HOUSEKEEPING);
+
+    serverLoop.run();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// CLIENT
+//---------------------------------------------------------------------------------------------------------------------
+
+struct results
+{
+    double avg_us{ 0 };
+    double p50_us{ 0 };
+    double p99_us{ 0 };
+    double cpu_us{ 0 }; /*!< CPU time of the client thread (user + system) during the latency test */
+    double mbps{ 0 };
+    int    errors{ 0 };
+};
+
+static double
+thread_cpu_us(void)
+{
+    rusage usage{};
+    ::getrusage(RUSAGE_THREAD, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void
+bench_latency(const std::string& base, socket_factory* factory, int requests, results& ret, long spin_us = 0)
+{
+    Loop    myLoop;
+    mhandle sess(myLoop);
+
+    sess.set_socket_factory(factory);
+    sess.set_busy_poll(spin_us);
+
+    std::vector<double> samples;
+    handle              small;
+    small.set_opt(CURLOPT_URL, base + std::to_string(SMALL_SIZE));
+    small.set_opt(CURLOPT_FORBID_REUSE, 1L);
+    small.set_cb_done([&](int rc) {
+        auto info{ small.get_info(CURLINFO_TOTAL_TIME) };
+        if (0 != rc || handle::HDL_OK != info.ret)
+            ++ret.errors;
+        else
+            samples.push_back(std::any_cast<double>(info.value) * 1e6);
+
+        if (static_cast<int>(samples.size()) + ret.errors < requests)
+            sess.add_handle(small);
+        else
+            myLoop.exit();
+    });
+
+    const auto cpu{ thread_cpu_us() };
+    sess.add_handle(small);
+    myLoop.run();
+    ret.cpu_us = thread_cpu_us() - cpu;
+
+    if (samples.empty()) return;
+
+    std::sort(samples.begin(), samples.end());
+    for (auto s : samples)
+        ret.avg_us += s / static_cast<double>(samples.size());
+    ret.p50_us = samples[samples.size() / 2];
+    ret.p99_us = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+}
+
+static void
+bench_throughput(const std::string& base, socket_factory* factory, size_t download, results& ret)
+{
+    Loop    myLoop;
+    mhandle sess(myLoop);
+
+    sess.set_socket_factory(factory);
+
+    std::vector<std::unique_ptr<handle>> bulk;
+    int                                  pending{ PARALLEL_DOWNLOADS };
+    const auto                           start{ std::chrono::steady_clock::now() };
+
+    for (int i{ 0 }; i < PARALLEL_DOWNLOADS; ++i)
+    {
+        bulk.emplace_back(std::make_unique<handle>());
+        bulk.back()->set_opt(CURLOPT_URL, base + std::to_string(download));
+        bulk.back()->set_opt(CURLOPT_FORBID_REUSE, 1L);
+        bulk.back()->set_cb_done([&](int rc) {
+            if (0 != rc) ++ret.errors;
+            if (0 == --pending) myLoop.exit();
+        });
+        sess.add_handle(*bulk.back());
+    }
+    myLoop.run();
+
+    const std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+    ret.mbps = static_cast<double>(PARALLEL_DOWNLOADS * download) / (1024 * 1024) / elapsed.count();
+}
+
+int
+main(int argc, char** argv)
+{
+    const int    requests{ (1 < argc) ? std::atoi(argv[1]) : 500 };
+    const size_t download{ static_cast<size_t>((2 < argc) ? std::atoi(argv[2]) : 256) * 1024 * 1024 };
+    const long   spin_us{ (3 < argc) ? std::atol(argv[3]) : 100 };
+
+    // 1 - Start the server on an ephemeral loopback port
+    int         listener{ ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0) };
+    sockaddr_in addr{};
+    socklen_t   len{ sizeof(addr) };
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (0 > listener || 0 != ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+        0 != ::listen(listener, SOMAXCONN) || 0 != ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len))
+    {
+        std::cerr << "Unable to start the loopback server" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::atomic<bool> stop{ false };
+    std::thread       server(serve, listener, std::ref(stop));
+    const std::string base{ "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/" };
+
+    // 2 - Run the benchmark for each preset
+    socket_factory plain;
+    socket_factory lowLatency(socket_factory::low_latency());
+    socket_factory bulkThroughput(socket_factory::bulk_throughput());
+
+    const std::vector<std::pair<std::string, socket_factory*>> presets{ { "none (curl defaults)", nullptr },
+                                                                        { "default factory", &plain },
+                                                                        { "low_latency", &lowLatency },
+                                                                        { "bulk_throughput", &bulkThroughput } };
+
+    std::cout << requests << " sequential requests of " << SMALL_SIZE << " bytes, then " << PARALLEL_DOWNLOADS
+              << " parallel downloads of " << download / (1024 * 1024) << " MB" << std::endl;
+
+    for (const auto& [name, factory] : presets)
+    {
+        results res;
+        bench_latency(base, factory, requests, res);
+        bench_throughput(base, factory, download, res);
+
+        std::cout << name << " : latency avg " << static_cast<long>(res.avg_us) << " us, p99 "
+                  << static_cast<long>(res.p99_us) << " us - throughput " << static_cast<long>(res.mbps) << " MB/s"
+                  << (res.errors ? " (" + std::to_string(res.errors) + " errors)" : "") << std::endl;
+    }
+
+    // 3 - Busy polling : lower latency, paid with the CPU time spent spinning
+    if (0 < spin_us)
+    {
+        std::cout << "busy polling (low_latency preset, spin " << spin_us << " us)" << std::endl;
+
+        for (const auto spin : { 0L, spin_us })
+        {
+            results res;
+            bench_latency(base, &lowLatency, requests, res, spin);
+
+            std::cout << (spin ? "with spin" : "without spin") << " : latency p50 " << static_cast<long>(res.p50_us)
+                      << " us, p99 " << static_cast<long>(res.p99_us) << " us - CPU "
+                      << static_cast<long>(res.cpu_us / 1000) << " ms ("
+                      << static_cast<long>(res.cpu_us / std::max(requests, 1)) << " us per request)"
+                      << (res.errors ? " (" + std::to_string(res.errors) + " errors)" : "") << std::endl;
+        }
+    }
+
+    // 4 - Cleanup
+    stop = true;
+    server.join();
+    ::close(listener);
+
+    return EXIT_SUCCESS;
+}
@@ -13,8 +13,20 @@
 #ifndef INCLUDE_ASYNCURL_ASYNCURL_H
 #define INCLUDE_ASYNCURL_ASYNCURL_H
 
+#include "batcher.hpp"
+#include "bulk_fetch.hpp"
+#include "context.hpp"
+#include "coro.hpp"
+#include "dag.hpp"
+#include "endpoint_set.hpp"
 #include "handle.hpp"
+#include "latency.hpp"
 #include "mhandle.hpp"
+#include "offload.hpp"
+#include "outbox.hpp"
+#include "poller.hpp"
+#include "progress.hpp"
+#include "socket_factory.hpp"
 #include "list.hpp"
 
 #endif // INCLUDE_ASYNCURL_ASYNCURL_H
@@ -0,0 +1,184 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file batcher.hpp
+ * @brief Client-side auto-batching of small requests into calls of batch endpoints
+ *
+ * A batcher collects the requests submitted with the same key (e.g. a batch endpoint) :
+ * <ul>
+ * <li>A batch is sent once it holds N requests, or T microseconds after its first request</li>
+ * <li>The requests of a batch are encoded into a single transfer by a user codec</li>
+ * <li>The response of the batch is decoded by the codec into the responses of the requests, each of them being handed
+ * to the callback of its request</li>
+ * </ul>
+ * Far fewer transfers are performed, at the cost of a bounded latency (T).
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_BATCHER_H
+#define INCLUDE_ASYNCURL_BATCHER_H
+
+#include <cstddef>    // size_t
+#include <cstdint>    // int64_t
+#include <functional> // std::function
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <miniLoop/Loop.h>
+
+namespace asyncurl
+{
+class handle;
+class mhandle;
+
+/*********************************************************************************************************************/
+class batcher
+{
+public:
+    /**
+     * @brief BAT_RetCode describes the return codes of the asyncurl::batcher class methods
+     */
+    typedef enum
+    {
+        BAT_OK = 0,    /*!< OK */
+        BAT_BAD_PARAM, /*!< An invalid parameter was passed to a function */
+        BAT_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } BAT_RetCode;
+
+    /**
+     * @brief item_response is the response of a request, decoded out of the response of its batch
+     */
+    struct item_response
+    {
+        long        response_code{ 0 };
+        std::string body{};
+    };
+
+    /**
+     * @brief item_result is the outcome of a request, handed to its callback
+     * @warning The body is only valid during the call of the callback
+     */
+    struct item_result
+    {
+        int              code;          /*!< Result of the batch transfer (CURLcode) - CURLE_WEIRD_SERVER_REPLY if its
+                                             response could not be decoded */
+        long             response_code; /*!< Response code of the request (or of the batch if it failed) */
+        std::string_view body;          /*!< Body of the response of the request */
+    };
+
+    /**
+     * @brief batcher_stats is a snapshot of the activity of the batcher (\see batcher::stats)
+     */
+    struct batcher_stats
+    {
+        uint64_t submitted; /*!< Requests submitted */
+        uint64_t batches;   /*!< Batches sent */
+        uint64_t failed;    /*!< Batches failed (transfer error, or response not decoded) */
+        uint64_t full;      /*!< Batches sent because they were full (the others were sent on their deadline) */
+        size_t   pending;   /*!< Requests waiting for their batch to be sent */
+        size_t   in_flight; /*!< Batches being sent */
+    };
+
+    /**
+     * @brief The encoder configures the transfer of a batch (URL, headers...) and fills its body out of the payloads
+     * of its requests. It must not set the write and done callbacks, nor the body (owned by the batcher). Returning
+     * false fails the requests of the batch.
+     */
+    using TEncode = std::function<bool(handle&, std::string_view key, const std::vector<std::string_view>& payloads,
+                                       std::string& body)>;
+
+    /**
+     * @brief The decoder splits the response of a batch into the responses of its requests (in the order of the
+     * payloads). Returning false, or a number of responses different from the number of requests, fails the requests.
+     */
+    using TDecode = std::function<bool(std::string_view key, long response_code, std::string_view body, size_t count,
+                                       std::vector<item_response>& responses)>;
+
+    /**
+     * @brief codec is the pair of functions mapping the requests to a batch, and back
+     */
+    struct codec
+    {
+        TEncode encode{};
+        TDecode decode{};
+    };
+
+    using TCbItem = std::function<void(const item_result&)>;
+
+private:
+    struct item
+    {
+        std::string payload{};
+        TCbItem     cb{};
+    };
+
+    struct batch
+    {
+        std::string       key{};
+        std::vector<item> items{};
+        int64_t           deadline_us{ 0 };
+    };
+
+    struct flight
+    {
+        std::unique_ptr<handle> h{};
+        std::string             key{};
+        std::vector<item>       items{};
+        std::string             request{};  /*!< Body of the batch */
+        std::string             response{}; /*!< Body of the response */
+    };
+
+    mhandle& session__;
+    codec    codec__;
+    size_t   max_items__;
+    int64_t  max_delay_us__;
+
+    std::map<std::string, std::unique_ptr<batch>, std::less<>> batches__{}; /*!< Open batches (by key) */
+    std::set<std::pair<int64_t, batch*>>                        deadlines__{};
+    std::map<flight*, std::unique_ptr<flight>>                  flights__{};
+    std::vector<std::unique_ptr<flight>>                        landed__{}; /*!< Completed flights (to destroy) */
+
+    uint64_t submitted__{ 0 };
+    uint64_t sent__{ 0 };
+    uint64_t failed__{ 0 };
+    uint64_t full__{ 0 };
+    size_t   pending__{ 0 };
+
+    std::unique_ptr<loop::Loop::Timeout> timer__{ nullptr };
+    std::unique_ptr<loop::Loop::Timeout> gc_timer__{ nullptr };
+
+    batcher(const batcher&) = delete;
+    batcher& operator=(const batcher&) = delete;
+    batcher(batcher&&)                 = delete;
+    batcher& operator=(batcher&&) = delete;
+
+    void send(batch&) noexcept;
+    void completed(flight&, int result) noexcept;
+    void fail(std::vector<item>&, int code, long response_code) noexcept;
+    void arm(void) noexcept;
+    void tick(void) noexcept;
+
+public:
+    batcher(loop::Loop&, mhandle&, const codec&, size_t max_items = 100, long max_delay_us = 2000);
+    ~batcher() noexcept;
+
+    BAT_RetCode submit(std::string_view key, std::string_view payload, const TCbItem& cb) noexcept;
+    void        flush(void) noexcept;
+
+    batcher_stats stats(void) const noexcept;
+
+    static std::string_view retCode2Str(BAT_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_BATCHER_H
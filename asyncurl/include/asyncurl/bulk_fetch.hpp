@@ -0,0 +1,155 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file bulk_fetch.hpp
+ * @brief Streaming fetch of (very) large lists of URLs, in constant memory
+ *
+ * A bulk fetch reads its URLs lazily and keeps a bounded window of transfers in flight :
+ * <ul>
+ * <li>The URLs come from a file (one per line, memory-mapped) or from a generator</li>
+ * <li>The window is a pool of handles, reused from one URL to the next</li>
+ * <li>Every result is handed to a sink - optionally in input order (the window is then also the reorder buffer)</li>
+ * </ul>
+ * The memory used only depends on the window and on the maximum body size, not on the number of URLs.
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_BULK_FETCH_H
+#define INCLUDE_ASYNCURL_BULK_FETCH_H
+
+#include <cstddef>    // size_t
+#include <cstdint>    // uint64_t
+#include <functional> // std::function
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace asyncurl
+{
+class handle;
+class mhandle;
+
+/*********************************************************************************************************************/
+class bulk_fetch
+{
+public:
+    /**
+     * @brief BF_RetCode describes the return codes of the asyncurl::bulk_fetch class methods
+     */
+    typedef enum
+    {
+        BF_OK = 0,    /*!< OK */
+        BF_BAD_PARAM, /*!< An invalid parameter was passed to a function */
+        BF_RUNNING,   /*!< The fetch is running */
+        BF_NO_INPUT,  /*!< No input was set */
+        BF_IO_ERROR,  /*!< The input file could not be mapped */
+        BF_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } BF_RetCode;
+
+    /**
+     * @brief fetch_result is the outcome of a URL, handed to the sink
+     * @warning The views are only valid during the call of the sink
+     */
+    struct fetch_result
+    {
+        uint64_t         index;         /*!< Position of the URL in the input */
+        std::string_view url;           /*!< The URL */
+        int              code;          /*!< Result of the transfer (CURLcode) */
+        long             response_code; /*!< Last response code of the transfer */
+        std::string_view body;          /*!< Body of the response */
+    };
+
+    /**
+     * @brief fetch_stats is a snapshot of the progress of the fetch (\see bulk_fetch::stats)
+     */
+    struct fetch_stats
+    {
+        uint64_t read;      /*!< URLs read from the input */
+        uint64_t emitted;   /*!< Results handed to the sink */
+        uint64_t failed;    /*!< Results with a curl error or an HTTP response >= 400 */
+        size_t   in_flight; /*!< Transfers currently running */
+        size_t   buffered;  /*!< Results completed but waiting for the previous ones (ordered output) */
+    };
+
+    using TGenerator = std::function<bool(std::string& url)>;
+    using TConfigure = std::function<void(handle&, std::string_view url)>;
+    using TSink      = std::function<void(const fetch_result&)>;
+    using TCbDone    = std::function<void(const fetch_stats&)>;
+
+private:
+    struct slot
+    {
+        std::unique_ptr<handle> h{};
+        uint64_t                index{ 0 };
+        std::string             url{};
+        std::string             body{};
+        int                     code{ 0 };
+        long                    response_code{ 0 };
+        bool                    busy{ false }; /*!< Holds a URL (running, or completed but not emitted yet) */
+        bool                    done{ false }; /*!< Completed, waiting to be emitted */
+    };
+
+    mhandle&            session__;
+    std::vector<slot>   slots__{};
+    std::vector<size_t> free__{}; /*!< Free slots (unordered output) */
+    bool                ordered__{ false };
+    size_t              max_body__{ 1024 * 1024 };
+
+    TGenerator generator__{};
+    TConfigure configure__{};
+    TSink      sink__{};
+    TCbDone    cb_done__{};
+
+    const char* map__{ nullptr }; /*!< Memory-mapped input file */
+    size_t      map_size__{ 0 };
+    size_t      map_pos__{ 0 };      /*!< Read cursor in the input file */
+    size_t      map_released__{ 0 }; /*!< Pages of the input file already released (before the cursor) */
+    bool        mapped__{ false };   /*!< Whether the input is a file */
+
+    uint64_t read__{ 0 };
+    uint64_t emitted__{ 0 };
+    uint64_t failed__{ 0 };
+    size_t   in_flight__{ 0 };
+    size_t   buffered__{ 0 };
+    bool     exhausted__{ false };
+    bool     started__{ false };
+    bool     pumping__{ false };
+
+    bulk_fetch(const bulk_fetch&) = delete;
+    bulk_fetch& operator=(const bulk_fetch&) = delete;
+    bulk_fetch(bulk_fetch&&)                 = delete;
+    bulk_fetch& operator=(bulk_fetch&&) = delete;
+
+    bool next_url(std::string& url) noexcept;
+    void pump(void) noexcept;
+    void launch(slot&) noexcept;
+    void completed(size_t, int result) noexcept;
+    void emit(slot&) noexcept;
+    void unmap(void) noexcept;
+
+public:
+    explicit bulk_fetch(mhandle& session, size_t window = 64, bool ordered = false);
+    ~bulk_fetch() noexcept;
+
+    BF_RetCode open_file(const std::string& path) noexcept;
+    BF_RetCode set_generator(const TGenerator&) noexcept;
+    BF_RetCode set_configure(const TConfigure&) noexcept;
+    BF_RetCode set_max_body(size_t) noexcept;
+
+    BF_RetCode start(const TSink& sink, const TCbDone& cb) noexcept;
+    void       stop(void) noexcept;
+
+    bool        running(void) const noexcept { return started__; }
+    fetch_stats stats(void) const noexcept { return { read__, emitted__, failed__, in_flight__, buffered__ }; }
+
+    static std::string_view retCode2Str(BF_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_BULK_FETCH_H
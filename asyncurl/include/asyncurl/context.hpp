@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file context.hpp
+ * @brief Deadline and cancellation scope of a group of transfers
+ *
+ * A context groups the transfers performed on behalf of a same request (e.g. the sub-requests of a fan-out) :
+ * <ul>
+ * <li>Transfers are attached to a context when they are added to the session (\see mhandle::add_handle)</li>
+ * <li>Cancelling the context completes all its running and queued transfers at once (HDL_CANCELLED)</li>
+ * <li>When the deadline of the context expires, the same happens (CURLE_OPERATION_TIMEDOUT) - the deadlines are
+ * tracked by the session, with a single timer whatever the number of contexts</li>
+ * <li>A child context expires and is cancelled with its parent (but not the other way around)</li>
+ * </ul>
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_CONTEXT_H
+#define INCLUDE_ASYNCURL_CONTEXT_H
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <string_view>
+
+namespace asyncurl
+{
+class handle;
+class mhandle;
+
+/*********************************************************************************************************************/
+class context
+{
+    friend class mhandle;
+
+public:
+    /**
+     * @brief CTX_RetCode describes the return codes of the asyncurl::context class methods
+     */
+    typedef enum
+    {
+        CTX_OK = 0,    /*!< OK */
+        CTX_BAD_PARAM, /*!< An invalid parameter was passed to a function */
+        CTX_DONE,      /*!< The context is already cancelled (or expired) */
+        CTX_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } CTX_RetCode;
+
+private:
+    mhandle& session__;
+    context* parent__{ nullptr };
+    context* children__{ nullptr };     /*!< First child context (intrusive list) */
+    context* sibling_prev__{ nullptr }; /*!< Previous context in the children list of the parent */
+    context* sibling_next__{ nullptr }; /*!< Next context in the children list of the parent */
+    handle*  handles__{ nullptr };      /*!< First attached transfer (intrusive list) */
+    size_t   size__{ 0 };               /*!< Number of attached transfers */
+    int64_t  deadline_us__{ 0 };        /*!< Own deadline (monotonic time) - 0 meaning none */
+    int      result__{ 0 };             /*!< Result the context was completed with - 0 while it is active */
+
+    context(const context&) = delete;
+    context& operator=(const context&) = delete;
+    context(context&&)                 = delete;
+    context& operator=(context&&) = delete;
+
+    void attach(handle&) noexcept;
+    void detach(handle&) noexcept;
+    void complete(int result) noexcept;
+
+public:
+    explicit context(mhandle& session, long timeout_ms = 0);
+    explicit context(context& parent, long timeout_ms = 0);
+    ~context() noexcept;
+
+    void        cancel(void) noexcept;
+    CTX_RetCode set_timeout(long timeout_ms) noexcept;
+
+    int64_t deadline_us(void) const noexcept;
+    long    remaining_ms(void) const noexcept;
+    int     result(void) const noexcept { return result__; }
+    bool    done(void) const noexcept { return 0 != result__; }
+    size_t  size(void) const noexcept { return size__; }
+    auto&   session(void) noexcept { return session__; }
+
+    static std::string_view retCode2Str(CTX_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_CONTEXT_H
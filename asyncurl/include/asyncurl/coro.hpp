@@ -0,0 +1,430 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file coro.hpp
+ * @brief Coroutine interface of the sessions - awaitable transfers
+ *
+ * <ul>
+ * <li>\a co_await \a session.fetch(h) adds the transfer to the session, and resumes the coroutine (on the loop thread)
+ * once it completed, with its result and response code</li>
+ * <li>\a asyncurl::task<T> is a lazily started coroutine, that can be awaited by another one. Its frames are allocated
+ * from a per-thread pool</li>
+ * <li>Destroying a task suspended on a transfer cancels it : the transfer is removed from the session</li>
+ * <li>\a session.stream(h) streams the body of a transfer : \a co_await \a s.next() resumes the coroutine with each
+ * chunk received, the transfer being paused while the coroutine does not ask for the next one</li>
+ * </ul>
+ * The library is built as C++17 : the awaiter is usable from any C++20 coroutine type, while \a asyncurl::task is only
+ * available to C++20 translation units.
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_CORO_H
+#define INCLUDE_ASYNCURL_CORO_H
+
+#include <cstddef>     // size_t
+#include <optional>
+#include <string_view>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <array>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <utility>
+#include <vector>
+#define ASYNCURL_HAS_COROUTINES 1
+#endif
+
+namespace asyncurl
+{
+class context;
+class handle;
+class mhandle;
+
+/*********************************************************************************************************************/
+/**
+ * @brief completion_hook is notified by the session of the completion of a transfer, after its done callback
+ */
+class completion_hook
+{
+    friend class mhandle;
+
+protected:
+    ~completion_hook() = default;
+
+    virtual void completed(int result) noexcept = 0;
+};
+
+/*********************************************************************************************************************/
+/**
+ * @brief transfer_awaiter is the awaitable returned by mhandle::fetch
+ *
+ * @warning The transfer must not be removed from the session (nor destroyed) while awaited : destroy the awaiting
+ * coroutine instead
+ */
+class transfer_awaiter : private completion_hook
+{
+    friend class mhandle;
+
+public:
+    /**
+     * @brief result is the outcome of an awaited transfer
+     */
+    struct result
+    {
+        int  code;          /*!< Result of the transfer (CURLcode, or a handle::HDL_RetCode) */
+        long response_code; /*!< Last response code of the transfer */
+    };
+
+private:
+    mhandle& session__;
+    handle&  h__;
+    context* ctx__;
+    void*    frame__{ nullptr };        /*!< Frame of the awaiting coroutine */
+    void (*resume__)(void*){ nullptr }; /*!< Resumes the awaiting coroutine (type-erased coroutine handle) */
+    result   result__{ 0, 0 };
+    bool     pending__{ false };  /*!< Added to the session, not completed yet */
+    bool     starting__{ false }; /*!< Being added to the session (a completion must not resume the coroutine) */
+
+    transfer_awaiter(mhandle& session, handle& h, context* ctx) noexcept
+      : session__{ session }
+      , h__{ h }
+      , ctx__{ ctx }
+    {}
+
+    transfer_awaiter(const transfer_awaiter&) = delete;
+    transfer_awaiter& operator=(const transfer_awaiter&) = delete;
+    transfer_awaiter(transfer_awaiter&&)                 = delete;
+    transfer_awaiter& operator=(transfer_awaiter&&) = delete;
+
+    bool start(void) noexcept;
+    void completed(int result) noexcept override;
+
+public:
+    ~transfer_awaiter() noexcept;
+
+    bool await_ready(void) const noexcept { return false; }
+
+    template<typename C>
+    bool await_suspend(C coro) noexcept
+    {
+        frame__  = coro.address();
+        resume__ = [](void* frame) { C::from_address(frame).resume(); };
+        return start();
+    }
+
+    result await_resume(void) const noexcept { return result__; }
+};
+
+/*********************************************************************************************************************/
+/**
+ * @brief body_stream is the asynchronous sequence of the chunks of a response body, returned by mhandle::stream
+ *
+ * \a while \a (auto \a chunk \a = \a co_await \a s.next()) gets the chunks as they are received, then std::nullopt
+ * once the transfer completed (\see body_stream::result). The transfer is added to the session by the first call to
+ * next, and paused (CURLPAUSE_RECV) while the coroutine does not wait for the next chunk.
+ *
+ * A chunk points into the buffer of curl, and is only valid until the next call to next. The coroutine is resumed with
+ * it from the write callback of the transfer : up to its next suspension, it must not add transfers to the session nor
+ * remove them (awaiting a timer, or the next chunk, is fine).
+ * Destroying the stream before the end of the transfer cancels it : it is removed from the session (or aborted with
+ * CURLE_WRITE_ERROR if a chunk is being handled).
+ *
+ * @warning The stream owns the write callback of the transfer
+ */
+class body_stream : private completion_hook
+{
+    friend class mhandle;
+
+private:
+    mhandle&         session__;
+    handle&          h__;
+    context*         ctx__;
+    void*            frame__{ nullptr }; /*!< Frame of the awaiting coroutine */
+    void (*resume__)(void*){ nullptr };  /*!< Resumes the awaiting coroutine (type-erased coroutine handle) */
+    std::string_view chunk__{};          /*!< Chunk being delivered */
+    bool             has_chunk__{ false };
+    bool             waiting__{ false };    /*!< The coroutine waits for the next chunk */
+    bool             delivering__{ false }; /*!< The coroutine is resumed from the write callback */
+    bool             started__{ false };    /*!< Added to the session */
+    bool             finished__{ false };
+    int              result__{ 0 };
+    long             response_code__{ 0 };
+
+    body_stream(mhandle& session, handle& h, context* ctx) noexcept
+      : session__{ session }
+      , h__{ h }
+      , ctx__{ ctx }
+    {}
+
+    void pull(void) noexcept;
+    void finish(int result) noexcept;
+    void completed(int result) noexcept override;
+
+public:
+    /**
+     * @brief next_awaiter is the awaitable returned by body_stream::next
+     */
+    class next_awaiter
+    {
+        friend class body_stream;
+
+    private:
+        body_stream& s__;
+
+        explicit next_awaiter(body_stream& s) noexcept
+          : s__{ s }
+        {}
+
+    public:
+        bool await_ready(void) const noexcept { return s__.finished__; }
+
+        template<typename C>
+        void await_suspend(C coro) noexcept
+        {
+            s__.frame__   = coro.address();
+            s__.resume__  = [](void* frame) { C::from_address(frame).resume(); };
+            s__.waiting__ = true;
+            s__.pull(); // May resume the coroutine : nothing is touched afterwards
+        }
+
+        std::optional<std::string_view> await_resume(void) noexcept
+        {
+            if (!s__.has_chunk__) return std::nullopt;
+
+            s__.has_chunk__ = false;
+            return s__.chunk__;
+        }
+    };
+
+    body_stream(const body_stream&) = delete;
+    body_stream& operator=(const body_stream&) = delete;
+    body_stream(body_stream&&)                 = delete;
+    body_stream& operator=(body_stream&&) = delete;
+    ~body_stream() noexcept;
+
+    next_awaiter next(void) noexcept { return next_awaiter{ *this }; }
+
+    bool done(void) const noexcept { return finished__; }
+    int  result(void) const noexcept { return result__; }               /*!< CURLcode, or a handle::HDL_RetCode */
+    long response_code(void) const noexcept { return response_code__; } /*!< Last response code of the transfer */
+};
+
+#ifdef ASYNCURL_HAS_COROUTINES
+/*********************************************************************************************************************/
+/**
+ * @brief frame_pool recycles the coroutine frames of the tasks (per thread, by size classes)
+ */
+class frame_pool
+{
+private:
+    static constexpr size_t GRANULARITY = 128; /*!< Size classes step (bytes) */
+    static constexpr size_t CLASSES     = 32;  /*!< Frames larger than CLASSES * GRANULARITY are not pooled */
+    static constexpr size_t DEPTH       = 64;  /*!< Maximum number of free frames per size class */
+
+    static std::array<std::vector<void*>, CLASSES>& free_lists(void) noexcept
+    {
+        struct lists
+        {
+            std::array<std::vector<void*>, CLASSES> l{};
+            ~lists()
+            {
+                for (auto& v : l)
+                    for (auto p : v)
+                        ::operator delete(p);
+            }
+        };
+        thread_local lists ret;
+        return ret.l;
+    }
+
+public:
+    static void* allocate(size_t size)
+    {
+        const auto c{ (size + GRANULARITY - 1) / GRANULARITY };
+        if (CLASSES < c) return ::operator new(size);
+
+        auto& l{ free_lists()[c - 1] };
+        if (std::empty(l)) return ::operator new(c * GRANULARITY);
+
+        auto ret{ l.back() };
+        l.pop_back();
+        return ret;
+    }
+
+    static void release(void* p, size_t size) noexcept
+    {
+        const auto c{ (size + GRANULARITY - 1) / GRANULARITY };
+        if (CLASSES < c)
+        {
+            ::operator delete(p);
+            return;
+        }
+
+        auto& l{ free_lists()[c - 1] };
+        try
+        {
+            l.reserve(DEPTH); // Never grows afterwards
+        }
+        catch (const std::bad_alloc&)
+        {
+        }
+
+        if (DEPTH <= std::size(l) || std::size(l) == l.capacity())
+        {
+            ::operator delete(p);
+            return;
+        }
+        l.push_back(p);
+    }
+};
+
+/*********************************************************************************************************************/
+template<typename T = void>
+class task;
+
+namespace detail
+{
+struct task_promise_base
+{
+    std::coroutine_handle<> continuation{}; /*!< Coroutine awaiting the task (if any) */
+    std::exception_ptr      error{};
+
+    struct final_awaiter
+    {
+        bool await_ready(void) const noexcept { return false; }
+
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> coro) noexcept
+        {
+            auto c{ coro.promise().continuation };
+            return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume(void) const noexcept {}
+    };
+
+    std::suspend_always initial_suspend(void) const noexcept { return {}; }
+    final_awaiter       final_suspend(void) const noexcept { return {}; }
+    void                unhandled_exception(void) noexcept { error = std::current_exception(); }
+
+    static void* operator new(size_t size) { return frame_pool::allocate(size); }
+    static void  operator delete(void* p, size_t size) noexcept { frame_pool::release(p, size); }
+};
+
+template<typename T>
+struct task_promise : task_promise_base
+{
+    std::optional<T> value{};
+
+    task<T> get_return_object(void) noexcept;
+    void    return_value(T v) { value.emplace(std::move(v)); }
+
+    T take(void)
+    {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct task_promise<void> : task_promise_base
+{
+    task<void> get_return_object(void) noexcept;
+    void       return_void(void) noexcept {}
+
+    void take(void)
+    {
+        if (error) std::rethrow_exception(error);
+    }
+};
+} // namespace detail
+
+/**
+ * @brief task is a lazily started coroutine returning a T
+ *
+ * A task is started either by being awaited (\a co_await returns its value, or rethrows its exception), or by
+ * task::start for the outermost one. Destroying a task destroys its frame, cancelling the transfer it awaits (if any).
+ */
+template<typename T>
+class task
+{
+public:
+    using promise_type = detail::task_promise<T>;
+
+private:
+    std::coroutine_handle<promise_type> coro__{};
+
+public:
+    explicit task(std::coroutine_handle<promise_type> coro) noexcept
+      : coro__{ coro }
+    {}
+    task(task&& o) noexcept
+      : coro__{ std::exchange(o.coro__, {}) }
+    {}
+    task& operator=(task&& o) noexcept
+    {
+        if (this != &o)
+        {
+            if (coro__) coro__.destroy();
+            coro__ = std::exchange(o.coro__, {});
+        }
+        return *this;
+    }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() noexcept
+    {
+        if (coro__) coro__.destroy();
+    }
+
+    /**
+     * @brief start - Run the task until its first suspension (outermost task only)
+     */
+    void start(void) noexcept
+    {
+        if (coro__ && !coro__.done()) coro__.resume();
+    }
+
+    bool done(void) const noexcept { return !coro__ || coro__.done(); }
+
+    /**
+     * @brief get - Get the value of a completed task (rethrows its exception)
+     */
+    T get(void) { return coro__.promise().take(); }
+
+    bool await_ready(void) const noexcept { return done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        coro__.promise().continuation = awaiting;
+        return coro__; // Symmetric transfer : starts the task
+    }
+
+    T await_resume(void) { return coro__.promise().take(); }
+};
+
+namespace detail
+{
+template<typename T>
+task<T>
+task_promise<T>::get_return_object(void) noexcept
+{
+    return task<T>{ std::coroutine_handle<task_promise<T>>::from_promise(*this) };
+}
+
+inline task<void>
+task_promise<void>::get_return_object(void) noexcept
+{
+    return task<void>{ std::coroutine_handle<task_promise<void>>::from_promise(*this) };
+}
+} // namespace detail
+#endif // ASYNCURL_HAS_COROUTINES
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_CORO_H
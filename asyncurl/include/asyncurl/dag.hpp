@@ -0,0 +1,160 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file dag.hpp
+ * @brief Dependency-graph execution of chained transfers (e.g. token, then listing, then N fetches, then aggregate)
+ *
+ * A dag is a set of nodes, each of them building a transfer out of the results of its parents :
+ * <ul>
+ * <li>A node is started as soon as all its parents succeeded, independent nodes running concurrently (up to a
+ * limit) - the ready nodes heading the longest chains are started first</li>
+ * <li>A node fails if its transfer fails (curl error or HTTP response >= 400), or if its builder refuses to build it.
+ * Its descendants are then skipped</li>
+ * <li>The timing of every node and the critical path of the execution are reported (\see dag::report)</li>
+ * </ul>
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_DAG_H
+#define INCLUDE_ASYNCURL_DAG_H
+
+#include <cstddef>    // size_t
+#include <cstdint>    // int64_t
+#include <functional> // std::function
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace asyncurl
+{
+class handle;
+class mhandle;
+class context;
+
+/*********************************************************************************************************************/
+class dag
+{
+public:
+    using node_id = size_t;
+
+    /**
+     * @brief DAG_RetCode describes the return codes of the asyncurl::dag class methods
+     */
+    typedef enum
+    {
+        DAG_OK = 0,    /*!< OK */
+        DAG_BAD_PARAM, /*!< An invalid parameter was passed to a function (e.g. an unknown parent) */
+        DAG_RUNNING,   /*!< The graph is being executed */
+        DAG_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } DAG_RetCode;
+
+    /**
+     * @brief node_state describes the progress of a node
+     */
+    typedef enum
+    {
+        NODE_PENDING = 0, /*!< Waiting for its parents */
+        NODE_READY,       /*!< Waiting for a concurrency slot */
+        NODE_RUNNING,     /*!< Its transfer is running */
+        NODE_SUCCEEDED,   /*!< Its transfer succeeded */
+        NODE_FAILED,      /*!< Its transfer failed (or could not be built) */
+        NODE_SKIPPED      /*!< One of its ancestors failed */
+    } node_state;
+
+    /**
+     * @brief node_result is the outcome of a node, handed to the builders of its children
+     */
+    struct node_result
+    {
+        node_state  state{ NODE_PENDING };
+        int         code{ 0 };          /*!< Result of the transfer (CURLcode, or a handle::HDL_RetCode) */
+        long        response_code{ 0 }; /*!< Last response code of the transfer */
+        std::string body{};             /*!< Body received (unless the builder set its own write callback) */
+        int64_t     wait_us{ 0 };       /*!< Time spent ready, waiting for a concurrency slot */
+        int64_t     duration_us{ 0 };   /*!< Duration of the transfer */
+    };
+
+    /**
+     * @brief dag_report is the outcome of an execution (\see dag::report)
+     */
+    struct dag_report
+    {
+        size_t               succeeded{ 0 };
+        size_t               failed{ 0 };
+        size_t               skipped{ 0 };
+        int64_t              elapsed_us{ 0 };       /*!< Duration of the whole execution */
+        int64_t              critical_path_us{ 0 }; /*!< Sum of the durations of the nodes of the critical path */
+        std::vector<node_id> critical_path{};       /*!< Longest chain of executed nodes (durations-wise) */
+    };
+
+    /**
+     * @brief A builder configures the transfer of a node, out of the results of its parents (in the order of the
+     * declaration). Returning false fails the node.
+     */
+    using TBuilder = std::function<bool(handle&, const std::vector<const node_result*>&)>;
+    using TCbDone  = std::function<void(const dag_report&)>;
+
+private:
+    struct node
+    {
+        TBuilder                builder{};
+        std::vector<node_id>    parents{};
+        std::vector<node_id>    children{};
+        size_t                  waiting{ 0 }; /*!< Parents not completed yet */
+        size_t                  height{ 0 };  /*!< Length of the longest chain of descendants (scheduling priority) */
+        std::unique_ptr<handle> h{};
+        node_result             result{};
+        int64_t                 ready_us{ 0 };
+        int64_t                 start_us{ 0 };
+    };
+
+    mhandle&                                session__;
+    context*                                context__{ nullptr };
+    std::vector<node>                       nodes__{};
+    std::vector<std::pair<size_t, node_id>> ready__{}; /*!< Ready nodes (heap on the height) */
+    size_t                                  max_running__{ 0 };
+    size_t                                  running__{ 0 };
+    size_t                                  completed__{ 0 };
+    int64_t                                 start_us__{ 0 };
+    bool                                    started__{ false };
+    bool                                    pumping__{ false };
+    dag_report                              report__{};
+    TCbDone                                 cb_done__{};
+
+    dag(const dag&) = delete;
+    dag& operator=(const dag&) = delete;
+    dag(dag&&)                 = delete;
+    dag& operator=(dag&&) = delete;
+
+    void make_ready(node_id) noexcept;
+    void launch(node_id) noexcept;
+    void finished(node_id, int code) noexcept;
+    void skip(node_id) noexcept;
+    void pump(void) noexcept;
+    void conclude(void) noexcept;
+
+public:
+    explicit dag(mhandle& session, size_t max_running = 8) noexcept;
+    ~dag() noexcept;
+
+    DAG_RetCode add_node(const TBuilder& builder, const std::vector<node_id>& parents, node_id& id) noexcept;
+    DAG_RetCode start(const TCbDone& cb, context* ctx = nullptr) noexcept;
+    void        cancel(void) noexcept;
+
+    size_t             size(void) const noexcept { return std::size(nodes__); }
+    bool               running(void) const noexcept { return started__; }
+    const node_result* result(node_id) const noexcept;
+    const dag_report&  report(void) const noexcept { return report__; }
+
+    static std::string_view retCode2Str(DAG_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_DAG_H
@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file endpoint_set.hpp
+ * @brief Client-side load balancing of a logical host over a set of replicated endpoints
+ * @see https://curl.se/libcurl/c/CURLOPT_CONNECT_TO.html for more informations
+ *
+ * An endpoint set maps a logical host (hostname + port, as found in the transfers URLs) to N endpoints.
+ * Once registered in a session (\see mhandle::add_endpoint_set), every transfer targetting the logical host is routed
+ * to one of the endpoints :
+ * <ul>
+ * <li>The endpoint is chosen with the power-of-two-choices algorithm, weighting outstanding requests by the EWMA of
+ * the observed latencies</li>
+ * <li>Endpoints failing repeatedly are ejected for an increasing amount of time (outlier ejection)</li>
+ * <li>The routing is applied using CURLOPT_CONNECT_TO, so the TLS SNI and Host header are left untouched</li>
+ * </ul>
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_ENDPOINT_SET_H
+#define INCLUDE_ASYNCURL_ENDPOINT_SET_H
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace asyncurl
+{
+class mhandle;
+
+/*********************************************************************************************************************/
+class endpoint_set
+{
+    friend class mhandle;
+
+public:
+    /**
+     * @brief ES_RetCode describes the return codes of the asyncurl::endpoint_set class methods
+     */
+    typedef enum
+    {
+        ES_OK = 0,    /*!< OK */
+        ES_BAD_PARAM, /*!< An invalid parameter was passed to a function */
+        ES_ALREADY,   /*!< The endpoint is already part of the set */
+        ES_UNKNOWN,   /*!< The endpoint is not part of the set */
+        ES_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } ES_RetCode;
+
+    /**
+     * @brief endpoint_stats is a read-only view of the state of an endpoint (\see endpoint_set::stats)
+     */
+    struct endpoint_stats
+    {
+        std::string address;     /*!< The address (IP or hostname) of the endpoint */
+        long        port;        /*!< The port of the endpoint */
+        long        outstanding; /*!< Number of transfers currently routed to the endpoint */
+        double      ewma_us;     /*!< EWMA of the transfers total time (microseconds) */
+        bool        ejected;     /*!< Whether the endpoint is currently ejected */
+        uint64_t    requests;    /*!< Number of transfers routed to the endpoint so far */
+        uint64_t    failures;    /*!< Number of failed transfers so far */
+    };
+
+private:
+    struct endpoint
+    {
+        std::string address{};
+        long        port{ 0 };
+        std::string connect_to{}; /*!< Pre-computed CURLOPT_CONNECT_TO entry */
+        bool        removed{ false };
+        long        outstanding{ 0 };
+        double      ewma_us{ 0 };
+        long        consecutive_failures{ 0 };
+        long        ejections{ 0 };
+        int64_t     ejected_until_us{ 0 };
+        uint64_t    requests{ 0 };
+        uint64_t    failures{ 0 };
+    };
+
+    mhandle*              multi_handler__{ nullptr };
+    std::string           host__{};
+    long                  port__{ 0 };
+    std::vector<endpoint> endpoints__{}; /*!< Endpoints slots - indexes are stable (removed slots are recycled) */
+    std::vector<long>     live__{};      /*!< Indexes of the endpoints that can be selected */
+    std::minstd_rand      rng__{ std::random_device{}() };
+
+    double ewma_alpha__{ 0.3 };
+    long   eject_failures__{ 5 };
+    long   eject_base_ms__{ 30000 };
+    double eject_max_ratio__{ 0.5 };
+
+    endpoint_set(const endpoint_set&) = delete;
+    endpoint_set& operator=(const endpoint_set&) = delete;
+    endpoint_set(endpoint_set&&)                 = delete;
+    endpoint_set& operator=(endpoint_set&&) = delete;
+
+    static bool available(const endpoint&, int64_t now_us) noexcept;
+    long pick(int64_t now_us) noexcept;
+    void release(long idx, bool sample, bool failed, int64_t latency_us, int64_t now_us) noexcept;
+
+public:
+    endpoint_set(const std::string& host, long port);
+    ~endpoint_set() noexcept;
+
+    ES_RetCode add_endpoint(const std::string& address, long port = 0) noexcept;
+    ES_RetCode remove_endpoint(const std::string& address, long port = 0) noexcept;
+
+    ES_RetCode set_ewma_decay(double alpha) noexcept;
+    ES_RetCode set_outlier_ejection(long consecutive_failures, long base_ms, double max_ejected_ratio) noexcept;
+
+    const std::string&          host(void) const noexcept { return host__; }
+    long                        port(void) const noexcept { return port__; }
+    size_t                      size(void) const noexcept { return std::size(live__); }
+    std::vector<endpoint_stats> stats(void) const;
+
+    static std::string_view retCode2Str(ES_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_ENDPOINT_SET_H
@@ -29,16 +29,32 @@
 #include <map>
 #include <string>
 #include <string_view>
+#include <vector>
+
+#include "list.hpp"
+#include "progress.hpp"
 
 namespace asyncurl
 {
 class mhandle;
-class list;
+class context;
+class endpoint_set;
+class poller;
+class socket_factory;
+class completion_hook;
+class transfer_awaiter;
+class body_stream;
+struct gather_state;
+struct tag_group;
 
 /*********************************************************************************************************************/
 class handle
 {
     friend class mhandle;
+    friend class context;
+    friend class poller;
+    friend class transfer_awaiter;
+    friend class body_stream;
 
 public:
     using TCbWrite    = std::function<size_t(char*, size_t)>;
@@ -53,12 +69,14 @@ public:
      */
     typedef enum
     {
+        HDL_CANCELLED     = -2, /*!< In case the handle is attached to a context, the cancellation of the context */
         HDL_MULTI_STOPPED = -1, /*!< In case the handle is associated to a multi session, the end of the session */
         HDL_OK            = 0,  /*!< OK */
         HDL_BAD_PARAM,          /*!< An invalid parameter was passed to a function */
         HDL_BAD_FUNCTION,       /*!< A function has been called when it should not be */
         HDL_OUT_OF_MEM,         /*!< An dynamic allocation call failed (you were probably too greedy) */
-        HDL_INTERNAL_ERROR      /*!< Internal error */
+        HDL_INTERNAL_ERROR,     /*!< Internal error */
+        HDL_TIMEOUT             /*!< The deadline of a set of transfers expired (\see handle::perform_all) */
     } HDL_RetCode;
 
     /**
@@ -85,6 +103,55 @@ private:
     TCbHeader   cb_header__{ nullptr };
     TCbDebug    cb_debug__{ nullptr };
     TCbDone     cb_done__{ nullptr };
+    TCbDone     cb_notify__{ nullptr }; /*!< Internal completion hook, called before cb_done__ */
+
+    poller*         poller__{ nullptr };         /*!< Poller re-running the transfer periodically (if any) */
+    socket_factory* socket_factory__{ nullptr }; /*!< Factory of the sockets (the session one if not set) */
+
+    endpoint_set* lb_set__{ nullptr }; /*!< Endpoint set the transfer is routed through (if any) */
+    long          lb_endpoint__{ -1 }; /*!< Index of the endpoint (in lb_set__) the transfer is routed to */
+    list          lb_connect_to__{};   /*!< CURLOPT_CONNECT_TO list used to route the transfer */
+
+    gather_state*    gather__{ nullptr };  /*!< Scatter-gather the transfer is part of (if any) */
+    completion_hook* awaiter__{ nullptr }; /*!< Coroutine awaiting the completion of the transfer (if any) */
+
+    std::string tag__{};                /*!< Tag of the transfer (\see mhandle::cancel_tag) */
+    tag_group*  tag_group__{ nullptr }; /*!< Transfers of the session sharing the tag (intrusive list) */
+    handle*     tag_prev__{ nullptr };
+    handle*     tag_next__{ nullptr };
+    uint64_t    tag_seq__{ 0 }; /*!< Linking order in the group */
+
+    context* ctx__{ nullptr };      /*!< Context the transfer is attached to (if any) */
+    handle*  ctx_prev__{ nullptr }; /*!< Previous transfer attached to the same context */
+    handle*  ctx_next__{ nullptr }; /*!< Next transfer attached to the same context */
+
+    handle* queue_prev__{ nullptr }; /*!< Previous transfer in the session admission queue */
+    handle* queue_next__{ nullptr }; /*!< Next transfer in the session admission queue */
+    bool    queued__{ false };       /*!< Whether the transfer waits in the session admission queue */
+
+    long   bw_weight__{ 1 };          /*!< Weight of the transfer in the session bandwidth budget */
+    bool   bw_governed__{ false };    /*!< Whether the transfer is governed by a session bandwidth budget */
+    int    bw_paused__{ 0 };          /*!< Directions paused by the session bandwidth budget (CURLPAUSE_*) */
+    double bw_allowance__[2]{ 0, 0 }; /*!< Bytes left to transfer in the current period (receive, send) */
+    double bw_used__[2]{ 0, 0 };      /*!< Bytes transferred in the current period (receive, send) */
+    double bw_share__[2]{ 0, 0 };     /*!< Rate granted by the session (receive, send) - bytes/s */
+
+    progress progress__{};       /*!< Progress of the current transfer, readable from any thread */
+    int64_t  added_us__{ 0 };    /*!< Addition to the session - 0 once handed over to curl */
+
+    uint64_t    rx_bytes__{ 0 };          /*!< Body bytes delivered to the write callback by the current transfer */
+    std::string strg_origin__{};          /*!< Origin ("host:port") the transfer is compared against */
+    int64_t     strg_start_us__{ 0 };     /*!< First throughput sample of the transfer - 0 when not sampled yet */
+    int64_t     strg_last_us__{ 0 };      /*!< Last throughput sample */
+    uint64_t    strg_last_bytes__{ 0 };   /*!< rx_bytes__ at the last sample */
+    double      strg_rate__{ -1 };        /*!< Smoothed throughput (bytes/s) - negative when unknown */
+    handle*     strg_twin__{ nullptr };   /*!< Reissue of the transfer - or for a reissue, the original transfer */
+    uint64_t    strg_base__{ 0 };         /*!< Body offset the reissue resumes from */
+    uint64_t    strg_received__{ 0 };     /*!< Body bytes received by the reissue */
+    bool        strg_reissue__{ false };  /*!< Whether the transfer is a reissue (owned by the session) */
+    bool        strg_reissued__{ false }; /*!< Whether the transfer has already been reissued */
+    bool        strg_won__{ false };      /*!< Whether the reissue overtook the original transfer */
+    int         strg_paused__{ 0 };       /*!< Directions paused since the reissue overtook it (CURLPAUSE_*) */
 
     handle(const handle&) = delete;
     handle& operator=(const handle&) = delete;
@@ -93,6 +160,10 @@ private:
 
     handle(void*);
 
+    HDL_RetCode route_to(const std::string& connect_to) noexcept;
+    void        unroute(void) noexcept;
+    bool        routed(void) const noexcept { return nullptr != lb_connect_to__.head__; }
+
 protected:
     HDL_RetCode get_info_long(int, long&) const noexcept;
     HDL_RetCode get_info_socket(int, uint64_t&) const noexcept;
@@ -122,8 +193,21 @@ public:
     HDL_RetCode set_cb_debug(const TCbDebug&) noexcept;
     HDL_RetCode set_cb_done(const TCbDone&) noexcept;
 
+    HDL_RetCode set_bandwidth_weight(long) noexcept;
+    HDL_RetCode set_socket_factory(socket_factory*) noexcept;
+    HDL_RetCode set_tag(std::string_view) noexcept;
+    HDL_RetCode set_tag(int64_t) noexcept;
+
+    const std::string& tag(void) const noexcept { return tag__; }
+
+    progress::snapshot get_progress(void) const noexcept { return progress__.read(); }
+
     HDL_RetCode perform_blocking(void) noexcept;
-    void        reset(void) noexcept;
+
+    static HDL_RetCode perform_all(const std::vector<handle*>& handles, size_t max_parallel, std::vector<int>& results,
+                                   long timeout_ms = 0) noexcept;
+
+    void reset(void) noexcept;
 
     bool pause(int bitmask) noexcept;
     bool unpause(int bitmask) noexcept;
@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file latency.hpp
+ * @brief Log-linear latency histograms (HDR style)
+ *
+ * The values (microseconds) are counted in buckets whose width doubles every 32 buckets : the relative error stays
+ * below ~3% from the microsecond up to ~19 hours, with a fixed number of buckets.
+ * <ul>
+ * <li>Recording is lock-free and never allocates : it may happen on any thread</li>
+ * <li>A snapshot copies the counters into caller storage, and snapshots merge (e.g. across sessions and threads)</li>
+ * </ul>
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_LATENCY_H
+#define INCLUDE_ASYNCURL_LATENCY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <string_view>
+
+namespace asyncurl
+{
+/**
+ * @brief latency_snapshot is a plain copy of a latency histogram (\see latency_histogram::snapshot)
+ */
+struct latency_snapshot
+{
+    static constexpr size_t BUCKETS{ 1024 };
+
+    std::array<uint64_t, BUCKETS> counts{}; /*!< Values counted per bucket */
+    uint64_t                      count{ 0 };
+    int64_t                       sum{ 0 };  /*!< Sum of the values (microseconds) */
+    int64_t                       min{ -1 }; /*!< Smallest value - negative when empty */
+    int64_t                       max{ -1 }; /*!< Largest value - negative when empty */
+
+    void    merge(const latency_snapshot&) noexcept;
+    double  mean(void) const noexcept;
+    int64_t percentile(double p) const noexcept;
+
+    static size_t  bucket_of(int64_t us) noexcept;
+    static int64_t bucket_high(size_t bucket) noexcept;
+};
+
+/*********************************************************************************************************************/
+class latency_histogram
+{
+public:
+    /**
+     * @brief LAT_Phase describes the phases of the transfers measured by the sessions (\see mhandle::get_latency)
+     */
+    typedef enum
+    {
+        LAT_QUEUE_WAIT = 0, /*!< From mhandle::add_handle to the hand-over to curl (admission) */
+        LAT_NAMELOOKUP,     /*!< Name resolution done (CURLINFO_NAMELOOKUP_TIME_T) */
+        LAT_CONNECT,        /*!< Connected to the peer (CURLINFO_CONNECT_TIME_T) */
+        LAT_APPCONNECT,     /*!< TLS handshake done (CURLINFO_APPCONNECT_TIME_T) */
+        LAT_PRETRANSFER,    /*!< About to send the request (CURLINFO_PRETRANSFER_TIME_T) */
+        LAT_STARTTRANSFER,  /*!< First response byte received (CURLINFO_STARTTRANSFER_TIME_T) */
+        LAT_TOTAL,          /*!< Transfer completed (CURLINFO_TOTAL_TIME_T) */
+        LAT_PHASES          /*!< Number of phases */
+    } LAT_Phase;
+
+private:
+    std::array<std::atomic<uint64_t>, latency_snapshot::BUCKETS> counts__{};
+    std::atomic<int64_t>                                          sum__{ 0 };
+    std::atomic<int64_t>                                          min__{ -1 };
+    std::atomic<int64_t>                                          max__{ -1 };
+
+    latency_histogram(const latency_histogram&) = delete;
+    latency_histogram& operator=(const latency_histogram&) = delete;
+    latency_histogram(latency_histogram&&)                 = delete;
+    latency_histogram& operator=(latency_histogram&&) = delete;
+
+public:
+    latency_histogram() = default;
+
+    void record(int64_t us) noexcept;
+    void snapshot(latency_snapshot&) const noexcept;
+    void reset(void) noexcept;
+
+    static std::string_view phase2Str(LAT_Phase) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_LATENCY_H
@@ -27,21 +27,39 @@
 #include <functional> // std::function
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include <miniLoop/Loop.h>
 
+#include "latency.hpp"
+#include "progress.hpp"
+
 template<class T>
 using uptr = std::unique_ptr<T>;
 
+struct pollfd;
+
 namespace asyncurl
 {
 class handle;
+class context;
+class endpoint_set;
+class socket_factory;
+class transfer_awaiter;
+class body_stream;
+struct gather_state;
+struct tag_group;
 
 /*********************************************************************************************************************/
 class mhandle
 {
+    friend class context;
+    friend class handle;
+
 public:
     using TCbError = std::function<void(int)>;
 
@@ -58,20 +76,258 @@ public:
         MHDL_REMOVE_ALREADY, /*!< An handle already removed (or never added) was attempted to get removed again */
         MHDL_BAD_HANDLE,     /*!< An handle passed-in is not a valid handle */
         MHDL_OUT_OF_MEM,     /*!< An dynamic allocation call failed (you were probably too greedy) */
-        MHDL_INTERNAL_ERROR  /*!< Internal error */
+        MHDL_INTERNAL_ERROR, /*!< Internal error */
+        MHDL_CONTEXT_DONE    /*!< An handle was attempted to get added to a cancelled (or expired) context */
     } MHDL_RetCode;
 
+    /**
+     * @brief source_stats is a read-only view of a local source address (\see mhandle::source_addresses)
+     */
+    struct source_stats
+    {
+        std::string address;     /*!< The local address */
+        long        connections; /*!< Number of connections currently bound to the address */
+        uint64_t    total;       /*!< Number of connections bound to the address so far */
+    };
+
+    /**
+     * @brief gather_mode describes when a scatter-gather is complete (\see mhandle::gather)
+     */
+    typedef enum
+    {
+        GATHER_ALL = 0,      /*!< All the transfers succeeded */
+        GATHER_QUORUM,       /*!< A given number of transfers succeeded */
+        GATHER_FIRST_SUCCESS /*!< One of the transfers succeeded */
+    } gather_mode;
+
+    /**
+     * @brief gather_policy describes a scatter-gather (\see mhandle::gather)
+     */
+    struct gather_policy
+    {
+        gather_mode mode{ GATHER_ALL };
+        size_t      quorum{ 0 };     /*!< Number of successful transfers needed (GATHER_QUORUM) */
+        long        timeout_ms{ 0 }; /*!< Deadline of the scatter-gather (milliseconds) - 0 meaning none */
+    };
+
+    /**
+     * @brief gather_result is the outcome of a scatter-gather (\see mhandle::gather)
+     */
+    struct gather_result
+    {
+        bool                                 satisfied{ false }; /*!< Whether the policy was satisfied */
+        size_t                               succeeded{ 0 };     /*!< Transfers that succeeded */
+        size_t                               failed{ 0 };        /*!< Transfers that failed (or timed out) */
+        size_t                               cancelled{ 0 };     /*!< Transfers removed once the outcome was known */
+        std::vector<std::pair<handle*, int>> completed{};        /*!< Transfers and results, in completion order */
+    };
+
+    using TCbGather = std::function<void(const gather_result&)>;
+
+    /**
+     * @brief completion is the outcome of a transfer, delivered in batches (\see mhandle::set_cb_completions)
+     */
+    struct completion
+    {
+        handle* h;      /*!< The transfer */
+        int     result; /*!< Result of the transfer (CURLcode or HDL_RetCode) */
+    };
+
+    using TCbCompletions = std::function<void(const std::vector<completion>&)>;
+
+    /**
+     * @brief transfer_progress is the progress of a transfer, as of a session progress report
+     */
+    struct transfer_progress
+    {
+        handle*            h; /*!< The transfer */
+        progress::snapshot p; /*!< Its progress */
+    };
+
+    /**
+     * @brief session_progress is a periodic progress report of a session (\see mhandle::set_cb_progress)
+     */
+    struct session_progress
+    {
+        size_t                         running{ 0 };  /*!< Transfers handed over to curl */
+        size_t                         queued{ 0 };   /*!< Transfers waiting in the admission queue */
+        uint64_t                       rx_bytes{ 0 }; /*!< Body bytes received by the session since its creation */
+        uint64_t                       tx_bytes{ 0 }; /*!< Body bytes sent through read callbacks since its creation */
+        double                         rx_rate{ 0 };  /*!< Body bytes received per second over the last period */
+        double                         tx_rate{ 0 };  /*!< Body bytes sent per second over the last period */
+        std::vector<transfer_progress> transfers{};   /*!< Progress of the running and queued transfers */
+    };
+
+    using TCbProgress = std::function<void(const session_progress&)>;
+
 private:
+    /**
+     * @brief event_budget holds the per-iteration budget of socket events processing (\see mhandle::set_event_budget)
+     */
+    struct event_budget
+    {
+        int64_t  max_us{ 0 };    /*!< Processing time per iteration - 0 meaning unlimited */
+        uint64_t max_bytes{ 0 }; /*!< Body bytes received per iteration - 0 meaning unlimited */
+        int64_t  start_us{ 0 };  /*!< Start of the current iteration */
+        uint64_t start_bytes{ 0 };
+        uint64_t deferred{ 0 }; /*!< Number of socket events deferred so far */
+        bool     open{ false }; /*!< Whether an iteration is being accounted */
+    };
+
+    /**
+     * @brief busy_poll holds the busy-polling mode of the session (\see mhandle::set_busy_poll)
+     */
+    struct busy_poll
+    {
+        long     spin_us{ 0 };   /*!< Spinning window after an activity of curl - 0 meaning disabled */
+        int      socket_us{ 0 }; /*!< SO_BUSY_POLL of the new sockets - 0 meaning not set */
+        uint64_t polls{ 0 };     /*!< Non-blocking polls performed */
+        uint64_t hits{ 0 };      /*!< Socket events found by spinning */
+        uint64_t spent_us{ 0 };  /*!< Time spent spinning */
+        bool     armed{ false };
+    };
+
+    /**
+     * @brief bandwidth_budget holds the session-wide bandwidth budget (\see mhandle::set_bandwidth_limit)
+     */
+    struct bandwidth_budget
+    {
+        int64_t bps[2]{ 0, 0 };   /*!< Budget per direction (receive, send) - bytes/s, 0 meaning unlimited */
+        long    period_ms{ 100 }; /*!< Period of the budget distribution */
+        int64_t last_tick_us{ 0 };
+        long    weights{ 0 }; /*!< Sum of the weights of the governed transfers */
+        bool    armed{ false };
+    };
+
+    /**
+     * @brief connection_ramp holds the slow-start policy of the new connections (\see mhandle::set_connection_ramp)
+     */
+    struct connection_ramp
+    {
+        long    initial{ 0 };        /*!< Initial rate of new connections (per second) - 0 meaning disabled */
+        long    max{ 0 };            /*!< Maximum rate of new connections (per second) */
+        long    doubling_ms{ 1000 }; /*!< Time needed for the rate to double */
+        int64_t start_us{ 0 };       /*!< Start of the current ramp */
+        int64_t last_us{ 0 };        /*!< Last tokens refill */
+        double  tokens{ 0 };         /*!< New connections that can be opened right away */
+        bool    active{ false };
+    };
+
+    /**
+     * @brief source_address is a local address the new connections are bound to (\see mhandle::set_source_addresses)
+     */
+    struct source_address
+    {
+        std::string   address{};
+        int           family{ 0 }; /*!< AF_INET or AF_INET6 */
+        unsigned char bytes[16]{}; /*!< Network-order address */
+        long          connections{ 0 };
+        uint64_t      total{ 0 };
+    };
+
+    /**
+     * @brief fd_budget holds the file descriptors budget of the session (\see mhandle::set_fd_budget)
+     */
+    struct fd_budget
+    {
+        long    limit{ 0 };        /*!< Maximum number of file descriptors held by the session - 0 meaning unlimited */
+        long    effective{ 0 };    /*!< Current limit (lowered after an exhaustion of the process descriptors) */
+        long    maxconnects{ 0 };  /*!< CURLMOPT_MAXCONNECTS set by the user */
+        bool    shrunk{ false };   /*!< Whether the connections cache is currently shrunk */
+        int64_t exhausted_us{ 0 }; /*!< Last exhaustion of the process descriptors (EMFILE/ENFILE) */
+    };
+
+    /**
+     * @brief straggler_policy holds the detection of the slow transfers (\see mhandle::set_straggler_reissue)
+     */
+    struct straggler_policy
+    {
+        double   ratio{ 0 };         /*!< Throughput ratio (to the origin median) of a straggler - 0 meaning disabled */
+        int64_t  min_age_us{ 0 };    /*!< Minimum age of a transfer before it can be considered a straggler */
+        long     sample_ms{ 500 };   /*!< Period of the throughput sampling */
+        size_t   min_peers{ 3 };     /*!< Minimum number of transfers to the same origin to compute a median */
+        uint64_t reissues{ 0 };      /*!< Number of reissued transfers */
+        uint64_t wins{ 0 };          /*!< Number of reissues that completed in place of the original transfer */
+        bool     armed{ false };
+    };
+
     void*                                 curl_multi__{ nullptr }; /*!< Raw curl multi-handle (CURL::CURLM) */
     std::map<void*, handle*>              handles__{};             /*!< Pool of the single transfers */
-    std::map<void*, uptr<loop::Loop::IO>> ios__{};                 /*!< Pool of IOs */
+    std::map<long, uptr<loop::Loop::IO>>  ios__{};                 /*!< Pool of IOs, by socket */
+    std::map<long, uptr<loop::Loop::IO>>  ios_released__{};        /*!< IOs of the removed sockets (\see gc_timer__) */
+    std::map<std::string, endpoint_set*>  endpoint_sets__{};       /*!< Endpoint sets by logical "host:port" */
     int running_handles__{ 0 }; /*!< Number of running transfers - or -1 in case of stop */
 
+    handle* queue_head__{ nullptr }; /*!< Transfers waiting to be admitted (intrusive list) */
+    handle* queue_tail__{ nullptr };
+    size_t  queued__{ 0 };
+    long    open_sockets__{ 0 };   /*!< Number of sockets opened by the session */
+    long    polled_sockets__{ 0 }; /*!< Number of sockets currently watched by the session */
+
     TCbError cb_error__{};
 
     loop::Loop& loop__;
 
     uptr<loop::Loop::Timeout> timeout__{ nullptr };
+    uptr<loop::Loop::Timeout> gc_timer__{ nullptr }; /*!< Destroys the IOs of the removed sockets */
+
+    bandwidth_budget                        bw__{};
+    uptr<loop::Loop::Timeout>               bw_timer__{ nullptr };
+    std::vector<std::pair<double, handle*>> bw_scratch__{}; /*!< Transfers sorted by normalized demand */
+
+    event_budget              ev__{};
+    std::map<long, int>       ev_deferred__{}; /*!< Socket events deferred to the next iteration (CURL_CSELECT_*) */
+    long                      ev_cursor__{ -1 }; /*!< Last deferred socket served (the next ones are served first) */
+    uptr<loop::Loop::Timeout> ev_timer__{ nullptr };
+    uint64_t                  rx_bytes__{ 0 }; /*!< Body bytes delivered to the transfers of the session */
+    uint64_t                  tx_bytes__{ 0 }; /*!< Body bytes read from the transfers of the session */
+
+    busy_poll                 busy__{};
+    std::map<long, short>     busy_events__{}; /*!< Events requested on the polled sockets (POLLIN/POLLOUT) */
+    std::vector<::pollfd>     busy_fds__{};
+    uptr<loop::Loop::Timeout> busy_timer__{ nullptr };
+
+    connection_ramp           ramp__{};
+    fd_budget                 fd__{};
+    uptr<loop::Loop::Timeout> admission_timer__{ nullptr };
+    int64_t                   admission_due_us__{ 0 }; /*!< Expiry of the admission timer - 0 when not armed */
+
+    socket_factory* socket_factory__{ nullptr }; /*!< Default factory of the sockets of the transfers */
+
+    std::set<std::pair<int64_t, context*>> ctx_deadlines__{}; /*!< Deadlines of the contexts, earliest first */
+    uptr<loop::Loop::Timeout>              ctx_timer__{ nullptr };
+    int64_t                                ctx_due_us__{ 0 }; /*!< Expiry of the deadlines timer - 0 when not armed */
+
+    std::map<gather_state*, uptr<gather_state>> gathers__; /*!< Scatter-gathers (destroyed by gc_timer__) */
+
+    std::map<std::string, uptr<tag_group>, std::less<>> tags__; /*!< Groups of the tagged transfers, by tag */
+    uint64_t                                            tag_seq__{ 0 };
+
+    latency_histogram latency__[latency_histogram::LAT_PHASES]; /*!< Latencies of the transfers, per phase */
+
+    TCbProgress               cb_progress__{};
+    long                      progress_period_ms__{ 250 };
+    session_progress          progress_report__{};     /*!< Report being built (its storage is reused) */
+    uptr<loop::Loop::Timeout> progress_timer__{ nullptr };
+    bool                      progress_armed__{ false };
+    bool                      progress_idle__{ true }; /*!< Whether the last report had no transfer */
+    int64_t                   progress_last_us__{ 0 };
+    uint64_t                  progress_last_rx__{ 0 };
+    uint64_t                  progress_last_tx__{ 0 };
+
+    TCbCompletions            cb_completions__{};
+    std::vector<completion>   completions__{};       /*!< Completions of the current loop iteration */
+    std::vector<completion>   completions_out__{};   /*!< Completions being delivered */
+    std::vector<completion>   completions_spare__{}; /*!< Single completion delivered on its own (out of memory) */
+    uptr<loop::Loop::Timeout> completions_timer__{ nullptr };
+
+    straggler_policy          strg__{};
+    uptr<loop::Loop::Timeout> strg_timer__{ nullptr };
+    std::vector<handle*>      strg_scratch__{}; /*!< Sampled transfers, sorted by origin */
+
+    std::vector<source_address> sources__{};
+    std::map<long, size_t>      source_of__{};      /*!< Source address index of the bound sockets */
+    size_t                      source_next__{ 0 }; /*!< Round-robin cursor among the least loaded addresses */
 
     mhandle(const mhandle&) = delete;
     mhandle& operator=(const mhandle&) = delete;
@@ -80,6 +336,11 @@ private:
 
     static int timer_callback(void*, long, void*);
     static int socket_callback(void*, size_t, int, void*, void*);
+    static int opensocket_callback(void*, int, void*);
+    static int closesocket_callback(void*, int);
+    static int sockopt_callback(void*, int, int);
+
+    static bool origin_of(const handle&, std::string&) noexcept;
 
 protected:
     MHDL_RetCode set_opt_long(int id, long val) noexcept;
@@ -90,16 +351,107 @@ protected:
     void handle_stop(int) noexcept;
     void handle_msgs(void) noexcept;
 
+    MHDL_RetCode admit(handle&) noexcept;
+    void         admit_pending(void) noexcept;
+    bool         admission_granted(void) noexcept;
+    void         enqueue(handle&) noexcept;
+    void         dequeue(handle&) noexcept;
+    void         sockets_hook(handle&, bool) noexcept;
+
+    void admission_arm(long delay_ms) noexcept;
+
+    void ramp_refill(void) noexcept;
+    void ramp_arm(void) noexcept;
+
+    int  source_bind(int fd, int family) noexcept;
+    void source_unbind(int fd) noexcept;
+
+    long held_fds(void) const noexcept;
+    void fd_pressure(void) noexcept;
+
+    void route(handle&) noexcept;
+    void unroute(handle&, bool completed, int result) noexcept;
+
+    MHDL_RetCode tag_link(handle&) noexcept;
+    void         tag_unlink(handle&) noexcept;
+    tag_group*   tag_find(std::string_view) const noexcept;
+    void         tag_release(tag_group&) noexcept;
+    size_t       tag_apply(std::string_view, const std::function<bool(handle&)>& op) noexcept;
+
+    void         notify(handle&, int result) noexcept;
+    MHDL_RetCode completions_reserve(void) noexcept;
+    void         completions_flush(void) noexcept;
+
+    void gather_completed(handle&, int result) noexcept;
+    void gather_check(gather_state&) noexcept;
+
+    void ctx_schedule(context&);
+    void ctx_unschedule(context&) noexcept;
+    void ctx_abort(handle&, int result) noexcept;
+    void ctx_arm(void) noexcept;
+    void ctx_tick(void) noexcept;
+
+    void strg_arm(void) noexcept;
+    void strg_tick(void) noexcept;
+    void strg_reissue(handle&) noexcept;
+    void strg_drop(handle&) noexcept;
+    void strg_done(handle&, int result) noexcept;
+    bool strg_lost(handle&) noexcept;
+
+    size_t strg_write(handle& twin, char* data, size_t size) noexcept;
+
+    void socket_event(long s, int evt_bitmask) noexcept;
+    bool ev_charge(void) noexcept;
+    void ev_defer(long s, int evt_bitmask) noexcept;
+    void ev_tick(void) noexcept;
+
+    void busy_arm(void) noexcept;
+    void busy_spin(void) noexcept;
+
+    void progress_arm(void) noexcept;
+    void progress_tick(void) noexcept;
+
+    void latency_record(handle&) noexcept;
+
+    bool bw_reserve(size_t) noexcept;
+    void bw_admit(handle&) noexcept;
+    void bw_release(handle&) noexcept;
+    void bw_tick(void) noexcept;
+
 public:
     mhandle(loop::Loop&);
     ~mhandle() noexcept;
 
     MHDL_RetCode add_handle(handle&) noexcept;
-    MHDL_RetCode remove_handle(handle&) noexcept;
-    auto         enumerate_added_handles(void) const noexcept { return std::size(handles__); }
+    MHDL_RetCode add_handle(handle&, context&) noexcept;
+    MHDL_RetCode gather(const std::vector<handle*>& handles, const gather_policy& policy, const TCbGather& cb,
+                        context* parent = nullptr) noexcept;
+    transfer_awaiter fetch(handle&, context* ctx = nullptr) noexcept;
+    body_stream      stream(handle&, context* ctx = nullptr) noexcept;
+    MHDL_RetCode     remove_handle(handle&) noexcept;
+    auto         enumerate_added_handles(void) const noexcept { return std::size(handles__) + queued__; }
+    auto         enumerate_queued_handles(void) const noexcept { return queued__; }
     auto         enumerate_running_handles(void) const noexcept { return running_handles__; }
+    auto         enumerate_open_connections(void) const noexcept { return open_sockets__; }
+
+    size_t cancel_tag(std::string_view tag) noexcept;
+    size_t cancel_tag(int64_t tag) noexcept;
+    size_t count_tag(std::string_view tag) const noexcept;
+    size_t count_tag(int64_t tag) const noexcept;
+    size_t pause_tag(std::string_view tag, int bitmask) noexcept;
+    size_t pause_tag(int64_t tag, int bitmask) noexcept;
+    size_t unpause_tag(std::string_view tag, int bitmask) noexcept;
+    size_t unpause_tag(int64_t tag, int bitmask) noexcept;
+
+    MHDL_RetCode add_endpoint_set(endpoint_set&) noexcept;
+    MHDL_RetCode remove_endpoint_set(endpoint_set&) noexcept;
 
-    void set_cb_error(TCbError&) noexcept;
+    void         set_cb_error(TCbError&) noexcept;
+    void         set_cb_completions(const TCbCompletions&) noexcept;
+    MHDL_RetCode set_cb_progress(const TCbProgress&, long period_ms = 250) noexcept;
+
+    const latency_histogram& get_latency(latency_histogram::LAT_Phase) const noexcept;
+    void                     reset_latency(void) noexcept;
 
     MHDL_RetCode set_opt(int id, std::any val) noexcept;
 
@@ -112,6 +464,27 @@ public:
     MHDL_RetCode set_pipelining(long) noexcept;
     //----------------------------------------------//
 
+    MHDL_RetCode set_bandwidth_limit(int64_t recv_bps, int64_t send_bps, long period_ms = 100) noexcept;
+    MHDL_RetCode set_event_budget(long max_us, int64_t max_bytes = 0) noexcept;
+    auto         enumerate_deferred_events(void) const noexcept { return ev__.deferred; }
+    MHDL_RetCode set_busy_poll(long spin_us, int socket_busy_poll_us = 0) noexcept;
+    auto         enumerate_busy_polls(void) const noexcept { return busy__.polls; }
+    auto         enumerate_busy_hits(void) const noexcept { return busy__.hits; }
+    auto         enumerate_busy_time(void) const noexcept { return busy__.spent_us; }
+    MHDL_RetCode set_connection_ramp(long initial_per_sec, long max_per_sec, long doubling_ms = 1000) noexcept;
+    MHDL_RetCode set_fd_budget(double ratio, bool raise_soft_limit = false) noexcept;
+    auto         enumerate_fd_budget(void) const noexcept { return fd__.effective; }
+
+    MHDL_RetCode set_straggler_reissue(double ratio, long min_age_ms = 2000, long sample_ms = 500,
+                                       long min_peers = 3) noexcept;
+    auto         enumerate_straggler_reissues(void) const noexcept { return strg__.reissues; }
+    auto         enumerate_straggler_wins(void) const noexcept { return strg__.wins; }
+
+    MHDL_RetCode set_socket_factory(socket_factory*) noexcept;
+
+    MHDL_RetCode              set_source_addresses(const std::vector<std::string>& addresses) noexcept;
+    std::vector<source_stats> source_addresses(void) const;
+
     void* raw(void) noexcept;
 
     static std::string_view retCode2Str(MHDL_RetCode) noexcept;
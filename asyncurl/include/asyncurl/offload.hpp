@@ -0,0 +1,162 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file offload.hpp
+ * @brief Offload of the completion processing of transfers to a pool of worker threads
+ *
+ * The done callbacks run on the loop thread : CPU-heavy processing (parsing, state updates...) delays the network IO
+ * of every other transfer. An offload runs it on a bounded pool of workers instead :
+ * <ul>
+ * <li>Once an attached transfer completed, its work (and optionally its whole response body) is queued to the
+ * workers</li>
+ * <li>Once the work is done, the transfer is handed back to the loop thread (eventfd), where its return callback may
+ * reuse it or add it again to a session</li>
+ * <li>When too many works are in flight, the work runs on the loop thread (back-pressure instead of unbounded
+ * memory)</li>
+ * </ul>
+ * The queueing delays (completion to worker, worker to loop thread) are measured (\see offload::stats).
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_OFFLOAD_H
+#define INCLUDE_ASYNCURL_OFFLOAD_H
+
+#include <condition_variable>
+#include <cstddef>    // size_t
+#include <cstdint>    // int64_t
+#include <deque>
+#include <functional> // std::function
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <miniLoop/Loop.h>
+
+namespace asyncurl
+{
+class handle;
+
+/*********************************************************************************************************************/
+class offload
+{
+public:
+    /**
+     * @brief OFL_RetCode describes the return codes of the asyncurl::offload class methods
+     */
+    typedef enum
+    {
+        OFL_OK = 0,    /*!< OK */
+        OFL_BAD_PARAM, /*!< An invalid parameter was passed to a function */
+        OFL_BUSY,      /*!< The work of the transfer is being processed */
+        OFL_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } OFL_RetCode;
+
+    /**
+     * @brief offload_stats is a snapshot of the activity of the offload (\see offload::stats)
+     */
+    struct offload_stats
+    {
+        uint64_t dispatched;          /*!< Works run by the workers */
+        uint64_t overflowed;          /*!< Works run on the loop thread (too many in flight) */
+        uint64_t failed;              /*!< Works that threw */
+        size_t   queued;              /*!< Works waiting for a worker */
+        size_t   in_flight;           /*!< Transfers not handed back to the loop thread yet */
+        double   queue_delay_avg_us;  /*!< Completion to worker - average (microseconds) */
+        int64_t  queue_delay_max_us;  /*!< Completion to worker - maximum (microseconds) */
+        double   return_delay_avg_us; /*!< Worker to loop thread - average (microseconds) */
+        int64_t  return_delay_max_us; /*!< Worker to loop thread - maximum (microseconds) */
+    };
+
+    /**
+     * @brief The work runs on a worker thread, with the result of the transfer and its response body (empty unless
+     * buffered). The transfer must only be read (e.g. handle::get_info).
+     */
+    using TWork = std::function<void(handle&, int result, std::string& body)>;
+
+    /**
+     * @brief The return callback runs on the loop thread once the work is done : the transfer is free again
+     */
+    using TCbReturn = std::function<void(handle&, int result)>;
+
+private:
+    struct entry
+    {
+        handle*     h{ nullptr };
+        TWork       work{};
+        TCbReturn   back{};
+        bool        buffered{ false }; /*!< Whether the body is buffered for the work */
+        bool        busy{ false };     /*!< Between the completion and the return callback */
+        std::string body{};
+    };
+
+    struct job
+    {
+        entry*      e{ nullptr };
+        int         result{ 0 };
+        std::string body{};
+        int64_t     queued_us{ 0 };
+        int64_t     done_us{ 0 };
+    };
+
+    size_t max_queue__;
+    int    efd__{ -1 }; /*!< eventfd waking up the loop thread */
+
+    std::map<handle*, std::unique_ptr<entry>> entries__{};  /*!< Attached transfers (loop thread) */
+    std::vector<std::unique_ptr<entry>>       retired__{};  /*!< Detached transfers (destroyed by the next drain) */
+    std::unique_ptr<loop::Loop::IO>           io__{ nullptr };
+    std::vector<job>                          returned__{}; /*!< Jobs handed back (loop thread) */
+
+    // Shared with the workers (under mtx__)
+    std::mutex               mtx__{};
+    std::condition_variable  cv__{};
+    std::deque<job>          queue__{};
+    std::vector<job>         done__{};
+    bool                     stopping__{ false };
+    std::vector<std::thread> workers__{};
+
+    uint64_t dispatched__{ 0 };
+    uint64_t overflowed__{ 0 };
+    uint64_t failed__{ 0 };
+    size_t   in_flight__{ 0 };
+    uint64_t queue_delays__{ 0 }; /*!< Number of queue delays measured */
+    int64_t  queue_delay_sum_us__{ 0 };
+    int64_t  queue_delay_max_us__{ 0 };
+    uint64_t return_delays__{ 0 };
+    int64_t  return_delay_sum_us__{ 0 };
+    int64_t  return_delay_max_us__{ 0 };
+
+    offload(const offload&) = delete;
+    offload& operator=(const offload&) = delete;
+    offload(offload&&)                 = delete;
+    offload& operator=(offload&&) = delete;
+
+    void shutdown(void) noexcept;
+    void completed(entry&, int result) noexcept;
+    void returned(job&) noexcept;
+    bool run(job&) noexcept;
+    void worker(void) noexcept;
+    void drain(void) noexcept;
+
+public:
+    offload(loop::Loop&, size_t workers = 2, size_t max_queue = 4096);
+    ~offload() noexcept;
+
+    OFL_RetCode attach(handle&, const TWork& work, const TCbReturn& back = nullptr, bool buffer_body = false) noexcept;
+    OFL_RetCode detach(handle&) noexcept;
+
+    offload_stats stats(void) noexcept;
+
+    static std::string_view retCode2Str(OFL_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_OFFLOAD_H
@@ -0,0 +1,200 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file outbox.hpp
+ * @brief Durable outbox - at-least-once delivery of requests (webhooks, events) across crashes
+ *
+ * An outbox is an append-only log of requests, memory-mapped, that a session delivers :
+ * <ul>
+ * <li>The appended requests are made durable by batches (group commit : one fsync per commit interval, whatever the
+ * number of requests appended meanwhile), then dispatched</li>
+ * <li>A request is acknowledged once delivered (or definitively rejected), and retried with an exponential backoff
+ * otherwise</li>
+ * <li>The acknowledged requests are compacted away once they make up most of the log</li>
+ * <li>When the log is opened again (e.g. after a crash), the requests not acknowledged yet are replayed</li>
+ * </ul>
+ * An acknowledgement lost in a crash only leads to a second delivery : the receivers should be idempotent.
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_OUTBOX_H
+#define INCLUDE_ASYNCURL_OUTBOX_H
+
+#include <cstddef>    // size_t
+#include <cstdint>    // uint64_t
+#include <functional> // std::function
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <miniLoop/Loop.h>
+
+namespace asyncurl
+{
+class handle;
+class mhandle;
+
+/*********************************************************************************************************************/
+class outbox
+{
+public:
+    /**
+     * @brief OB_RetCode describes the return codes of the asyncurl::outbox class methods
+     */
+    typedef enum
+    {
+        OB_OK = 0,       /*!< OK */
+        OB_BAD_PARAM,    /*!< An invalid parameter was passed to a function */
+        OB_NOT_OPEN,     /*!< No log is open */
+        OB_ALREADY_OPEN, /*!< A log is already open */
+        OB_BAD_FORMAT,   /*!< The file is not an outbox log */
+        OB_IO_ERROR,     /*!< A system call on the log failed (open, mmap, msync...) */
+        OB_OUT_OF_MEM    /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } OB_RetCode;
+
+    /**
+     * @brief request is a request to deliver
+     */
+    struct request
+    {
+        std::string              method{ "POST" };
+        std::string              url{};
+        std::vector<std::string> headers{}; /*!< "Name: value" */
+        std::string              body{};
+    };
+
+    /**
+     * @brief outbox_stats is a snapshot of the state of the outbox (\see outbox::stats)
+     */
+    struct outbox_stats
+    {
+        size_t   pending;    /*!< Requests not acknowledged yet */
+        size_t   in_flight;  /*!< Requests being delivered */
+        uint64_t appended;   /*!< Requests appended since the opening of the log */
+        uint64_t replayed;   /*!< Requests found not acknowledged when the log was opened */
+        uint64_t commits;    /*!< Group commits (fsync) since the opening of the log */
+        uint64_t delivered;  /*!< Requests acknowledged since the opening of the log */
+        uint64_t retries;    /*!< Failed delivery attempts since the opening of the log */
+        uint64_t compacted;  /*!< Compactions since the opening of the log */
+        size_t   log_bytes;  /*!< Size of the log (records) */
+        size_t   live_bytes; /*!< Size of the records not acknowledged yet */
+    };
+
+    /**
+     * @brief A configuration function completes the transfer of a request (timeouts, authentication...) before every
+     * attempt. It must not set the write and done callbacks (owned by the outbox).
+     */
+    using TConfigure   = std::function<void(handle&, const request&)>;
+    using TCbDelivered = std::function<void(uint64_t id, int code, long response_code)>;
+
+private:
+    typedef enum
+    {
+        ENTRY_UNCOMMITTED = 0, /*!< Appended, waiting for the next commit */
+        ENTRY_READY,           /*!< Durable, waiting for a delivery slot */
+        ENTRY_RUNNING,         /*!< Being delivered */
+        ENTRY_BACKOFF          /*!< Waiting before being retried */
+    } entry_state;
+
+    struct entry
+    {
+        uint64_t                id{ 0 };
+        size_t                  offset{ 0 }; /*!< Offset of the record in the log */
+        size_t                  size{ 0 };   /*!< Size of the record in the log (header and padding included) */
+        entry_state             state{ ENTRY_UNCOMMITTED };
+        long                    attempts{ 0 };
+        int64_t                 due_us{ 0 }; /*!< Time of the next attempt (backoff) */
+        std::unique_ptr<handle> h{};
+    };
+
+    mhandle& session__;
+    size_t   max_in_flight__;
+    long     commit_interval_ms__;
+    long     retry_ms__{ 1000 };
+    long     retry_max_ms__{ 60000 };
+    size_t   compact_min__{ 4 * 1024 * 1024 };
+
+    std::string path__{};
+    int         fd__{ -1 };
+    char*       map__{ nullptr };
+    size_t      capacity__{ 0 };  /*!< Size of the file (and of the mapping) */
+    size_t      write_pos__{ 0 }; /*!< End of the last record */
+    size_t      dirty_lo__{ 0 };  /*!< Range of the mapping modified since the last commit */
+    size_t      dirty_hi__{ 0 };
+    uint64_t    next_id__{ 1 };
+
+    std::map<uint64_t, std::unique_ptr<entry>> entries__{}; /*!< Requests not acknowledged yet (by identifier) */
+    std::vector<entry*>                        uncommitted__{};
+    std::vector<entry*>                        ready__{};   /*!< FIFO (consumed from ready_head__) */
+    size_t                                     ready_head__{ 0 };
+    std::set<std::pair<int64_t, uint64_t>>     backoff__{}; /*!< Requests waiting to be retried, by due time */
+    std::vector<std::unique_ptr<handle>>       pool__{};    /*!< Handles ready to be reused */
+    std::vector<std::unique_ptr<handle>>       spent__{};   /*!< Handles of the completed attempts (to recycle) */
+    std::unique_ptr<handle>                    gc__{};      /*!< Handle to destroy (when it could not be recycled) */
+    size_t                                     in_flight__{ 0 };
+    size_t                                     live_bytes__{ 0 };
+    bool                                       pumping__{ false };
+
+    uint64_t appended__{ 0 };
+    uint64_t replayed__{ 0 };
+    uint64_t commits__{ 0 };
+    uint64_t delivered__{ 0 };
+    uint64_t retries__{ 0 };
+    uint64_t compacted__{ 0 };
+
+    TConfigure   configure__{};
+    TCbDelivered cb_delivered__{};
+
+    std::unique_ptr<loop::Loop::Timeout> commit_timer__{ nullptr };
+    std::unique_ptr<loop::Loop::Timeout> retry_timer__{ nullptr };
+    bool                                 commit_armed__{ false };
+
+    outbox(const outbox&) = delete;
+    outbox& operator=(const outbox&) = delete;
+    outbox(outbox&&)                 = delete;
+    outbox& operator=(outbox&&) = delete;
+
+    OB_RetCode reserve(size_t size) noexcept;
+    OB_RetCode replay(void) noexcept;
+    void       dirty(size_t offset, size_t size) noexcept;
+    void       arm_commit(void) noexcept;
+    void       arm_retry(void) noexcept;
+    void       retry_tick(void) noexcept;
+    void       recycle(void) noexcept;
+    void       pump(void) noexcept;
+    void       launch(entry&) noexcept;
+    void       completed(uint64_t id, int result) noexcept;
+    void       acknowledge(entry&, int code, long response_code) noexcept;
+    void       close(void) noexcept;
+
+public:
+    outbox(loop::Loop&, mhandle&, long commit_interval_ms = 2, size_t max_in_flight = 256);
+    ~outbox() noexcept;
+
+    OB_RetCode open(const std::string& path) noexcept;
+    OB_RetCode append(const request&, uint64_t* id = nullptr) noexcept;
+    OB_RetCode commit(void) noexcept;
+    OB_RetCode compact(void) noexcept;
+
+    OB_RetCode set_retry(long retry_ms, long retry_max_ms) noexcept;
+    OB_RetCode set_compaction(size_t min_bytes) noexcept;
+    void       set_configure(const TConfigure& configure) noexcept { configure__ = configure; }
+    void       set_cb_delivered(const TCbDelivered& cb) noexcept { cb_delivered__ = cb; }
+
+    bool         is_open(void) const noexcept { return 0 <= fd__; }
+    outbox_stats stats(void) const noexcept;
+
+    static std::string_view retCode2Str(OB_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_OUTBOX_H
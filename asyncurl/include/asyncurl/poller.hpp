@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file poller.hpp
+ * @brief Periodic polling scheduler - re-runs registered transfers at a given interval
+ *
+ * A poller owns a hashed timing wheel driven by a single miniloop timer, whatever the number of polled transfers :
+ * <ul>
+ * <li>The first polls are spread evenly over the interval, so that a large set of endpoints does not poll in burst</li>
+ * <li>Each poll is delayed by a random jitter, and the transfer is re-added to the session after completion</li>
+ * <li>Failing transfers (curl error or HTTP 5xx response) are polled less often (exponential backoff)</li>
+ * <li>The schedule lag (how late the polls are started) is reported (\see poller::stats)</li>
+ * </ul>
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_POLLER_H
+#define INCLUDE_ASYNCURL_POLLER_H
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <map>
+#include <memory>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include <miniLoop/Loop.h>
+
+namespace asyncurl
+{
+class handle;
+class mhandle;
+
+/*********************************************************************************************************************/
+class poller
+{
+public:
+    /**
+     * @brief PLR_RetCode describes the return codes of the asyncurl::poller class methods
+     */
+    typedef enum
+    {
+        PLR_OK = 0,    /*!< OK */
+        PLR_BAD_PARAM, /*!< An invalid parameter was passed to a function */
+        PLR_ALREADY,   /*!< The handle is already polled by this poller */
+        PLR_OWNED,     /*!< The handle is already polled by another poller, or owned by a session */
+        PLR_UNKNOWN,   /*!< The handle is not polled by this poller */
+        PLR_OUT_OF_MEM /*!< An dynamic allocation call failed (you were probably too greedy) */
+    } PLR_RetCode;
+
+    /**
+     * @brief poller_stats is a snapshot of the state of the poller (\see poller::stats)
+     */
+    struct poller_stats
+    {
+        size_t   registered; /*!< Number of polled transfers */
+        size_t   in_flight;  /*!< Number of polls currently running */
+        size_t   backed_off; /*!< Number of polled transfers currently backed off */
+        uint64_t polls;      /*!< Number of polls started since the last reset */
+        uint64_t failures;   /*!< Number of failed polls since the last reset */
+        uint64_t late;       /*!< Number of polls started more than one tick late since the last reset */
+        int64_t  lag_avg_us; /*!< Average schedule lag since the last reset (microseconds) */
+        int64_t  lag_max_us; /*!< Maximum schedule lag since the last reset (microseconds) */
+    };
+
+private:
+    struct entry
+    {
+        handle* h{ nullptr };
+        long    interval_ms{ 0 };
+        long    jitter_ms{ 0 };
+        int64_t nominal_us{ 0 }; /*!< Nominal (jitter-free) time of the next poll */
+        int64_t due_us{ 0 };     /*!< Actual time of the next poll (nominal + jitter) */
+        int64_t due_tick{ 0 };   /*!< Wheel tick of the next poll */
+        long    failures{ 0 };   /*!< Consecutive failures */
+        entry*  prev{ nullptr }; /*!< Previous entry in the same wheel slot */
+        entry*  next{ nullptr }; /*!< Next entry in the same wheel slot */
+        bool    scheduled{ false };
+    };
+
+    mhandle&                                  session__;
+    std::map<handle*, std::unique_ptr<entry>> entries__{};
+    std::vector<entry*>                       wheel__;             /*!< Slots heads (intrusive lists) */
+    int64_t                                   tick_us__;           /*!< Duration of a wheel slot */
+    int64_t                                   origin_us__{ 0 };    /*!< Time of the wheel tick 0 */
+    int64_t                                   cursor__{ 0 };       /*!< Last processed wheel tick */
+    size_t                                    scheduled__{ 0 };    /*!< Number of entries in the wheel */
+    size_t                                    backed_off__{ 0 };   /*!< Number of entries currently failing */
+    uint64_t                                  sequence__{ 0 };     /*!< Registrations count (spreads the first polls) */
+    long                                      backoff_max__{ 16 }; /*!< Maximum backoff factor of the interval */
+    std::minstd_rand                          rng__{ std::random_device{}() };
+    std::vector<handle*>                      fired__{};           /*!< Scratch list of the polls to start */
+
+    uint64_t polls__{ 0 };
+    uint64_t failures__{ 0 };
+    uint64_t late__{ 0 };
+    int64_t  lag_sum_us__{ 0 };
+    int64_t  lag_max_us__{ 0 };
+
+    std::unique_ptr<loop::Loop::Timeout> timer__{ nullptr };
+    bool                                 armed__{ false };
+
+    poller(const poller&) = delete;
+    poller& operator=(const poller&) = delete;
+    poller(poller&&)                 = delete;
+    poller& operator=(poller&&) = delete;
+
+    void schedule(entry&, int64_t now_us) noexcept;
+    void unschedule(entry&) noexcept;
+    void completed(entry&, int result) noexcept;
+    void tick(void) noexcept;
+    void arm(int64_t now_us) noexcept;
+
+public:
+    poller(loop::Loop&, mhandle&, long tick_ms = 100, size_t slots = 1024);
+    ~poller() noexcept;
+
+    PLR_RetCode add(handle&, long interval_ms, long jitter_ms = 0) noexcept;
+    PLR_RetCode remove(handle&) noexcept;
+
+    PLR_RetCode set_backoff(long max_factor) noexcept;
+
+    size_t       size(void) const noexcept { return std::size(entries__); }
+    poller_stats stats(void) const noexcept;
+    void         reset_stats(void) noexcept;
+
+    static std::string_view retCode2Str(PLR_RetCode) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_POLLER_H
@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file progress.hpp
+ * @brief Progress record of a transfer, readable from any thread
+ *
+ * The loop thread keeps the progress of every transfer (state, bytes received and sent, expected sizes, last
+ * activity) up to date as the data flows, without the progress callback of curl. It publishes it through a sequence
+ * lock : any thread (UI, status...) reads a consistent snapshot without locking, and the loop thread never waits.
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_PROGRESS_H
+#define INCLUDE_ASYNCURL_PROGRESS_H
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <string_view>
+
+namespace asyncurl
+{
+/*********************************************************************************************************************/
+class progress
+{
+public:
+    /**
+     * @brief PRG_State describes the states of a transfer
+     */
+    typedef enum
+    {
+        PRG_IDLE = 0, /*!< Not added to a session (or removed from it) */
+        PRG_QUEUED,   /*!< Waiting in the session admission queue */
+        PRG_RUNNING,  /*!< Handed over to curl */
+        PRG_DONE      /*!< Completed (\see snapshot::result) */
+    } PRG_State;
+
+    /**
+     * @brief snapshot is a consistent view of the progress of a transfer (\see progress::read)
+     */
+    struct snapshot
+    {
+        PRG_State state{ PRG_IDLE };
+        int       result{ 0 };           /*!< Result of the transfer once done (CURLcode, or a negative HDL_RetCode) */
+        int64_t   dl_now{ 0 };           /*!< Body bytes received */
+        int64_t   dl_total{ -1 };        /*!< Body bytes expected - negative when unknown */
+        int64_t   ul_now{ 0 };           /*!< Body bytes sent */
+        int64_t   ul_total{ -1 };        /*!< Body bytes to send - negative when unknown */
+        int64_t   last_activity_us{ 0 }; /*!< Last data received or sent (std::chrono::steady_clock, microseconds) */
+    };
+
+private:
+    snapshot current__{}; /*!< Working copy (writer thread) */
+
+    std::atomic<uint32_t> seq__{ 0 }; /*!< Odd while a snapshot is being published */
+    std::atomic<int>      state__{ PRG_IDLE };
+    std::atomic<int>      result__{ 0 };
+    std::atomic<int64_t>  dl_now__{ 0 };
+    std::atomic<int64_t>  dl_total__{ -1 };
+    std::atomic<int64_t>  ul_now__{ 0 };
+    std::atomic<int64_t>  ul_total__{ -1 };
+    std::atomic<int64_t>  last_activity_us__{ 0 };
+
+    progress(const progress&) = delete;
+    progress& operator=(const progress&) = delete;
+    progress(progress&&)                 = delete;
+    progress& operator=(progress&&) = delete;
+
+    void publish(void) noexcept;
+
+public:
+    progress() = default;
+
+    // Writer side - the thread driving the transfer
+    void start(PRG_State) noexcept;
+    void finish(int result, int64_t ul_now) noexcept;
+    void set_state(PRG_State) noexcept;
+    void received(size_t bytes, int64_t total) noexcept;
+    void sent(size_t bytes, int64_t total) noexcept;
+
+    const snapshot& current(void) const noexcept { return current__; }
+
+    // Reader side - any thread
+    snapshot read(void) const noexcept;
+
+    static std::string_view state2Str(PRG_State) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_PROGRESS_H
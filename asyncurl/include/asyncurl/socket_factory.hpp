@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file socket_factory.hpp
+ * @brief Creation and tuning of the sockets of the transfers
+ * @see https://everything.curl.dev/libcurl/callbacks/sockopt for more informations
+ *
+ * A socket factory creates the sockets of the new connections and tunes them before they get connected :
+ * <ul>
+ * <li>It can be set per transfer (\see handle::set_socket_factory) or per session (\see mhandle::set_socket_factory)
+ * </li>
+ * <li>The default implementation applies a set of typed options (buffers, TCP_NODELAY, TCP_NOTSENT_LOWAT,
+ * SO_BUSY_POLL, TCP Fast Open, marks...) - presets are provided for low-latency and bulk-throughput traffic</li>
+ * <li>It can be derived to do anything else (e.g. mark the sockets per traffic class)</li>
+ * </ul>
+ * @author lhm
+ */
+
+#ifndef INCLUDE_ASYNCURL_SOCKET_FACTORY_H
+#define INCLUDE_ASYNCURL_SOCKET_FACTORY_H
+
+namespace asyncurl
+{
+/*********************************************************************************************************************/
+class socket_factory
+{
+public:
+    /**
+     * @brief options are the tuning applied to the sockets by the default factory
+     *
+     * A negative value leaves the system (or curl) default untouched.
+     * Options the system does not support (or the process is not allowed to set) are ignored.
+     */
+    struct options
+    {
+        int  nodelay{ -1 };       /*!< TCP_NODELAY (0 or 1) - curl enables it by default */
+        int  sndbuf{ -1 };        /*!< SO_SNDBUF (bytes) */
+        int  rcvbuf{ -1 };        /*!< SO_RCVBUF (bytes) */
+        int  notsent_lowat{ -1 }; /*!< TCP_NOTSENT_LOWAT (bytes) */
+        int  busy_poll_us{ -1 };  /*!< SO_BUSY_POLL (microseconds) */
+        int  tos{ -1 };           /*!< IP_TOS / IPV6_TCLASS */
+        int  priority{ -1 };      /*!< SO_PRIORITY */
+        int  mark{ -1 };          /*!< SO_MARK (requires CAP_NET_ADMIN) */
+        bool fastopen{ false };   /*!< TCP Fast Open (TCP_FASTOPEN_CONNECT) */
+    };
+
+private:
+    options options__{};
+
+public:
+    socket_factory() = default;
+    explicit socket_factory(const options& opts)
+      : options__{ opts }
+    {}
+    virtual ~socket_factory() = default;
+
+    virtual int open(int family, int socktype, int protocol) noexcept;
+    virtual int configure(int fd) noexcept;
+
+    const options& get_options(void) const noexcept { return options__; }
+    void           set_options(const options& opts) noexcept { options__ = opts; }
+
+    static options low_latency(void) noexcept;
+    static options bulk_throughput(void) noexcept;
+};
+
+} // namespace asyncurl
+
+#endif // INCLUDE_ASYNCURL_SOCKET_FACTORY_H
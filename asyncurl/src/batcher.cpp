@@ -0,0 +1,348 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/batcher.hpp>
+#include <asyncurl/handle.hpp>
+#include <asyncurl/mhandle.hpp>
+
+#include <curl/curl.h>
+#include <miniLoop/Loop.h>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <any>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using namespace loop;
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief batcher - Constructor
+ *
+ * The loop timer has a millisecond resolution : the delay is rounded up to the next millisecond.
+ * @param loop The event loop driving the deadlines of the batches
+ * @param session The session sending the batches
+ * @param c The codec of the batches
+ * @param max_items The maximum number of requests of a batch
+ * @param max_delay_us The maximum time a request waits for its batch to be sent (microseconds)
+ *
+ * @warning The session should outlive the batcher
+ */
+batcher::batcher(Loop& loop, mhandle& session, const codec& c, size_t max_items, long max_delay_us)
+  : session__{ session }
+  , codec__{ c }
+  , max_items__{ max_items }
+  , max_delay_us__{ max_delay_us }
+{
+    if (!c.encode || !c.decode || 0 == max_items || 0 > max_delay_us)
+        throw std::invalid_argument("Invalid batcher parameters");
+
+    timer__ = std::make_unique<Loop::Timeout>(loop);
+    timer__->onTimeout([this]() { this->tick(); });
+
+    gc_timer__ = std::make_unique<Loop::Timeout>(loop);
+    gc_timer__->onTimeout([this]() { this->landed__.clear(); });
+}
+
+/**
+ * @brief ~batcher - Destructor
+ *
+ * The batches being sent are removed from the session, and the pending requests are dropped : the callbacks are not
+ * called.
+ */
+batcher::~batcher() noexcept
+{
+    timer__->cancel();
+    gc_timer__->cancel();
+
+    for (auto& [f, ptr] : flights__)
+        session__.remove_handle(*f->h);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// BATCHING
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief submit - Submit a request
+ *
+ * The request joins the open batch of its key (a new batch is opened if there is none), which is sent right away if
+ * full.
+ * @param key The key of the batch (requests with the same key are compatible)
+ * @param payload The payload of the request, handed to the encoder
+ * @param cb The callback the outcome of the request is handed to
+ * @return A return code described by the \a BAT_RetCode enumerate
+ */
+batcher::BAT_RetCode
+batcher::submit(std::string_view key, std::string_view payload, const TCbItem& cb) noexcept
+{
+    if (!cb) return BAT_BAD_PARAM;
+
+    auto   it{ batches__.find(key) };
+    batch* b{ nullptr };
+    bool   opened{ false };
+    try
+    {
+        if (std::end(batches__) == it)
+        {
+            auto nb{ std::make_unique<batch>() };
+
+            nb->key         = key;
+            nb->deadline_us = monotonic_us() + max_delay_us__;
+            nb->items.reserve(std::min<size_t>(max_items__, 64));
+
+            it     = batches__.emplace(nb->key, std::move(nb)).first;
+            opened = true;
+            deadlines__.emplace(it->second->deadline_us, it->second.get());
+        }
+
+        b = it->second.get();
+        b->items.push_back({ std::string{ payload }, cb });
+    }
+    catch (const std::bad_alloc&)
+    {
+        if (opened)
+        {
+            deadlines__.erase({ it->second->deadline_us, it->second.get() });
+            batches__.erase(it);
+        }
+        return BAT_OUT_OF_MEM;
+    }
+
+    ++submitted__;
+    ++pending__;
+
+    if (std::size(b->items) >= max_items__)
+    {
+        ++full__;
+        send(*b);
+    }
+    else if (opened)
+        arm();
+
+    return BAT_OK;
+}
+
+/**
+ * @brief flush - Send all the open batches right away
+ */
+void
+batcher::flush(void) noexcept
+{
+    while (!std::empty(deadlines__))
+        send(*std::begin(deadlines__)->second);
+}
+
+/**
+ * @brief send - Close a batch, encode it and add its transfer to the session
+ *
+ * @param b The batch
+ */
+void
+batcher::send(batch& b) noexcept
+{
+    deadlines__.erase({ b.deadline_us, &b });
+
+    auto it{ batches__.find(b.key) };
+    auto closed{ std::move(it->second) };
+    batches__.erase(it);
+    pending__ -= std::size(closed->items);
+    arm();
+
+    flight* f{ nullptr };
+    try
+    {
+        auto nf{ std::make_unique<flight>() };
+        f = nf.get();
+
+        nf->h = std::make_unique<handle>();
+        flights__.emplace(f, std::move(nf));
+    }
+    catch (const std::bad_alloc&)
+    {
+        ++failed__;
+        fail(closed->items, CURLE_OUT_OF_MEMORY, 0);
+        return;
+    }
+
+    f->key   = std::move(closed->key);
+    f->items = std::move(closed->items);
+    ++sent__;
+
+    bool encoded{ false };
+    try
+    {
+        std::vector<std::string_view> payloads;
+
+        payloads.reserve(std::size(f->items));
+        for (const auto& i : f->items)
+            payloads.emplace_back(i.payload);
+
+        encoded = codec__.encode(*f->h, f->key, payloads, f->request);
+    }
+    catch (...)
+    {
+        encoded = false;
+    }
+
+    auto& h{ *f->h };
+    auto& response{ f->response };
+
+    h.set_cb_write([&response](char* data, size_t size) -> size_t {
+        try
+        {
+            response.append(data, size);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return 0;
+        }
+        return size;
+    });
+    h.set_cb_done([this, f](int result) { this->completed(*f, result); });
+
+    if (encoded && !std::empty(f->request))
+    {
+        encoded = handle::HDL_OK == h.set_opt(CURLOPT_POSTFIELDSIZE, static_cast<long>(std::size(f->request))) &&
+                  handle::HDL_OK == h.set_opt(CURLOPT_POSTFIELDS, static_cast<void*>(f->request.data()));
+    }
+
+    if (!encoded || mhandle::MHDL_OK != session__.add_handle(h)) completed(*f, CURLE_FAILED_INIT);
+}
+
+/**
+ * @brief completed - Decode the response of a batch, and hand the outcomes to the callbacks of its requests
+ *
+ * @param f The batch
+ * @param result The result of its transfer
+ */
+void
+batcher::completed(flight& f, int result) noexcept
+{
+    long                       response_code{ 0 };
+    std::vector<item_response> responses;
+    bool                       decoded{ false };
+
+    if (auto info{ f.h->get_info(CURLINFO_RESPONSE_CODE) }; handle::HDL_OK == info.ret)
+        response_code = std::any_cast<long>(info.value);
+
+    if (CURLE_OK == result)
+    {
+        try
+        {
+            decoded = codec__.decode(f.key, response_code, f.response, std::size(f.items), responses) &&
+                      std::size(responses) == std::size(f.items);
+        }
+        catch (...)
+        {
+            decoded = false;
+        }
+    }
+
+    // The flight is destroyed later : this may be the done callback of its handle
+    auto it{ flights__.find(&f) };
+    try
+    {
+        landed__.push_back(std::move(it->second));
+        flights__.erase(it);
+        gc_timer__->set(0);
+    }
+    catch (const std::bad_alloc&)
+    {
+        // Kept until the destruction of the batcher
+    }
+
+    if (!decoded)
+    {
+        ++failed__;
+        fail(f.items, (CURLE_OK == result) ? CURLE_WEIRD_SERVER_REPLY : result, response_code);
+        return;
+    }
+
+    for (size_t i{ 0 }; i < std::size(f.items); ++i)
+        f.items[i].cb({ CURLE_OK, responses[i].response_code, responses[i].body });
+}
+
+/**
+ * @brief fail - Hand a failure to the callbacks of requests
+ *
+ * @param items The requests
+ * @param code The result handed to the callbacks
+ * @param response_code The response code handed to the callbacks
+ */
+void
+batcher::fail(std::vector<item>& items, int code, long response_code) noexcept
+{
+    for (auto& i : items)
+        i.cb({ code, response_code, {} });
+}
+
+/**
+ * @brief arm - Arm the timer on the earliest deadline of the open batches
+ */
+void
+batcher::arm(void) noexcept
+{
+    if (std::empty(deadlines__))
+    {
+        timer__->cancel();
+        return;
+    }
+
+    const auto delay_us{ std::begin(deadlines__)->first - monotonic_us() };
+    timer__->set(std::max<int64_t>(0, (delay_us + 999) / 1000));
+}
+
+/**
+ * @brief tick - Send the batches whose deadline expired
+ */
+void
+batcher::tick(void) noexcept
+{
+    const auto now{ monotonic_us() };
+
+    while (!std::empty(deadlines__) && std::begin(deadlines__)->first <= now)
+        send(*std::begin(deadlines__)->second);
+
+    arm();
+}
+
+/**
+ * @brief stats - Get a snapshot of the activity of the batcher
+ *
+ * @return The snapshot
+ */
+batcher::batcher_stats
+batcher::stats(void) const noexcept
+{
+    return { submitted__, sent__, failed__, full__, pending__, std::size(flights__) };
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+batcher::retCode2Str(batcher::BAT_RetCode rc) noexcept
+{
+    static const std::map<BAT_RetCode, std::string> _retcodeMap{ { BAT_OK, "ok" },
+                                                                 { BAT_BAD_PARAM, "bad parameter" },
+                                                                 { BAT_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
@@ -0,0 +1,479 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/bulk_fetch.hpp>
+#include <asyncurl/handle.hpp>
+#include <asyncurl/mhandle.hpp>
+
+#include <curl/curl.h>
+
+#include <any>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BF_RELEASE_BYTES (16 * 1024 * 1024) // Granularity of the release of the input file pages already read
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief bulk_fetch - Constructor
+ *
+ * @param session The session performing the transfers
+ * @param window The maximum number of URLs being processed at once (running, or waiting to be emitted in order)
+ * @param ordered Whether the results are handed to the sink in input order
+ *
+ * @warning The session should outlive the bulk fetch
+ */
+bulk_fetch::bulk_fetch(mhandle& session, size_t window, bool ordered)
+  : session__{ session }
+  , slots__(window)
+  , ordered__{ ordered }
+{
+    if (0 == window) throw std::invalid_argument("Invalid bulk fetch window");
+
+    free__.reserve(window);
+    for (size_t i{ 0 }; i < window; ++i)
+    {
+        auto& s{ slots__[i] };
+
+        s.h = std::make_unique<handle>();
+        s.h->set_cb_write([this, &s](char* data, size_t size) -> size_t {
+            if (std::size(s.body) + size > this->max_body__) return 0; // CURLE_WRITE_ERROR
+            try
+            {
+                s.body.append(data, size);
+            }
+            catch (const std::bad_alloc&)
+            {
+                return 0;
+            }
+            return size;
+        });
+        s.h->set_cb_done([this, i](int result) { this->completed(i, result); });
+    }
+}
+
+/**
+ * @brief ~bulk_fetch - Destructor
+ *
+ * The running transfers are removed from the session, and the done callback is not called.
+ */
+bulk_fetch::~bulk_fetch() noexcept
+{
+    stop();
+    unmap();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// INPUT
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief open_file - Read the URLs from a file (one per line - blank lines are ignored)
+ *
+ * The file is memory-mapped, and its pages are released as it is read.
+ * @param path The path of the file
+ * @return A return code described by the \a BF_RetCode enumerate
+ */
+bulk_fetch::BF_RetCode
+bulk_fetch::open_file(const std::string& path) noexcept
+{
+    if (started__) return BF_RUNNING;
+
+    int fd{ ::open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (0 > fd) return BF_IO_ERROR;
+
+    struct stat st;
+    if (0 != ::fstat(fd, &st))
+    {
+        ::close(fd);
+        return BF_IO_ERROR;
+    }
+
+    void* map{ nullptr };
+    if (0 < st.st_size)
+    {
+        map = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == map)
+        {
+            ::close(fd);
+            return BF_IO_ERROR;
+        }
+        ::madvise(map, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    }
+    ::close(fd); // The mapping holds its own reference to the file
+
+    unmap();
+    generator__     = nullptr;
+    map__          = static_cast<const char*>(map);
+    map_size__     = static_cast<size_t>(st.st_size);
+    map_pos__      = 0;
+    map_released__ = 0;
+    mapped__       = true;
+
+    return BF_OK;
+}
+
+/**
+ * @brief set_generator - Read the URLs from a generator
+ *
+ * @param gen The generator, filling the next URL - it returns false once there is no more URL
+ * @return A return code described by the \a BF_RetCode enumerate
+ */
+bulk_fetch::BF_RetCode
+bulk_fetch::set_generator(const TGenerator& gen) noexcept
+{
+    if (started__) return BF_RUNNING;
+    if (!gen) return BF_BAD_PARAM;
+
+    unmap();
+    generator__ = gen;
+
+    return BF_OK;
+}
+
+/**
+ * @brief set_configure - Set the function configuring the transfers (options, headers...)
+ *
+ * It is called for every URL, the handles being reused from one URL to the next.
+ * @param configure The function - it must not set the write and done callbacks (owned by the bulk fetch)
+ * @return A return code described by the \a BF_RetCode enumerate
+ */
+bulk_fetch::BF_RetCode
+bulk_fetch::set_configure(const TConfigure& configure) noexcept
+{
+    if (started__) return BF_RUNNING;
+
+    configure__ = configure;
+    return BF_OK;
+}
+
+/**
+ * @brief set_max_body - Set the maximum size of the bodies kept for the sink
+ *
+ * A larger body fails the transfer (CURLE_WRITE_ERROR).
+ * @param max The maximum size (bytes)
+ * @return A return code described by the \a BF_RetCode enumerate
+ */
+bulk_fetch::BF_RetCode
+bulk_fetch::set_max_body(size_t max) noexcept
+{
+    if (started__) return BF_RUNNING;
+
+    max_body__ = max;
+    return BF_OK;
+}
+
+/**
+ * @brief next_url - Read the next URL of the input
+ *
+ * @param url The URL
+ * @return false if the input is exhausted
+ */
+bool
+bulk_fetch::next_url(std::string& url) noexcept
+{
+    try
+    {
+        if (!mapped__) return generator__ && generator__(url);
+
+        while (map_pos__ < map_size__)
+        {
+            const char* begin{ map__ + map_pos__ };
+            const char* eol{ static_cast<const char*>(std::memchr(begin, '\n', map_size__ - map_pos__)) };
+            const char* end{ (nullptr != eol) ? eol : map__ + map_size__ };
+
+            map_pos__ = static_cast<size_t>(end - map__) + 1;
+
+            while (begin < end && std::isspace(static_cast<unsigned char>(*begin)))
+                ++begin;
+            while (end > begin && std::isspace(static_cast<unsigned char>(end[-1])))
+                --end;
+            if (begin == end) continue;
+
+            // Give the pages already read back to the system : the resident memory does not grow with the file
+            if (map_pos__ - map_released__ >= BF_RELEASE_BYTES)
+            {
+                const auto page{ static_cast<size_t>(::sysconf(_SC_PAGESIZE)) };
+                const auto upto{ (map_pos__ / page) * page };
+
+                ::madvise(const_cast<char*>(map__) + map_released__, upto - map_released__, MADV_DONTNEED);
+                map_released__ = upto;
+            }
+
+            url.assign(begin, static_cast<size_t>(end - begin));
+            return true;
+        }
+    }
+    catch (...)
+    {
+    }
+
+    return false;
+}
+
+/**
+ * @brief unmap - Release the input file (if any)
+ */
+void
+bulk_fetch::unmap(void) noexcept
+{
+    if (nullptr != map__) ::munmap(const_cast<char*>(map__), map_size__);
+
+    map__      = nullptr;
+    map_size__ = 0;
+    mapped__   = false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// EXECUTION
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief start - Fetch the URLs of the input
+ *
+ * @param sink The function the results are handed to
+ * @param cb The callback called once the input is exhausted and all the results were handed to the sink
+ * @return A return code described by the \a BF_RetCode enumerate
+ */
+bulk_fetch::BF_RetCode
+bulk_fetch::start(const TSink& sink, const TCbDone& cb) noexcept
+{
+    if (started__) return BF_RUNNING;
+    if (!mapped__ && !generator__) return BF_NO_INPUT;
+    if (!sink) return BF_BAD_PARAM;
+
+    try
+    {
+        sink__    = sink;
+        cb_done__ = cb;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return BF_OUT_OF_MEM;
+    }
+
+    free__.clear();
+    for (size_t i{ std::size(slots__) }; 0 < i--;)
+    {
+        slots__[i].busy = false;
+        slots__[i].done = false;
+        free__.push_back(i);
+    }
+
+    read__      = 0;
+    emitted__   = 0;
+    failed__    = 0;
+    in_flight__ = 0;
+    buffered__  = 0;
+    exhausted__ = false;
+    started__   = true;
+
+    pump();
+    return BF_OK;
+}
+
+/**
+ * @brief stop - Stop the fetch
+ *
+ * The running transfers are removed from the session, the pending results are dropped and the done callback is not
+ * called.
+ */
+void
+bulk_fetch::stop(void) noexcept
+{
+    if (!started__) return;
+
+    started__ = false;
+    for (auto& s : slots__)
+    {
+        if (s.busy && !s.done) session__.remove_handle(*s.h);
+        s.busy = false;
+        s.done = false;
+    }
+
+    in_flight__ = 0;
+    buffered__  = 0;
+}
+
+/**
+ * @brief pump - Fill the window with the next URLs of the input
+ *
+ * Completes the fetch when there is nothing left to do.
+ */
+void
+bulk_fetch::pump(void) noexcept
+{
+    // A transfer may complete while being added : the outer call does the job
+    if (pumping__) return;
+
+    pumping__ = true;
+    while (started__ && !exhausted__)
+    {
+        // Ordered output : the slot of a URL is its position modulo the window (ring buffer)
+        slot* s{ nullptr };
+        if (ordered__)
+        {
+            s = &slots__[read__ % std::size(slots__)];
+            if (s->busy) break;
+        }
+        else
+        {
+            if (std::empty(free__)) break;
+            s = &slots__[free__.back()];
+        }
+
+        if (!next_url(s->url))
+        {
+            exhausted__ = true;
+            break;
+        }
+
+        if (!ordered__) free__.pop_back();
+        s->index = read__++;
+        s->busy  = true;
+        launch(*s);
+    }
+    pumping__ = false;
+
+    if (started__ && exhausted__ && 0 == in_flight__ && 0 == buffered__)
+    {
+        started__ = false;
+
+        // The bulk fetch may be destroyed (or restarted) from the callback
+        auto cb{ std::move(cb_done__) };
+        cb_done__ = nullptr;
+        if (cb) cb(stats());
+    }
+}
+
+/**
+ * @brief launch - Start the transfer of a slot
+ *
+ * @param s The slot
+ */
+void
+bulk_fetch::launch(slot& s) noexcept
+{
+    const auto i{ static_cast<size_t>(&s - slots__.data()) };
+
+    ++in_flight__;
+    s.body.clear();
+    s.code          = 0;
+    s.response_code = 0;
+
+    if (handle::HDL_OK != s.h->set_opt(CURLOPT_URL, s.url))
+    {
+        completed(i, CURLE_URL_MALFORMAT);
+        return;
+    }
+
+    try
+    {
+        if (configure__) configure__(*s.h, s.url);
+    }
+    catch (...)
+    {
+        completed(i, CURLE_FAILED_INIT);
+        return;
+    }
+
+    if (mhandle::MHDL_OK != session__.add_handle(*s.h)) completed(i, CURLE_FAILED_INIT);
+}
+
+/**
+ * @brief completed - Account for the completion of a transfer, and emit the results that can be
+ *
+ * @param i The slot of the transfer
+ * @param result The result of the transfer
+ */
+void
+bulk_fetch::completed(size_t i, int result) noexcept
+{
+    auto& s{ slots__[i] };
+    if (!started__ || !s.busy || s.done) return;
+
+    --in_flight__;
+    s.code = result;
+    s.done = true;
+    if (CURLE_OK == result)
+    {
+        if (auto info{ s.h->get_info(CURLINFO_RESPONSE_CODE) }; handle::HDL_OK == info.ret)
+            s.response_code = std::any_cast<long>(info.value);
+    }
+
+    if (!ordered__)
+        emit(s);
+    else
+    {
+        ++buffered__;
+        for (auto* next{ &slots__[emitted__ % std::size(slots__)] }; started__ && next->done;
+             next = &slots__[emitted__ % std::size(slots__)])
+        {
+            --buffered__;
+            emit(*next);
+        }
+    }
+
+    pump();
+}
+
+/**
+ * @brief emit - Hand the result of a slot to the sink, and release the slot
+ *
+ * @param s The slot
+ */
+void
+bulk_fetch::emit(slot& s) noexcept
+{
+    if (CURLE_OK != s.code || 400 <= s.response_code) ++failed__;
+    ++emitted__;
+
+    try
+    {
+        sink__({ s.index, s.url, s.code, s.response_code, s.body });
+    }
+    catch (...)
+    {
+    }
+
+    s.busy = false;
+    s.done = false;
+    if (!ordered__) free__.push_back(static_cast<size_t>(&s - slots__.data()));
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+bulk_fetch::retCode2Str(bulk_fetch::BF_RetCode rc) noexcept
+{
+    static const std::map<BF_RetCode, std::string> _retcodeMap{ { BF_OK, "ok" },
+                                                                { BF_BAD_PARAM, "bad parameter" },
+                                                                { BF_RUNNING, "bulk fetch running" },
+                                                                { BF_NO_INPUT, "no input" },
+                                                                { BF_IO_ERROR, "input file error" },
+                                                                { BF_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
@@ -0,0 +1,35 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+/**
+ * @file clock.hpp
+ * @brief Internal monotonic clock helpers
+ * @author lhm
+ */
+
+#ifndef SRC_ASYNCURL_CLOCK_H
+#define SRC_ASYNCURL_CLOCK_H
+
+#include <chrono>
+#include <cstdint> // int64_t
+
+namespace asyncurl
+{
+/**
+ * @brief monotonic_us - Get the current monotonic time
+ * @return The time elapsed since an arbitrary (but fixed) point in time, in microseconds
+ */
+inline int64_t
+monotonic_us(void) noexcept
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace asyncurl
+
+#endif // SRC_ASYNCURL_CLOCK_H
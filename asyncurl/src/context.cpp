@@ -0,0 +1,270 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/context.hpp>
+#include <asyncurl/handle.hpp>
+#include <asyncurl/mhandle.hpp>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief context - Constructor of a root context
+ *
+ * @param session The session performing the transfers of the context
+ * @param timeout_ms The time left before the deadline of the context (milliseconds) - 0 for no deadline
+ *
+ * @warning The session should outlive its contexts
+ */
+context::context(mhandle& session, long timeout_ms)
+  : session__{ session }
+{
+    if (0 < timeout_ms)
+    {
+        deadline_us__ = monotonic_us() + static_cast<int64_t>(timeout_ms) * 1000;
+        session__.ctx_schedule(*this);
+    }
+}
+
+/**
+ * @brief context - Constructor of a child context
+ *
+ * The child context shares the session of its parent, and is cancelled (or expires) with it.
+ * Its own deadline only matters if it is earlier than the one of its parent.
+ * @param parent The parent context
+ * @param timeout_ms The time left before the deadline of the context (milliseconds) - 0 for no deadline
+ *
+ * @warning The parent context should outlive its children
+ */
+context::context(context& parent, long timeout_ms)
+  : session__{ parent.session__ }
+  , parent__{ &parent }
+  , result__{ parent.result__ } // A child of a completed context is born completed
+{
+    sibling_next__ = parent.children__;
+    if (nullptr != sibling_next__) sibling_next__->sibling_prev__ = this;
+    parent.children__ = this;
+
+    if (0 < timeout_ms && !done())
+    {
+        deadline_us__ = monotonic_us() + static_cast<int64_t>(timeout_ms) * 1000;
+        try
+        {
+            session__.ctx_schedule(*this);
+        }
+        catch (...)
+        {
+            parent.children__ = sibling_next__;
+            if (nullptr != sibling_next__) sibling_next__->sibling_prev__ = nullptr;
+            throw;
+        }
+    }
+}
+
+/**
+ * @brief ~context - Destructor
+ *
+ * The transfers still attached to the context (and to its children) are cancelled.
+ * The children contexts outliving it become root contexts.
+ */
+context::~context() noexcept
+{
+    complete(handle::HDL_CANCELLED);
+
+    for (auto c{ children__ }; nullptr != c;)
+    {
+        auto next{ c->sibling_next__ };
+
+        c->parent__       = nullptr;
+        c->sibling_prev__ = nullptr;
+        c->sibling_next__ = nullptr;
+        c                 = next;
+    }
+
+    if (nullptr != parent__)
+    {
+        (nullptr != sibling_prev__ ? sibling_prev__->sibling_next__ : parent__->children__) = sibling_next__;
+        if (nullptr != sibling_next__) sibling_next__->sibling_prev__ = sibling_prev__;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// CANCELLATION
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief cancel - Cancel the context
+ *
+ * The running and queued transfers of the context and of its children are removed from the session, and their done
+ * callback is called with HDL_CANCELLED. Transfers can no longer be added to the context.
+ *
+ * @warning The contexts must not be destroyed from the done callbacks called during the cancellation
+ */
+void
+context::cancel(void) noexcept
+{
+    complete(handle::HDL_CANCELLED);
+}
+
+/**
+ * @brief set_timeout - Set the deadline of the context
+ *
+ * @param timeout_ms The time left before the deadline (milliseconds) - 0 to remove the deadline of the context
+ * @return A return code described by the \a CTX_RetCode enumerate
+ */
+context::CTX_RetCode
+context::set_timeout(long timeout_ms) noexcept
+{
+    if (timeout_ms < 0) return CTX_BAD_PARAM;
+    if (done()) return CTX_DONE;
+
+    if (0 != deadline_us__) session__.ctx_unschedule(*this);
+
+    deadline_us__ = (0 == timeout_ms) ? 0 : monotonic_us() + static_cast<int64_t>(timeout_ms) * 1000;
+    if (0 == deadline_us__) return CTX_OK;
+
+    try
+    {
+        session__.ctx_schedule(*this);
+    }
+    catch (const std::bad_alloc&)
+    {
+        deadline_us__ = 0;
+        return CTX_OUT_OF_MEM;
+    }
+
+    return CTX_OK;
+}
+
+/**
+ * @brief deadline_us - Get the deadline of the context, inherited from its parents
+ *
+ * @return The deadline (monotonic time, in microseconds) - 0 if neither the context nor its parents have one
+ */
+int64_t
+context::deadline_us(void) const noexcept
+{
+    int64_t ret{ 0 };
+
+    for (auto c{ this }; nullptr != c; c = c->parent__)
+        if (0 != c->deadline_us__ && (0 == ret || c->deadline_us__ < ret)) ret = c->deadline_us__;
+
+    return ret;
+}
+
+/**
+ * @brief remaining_ms - Get the time left before the deadline of the context (inherited from its parents)
+ *
+ * @return The time left (milliseconds) - -1 if there is no deadline, 0 if the context is completed
+ */
+long
+context::remaining_ms(void) const noexcept
+{
+    if (done()) return 0;
+
+    const auto deadline{ deadline_us() };
+    if (0 == deadline) return -1;
+
+    return static_cast<long>(std::max<int64_t>(0, (deadline - monotonic_us()) / 1000));
+}
+
+/**
+ * @brief attach - Attach a transfer to the context
+ *
+ * @param h The transfer
+ */
+void
+context::attach(handle& h) noexcept
+{
+    h.ctx__      = this;
+    h.ctx_prev__ = nullptr;
+    h.ctx_next__ = handles__;
+    if (nullptr != handles__) handles__->ctx_prev__ = &h;
+    handles__ = &h;
+    ++size__;
+}
+
+/**
+ * @brief detach - Detach a transfer from the context
+ *
+ * @param h The transfer
+ */
+void
+context::detach(handle& h) noexcept
+{
+    (nullptr != h.ctx_prev__ ? h.ctx_prev__->ctx_next__ : handles__) = h.ctx_next__;
+    if (nullptr != h.ctx_next__) h.ctx_next__->ctx_prev__ = h.ctx_prev__;
+
+    h.ctx__      = nullptr;
+    h.ctx_prev__ = nullptr;
+    h.ctx_next__ = nullptr;
+    --size__;
+}
+
+/**
+ * @brief complete - Complete the context, its transfers and its children
+ *
+ * @param result The result the transfers are completed with (HDL_CANCELLED or CURLE_OPERATION_TIMEDOUT)
+ */
+void
+context::complete(int result) noexcept
+{
+    if (done()) return;
+
+    result__ = result;
+    if (0 != deadline_us__) session__.ctx_unschedule(*this);
+
+    // The done callbacks may remove (or complete) other transfers of the context : always take the first one
+    while (nullptr != handles__)
+    {
+        auto h{ handles__ };
+
+        detach(*h);
+        session__.ctx_abort(*h, result);
+    }
+
+    // The done callbacks may also create children : restart from the first child after every completion
+    for (auto c{ children__ }; nullptr != c;)
+    {
+        if (c->done())
+        {
+            c = c->sibling_next__;
+            continue;
+        }
+
+        c->complete(result);
+        c = children__;
+    }
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+context::retCode2Str(context::CTX_RetCode rc) noexcept
+{
+    static const std::map<CTX_RetCode, std::string> _retcodeMap{ { CTX_OK, "ok" },
+                                                                 { CTX_BAD_PARAM, "bad parameter" },
+                                                                 { CTX_DONE, "context already cancelled or expired" },
+                                                                 { CTX_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
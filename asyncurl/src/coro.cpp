@@ -0,0 +1,193 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/coro.hpp>
+#include <asyncurl/handle.hpp>
+#include <asyncurl/mhandle.hpp>
+
+#include <curl/curl.h>
+
+#include <any>
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// TRANSFER AWAITER
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief ~transfer_awaiter - Destructor
+ *
+ * Destroyed while the transfer is pending (the awaiting coroutine was destroyed), the awaiter cancels the transfer :
+ * it is removed from the session, and its done callback is not called.
+ */
+transfer_awaiter::~transfer_awaiter() noexcept
+{
+    if (!pending__) return;
+
+    h__.awaiter__ = nullptr;
+    session__.remove_handle(h__);
+}
+
+/**
+ * @brief start - Add the transfer to the session
+ *
+ * @return Whether the awaiting coroutine must stay suspended (false if the transfer already completed, or failed to
+ * be added)
+ */
+bool
+transfer_awaiter::start(void) noexcept
+{
+    if (nullptr != h__.awaiter__)
+    {
+        result__ = { CURLE_FAILED_INIT, 0 }; // Already awaited
+        return false;
+    }
+
+    h__.awaiter__ = this;
+    pending__     = true;
+    starting__    = true;
+
+    const auto rc{ (nullptr != ctx__) ? session__.add_handle(h__, *ctx__) : session__.add_handle(h__) };
+
+    starting__ = false;
+    if (mhandle::MHDL_OK == rc) return pending__; // It may have completed while being added
+
+    const int code{ (mhandle::MHDL_CONTEXT_DONE == rc) ? handle::HDL_CANCELLED : static_cast<int>(CURLE_FAILED_INIT) };
+
+    h__.awaiter__ = nullptr;
+    pending__     = false;
+    result__      = { code, 0 };
+
+    return false;
+}
+
+/**
+ * @brief completed - Record the outcome of the transfer and resume the awaiting coroutine
+ *
+ * @param result The result of the transfer
+ */
+void
+transfer_awaiter::completed(int result) noexcept
+{
+    pending__ = false;
+    result__  = { result, 0 };
+
+    if (auto info{ h__.get_info(CURLINFO_RESPONSE_CODE) }; handle::HDL_OK == info.ret)
+        result__.response_code = std::any_cast<long>(info.value);
+
+    // Completed while being added : await_suspend returns false and the coroutine goes on by itself
+    if (!starting__) resume__(frame__);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// BODY STREAM
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief ~body_stream - Destructor
+ *
+ * Destroyed before the end of the transfer, the stream cancels it : it is removed from the session (its done callback
+ * is not called), or aborted by the write callback if the destruction happens while a chunk is being handled (curl
+ * forbids removing a transfer from its callbacks).
+ */
+body_stream::~body_stream() noexcept
+{
+    if (!started__ || finished__) return;
+
+    h__.awaiter__ = nullptr;
+    if (!delivering__) session__.remove_handle(h__);
+}
+
+/**
+ * @brief pull - Get the next chunk : add the transfer to the session the first time, resume it afterwards
+ *
+ * The coroutine may be resumed (and the stream destroyed) by this call : nothing is touched after it.
+ */
+void
+body_stream::pull(void) noexcept
+{
+    if (started__)
+    {
+        if (h__.is_paused(CURLPAUSE_RECV)) h__.unpause(CURLPAUSE_RECV); // curl may deliver the chunk right away
+        return;
+    }
+
+    if (nullptr != h__.awaiter__)
+    {
+        finish(CURLE_FAILED_INIT); // Already awaited
+        return;
+    }
+
+    auto h{ &h__ };
+    auto self{ static_cast<completion_hook*>(this) };
+
+    const auto set{ h__.set_cb_write([h, self](char* data, size_t size) -> size_t {
+        if (h->awaiter__ != self) return 0; // The stream was destroyed
+
+        auto s{ static_cast<body_stream*>(self) };
+        if (!s->waiting__) return CURL_WRITEFUNC_PAUSE; // curl keeps the chunk until the next call to next
+
+        s->waiting__   = false;
+        s->chunk__     = { data, size };
+        s->has_chunk__ = true;
+
+        s->delivering__ = true;
+        s->resume__(s->frame__);
+        if (h->awaiter__ != self) return 0; // Destroyed by the coroutine
+
+        s->delivering__ = false;
+        return size;
+    }) };
+
+    if (handle::HDL_OK != set)
+    {
+        finish(CURLE_FAILED_INIT);
+        return;
+    }
+
+    h__.awaiter__ = this;
+    started__     = true;
+
+    const auto rc{ (nullptr != ctx__) ? session__.add_handle(h__, *ctx__) : session__.add_handle(h__) };
+    if (mhandle::MHDL_OK == rc) return;
+
+    h__.awaiter__ = nullptr;
+    finish((mhandle::MHDL_CONTEXT_DONE == rc) ? handle::HDL_CANCELLED : static_cast<int>(CURLE_FAILED_INIT));
+}
+
+/**
+ * @brief finish - End the stream and resume the coroutine waiting for a chunk (if any) with std::nullopt
+ *
+ * @param result The result of the transfer
+ */
+void
+body_stream::finish(int result) noexcept
+{
+    finished__ = true;
+    result__   = result;
+
+    if (!waiting__) return;
+
+    waiting__ = false;
+    resume__(frame__);
+}
+
+/**
+ * @brief completed - Record the outcome of the transfer and end the stream
+ *
+ * @param result The result of the transfer
+ */
+void
+body_stream::completed(int result) noexcept
+{
+    if (auto info{ h__.get_info(CURLINFO_RESPONSE_CODE) }; handle::HDL_OK == info.ret)
+        response_code__ = std::any_cast<long>(info.value);
+
+    finish(result);
+}
+
+} // namespace asyncurl
@@ -0,0 +1,431 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/context.hpp>
+#include <asyncurl/dag.hpp>
+#include <asyncurl/handle.hpp>
+#include <asyncurl/mhandle.hpp>
+
+#include <curl/curl.h>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <any>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief dag - Constructor
+ *
+ * @param session The session performing the transfers of the nodes
+ * @param max_running The maximum number of nodes running concurrently (0 for unlimited)
+ *
+ * @warning The session should outlive the graph
+ */
+dag::dag(mhandle& session, size_t max_running) noexcept
+  : session__{ session }
+  , max_running__{ (0 == max_running) ? SIZE_MAX : max_running }
+{}
+
+/**
+ * @brief ~dag - Destructor
+ *
+ * The running transfers are removed from the session, and the done callback is not called.
+ */
+dag::~dag() noexcept {}
+
+//---------------------------------------------------------------------------------------------------------------------
+// GRAPH
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief add_node - Add a node to the graph
+ *
+ * The parents must already be part of the graph, which guarantees that it has no cycle.
+ * The builder is called when all the parents succeeded : it configures the transfer of the node (URL, options, write
+ * callback...) out of their results. The done callback of the transfer is owned by the graph.
+ * @param builder The builder of the transfer of the node
+ * @param parents The nodes the node depends on
+ * @param id The identifier of the new node
+ * @return A return code described by the \a DAG_RetCode enumerate
+ */
+dag::DAG_RetCode
+dag::add_node(const TBuilder& builder, const std::vector<node_id>& parents, node_id& id) noexcept
+{
+    if (started__) return DAG_RUNNING;
+    if (!builder) return DAG_BAD_PARAM;
+    for (auto p : parents)
+        if (p >= std::size(nodes__)) return DAG_BAD_PARAM;
+
+    const node_id ret{ std::size(nodes__) };
+    size_t        linked{ 0 };
+    try
+    {
+        nodes__.emplace_back();
+        nodes__.back().builder = builder;
+        nodes__.back().parents = parents;
+
+        for (auto p : parents)
+        {
+            nodes__[p].children.push_back(ret);
+            ++linked;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        for (size_t i{ 0 }; i < linked; ++i)
+            nodes__[parents[i]].children.pop_back();
+        if (std::size(nodes__) > ret) nodes__.pop_back();
+        return DAG_OUT_OF_MEM;
+    }
+
+    id = ret;
+    return DAG_OK;
+}
+
+/**
+ * @brief result - Get the outcome of a node (of the current, or last, execution)
+ *
+ * @param id The node
+ * @return The outcome of the node - nullptr if it is not part of the graph
+ */
+const dag::node_result*
+dag::result(node_id id) const noexcept
+{
+    return (id < std::size(nodes__)) ? &nodes__[id].result : nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// EXECUTION
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief start - Execute the graph
+ *
+ * The graph can be executed again once completed (the results of the previous execution are then lost).
+ * @param cb The callback called once every node succeeded, failed or was skipped
+ * @param ctx The context the transfers are attached to (if any) - its cancellation fails the running nodes
+ * @return A return code described by the \a DAG_RetCode enumerate
+ */
+dag::DAG_RetCode
+dag::start(const TCbDone& cb, context* ctx) noexcept
+{
+    if (started__) return DAG_RUNNING;
+    if (std::empty(nodes__) || (nullptr != ctx && &session__ != &ctx->session())) return DAG_BAD_PARAM;
+
+    try
+    {
+        cb_done__ = cb;
+        ready__.clear();
+        ready__.reserve(std::size(nodes__)); // A node gets ready once at most : make_ready can not throw
+    }
+    catch (const std::bad_alloc&)
+    {
+        return DAG_OUT_OF_MEM;
+    }
+
+    // The identifiers are a topological order : the heights are computed from the last node
+    for (auto i{ std::size(nodes__) }; 0 < i--;)
+    {
+        auto& n{ nodes__[i] };
+
+        n.waiting = std::size(n.parents);
+        n.height  = 0;
+        n.result  = {};
+        for (auto c : n.children)
+            n.height = std::max(n.height, nodes__[c].height + 1);
+    }
+
+    context__   = ctx;
+    report__    = {};
+    running__   = 0;
+    completed__ = 0;
+    start_us__  = monotonic_us();
+    started__   = true;
+
+    for (node_id i{ 0 }; i < std::size(nodes__); ++i)
+        if (0 == nodes__[i].waiting) make_ready(i);
+
+    pump();
+    return DAG_OK;
+}
+
+/**
+ * @brief cancel - Stop the execution of the graph
+ *
+ * The running nodes fail (HDL_CANCELLED), the others are skipped, then the done callback is called.
+ */
+void
+dag::cancel(void) noexcept
+{
+    if (!started__) return;
+
+    // Hold the completion until every node is accounted for
+    pumping__ = true;
+    ready__.clear();
+
+    for (node_id i{ 0 }; i < std::size(nodes__); ++i)
+    {
+        auto& n{ nodes__[i] };
+
+        if (NODE_PENDING == n.result.state || NODE_READY == n.result.state)
+        {
+            n.result.state = NODE_SKIPPED;
+            ++completed__;
+        }
+        else if (NODE_RUNNING == n.result.state)
+        {
+            session__.remove_handle(*n.h);
+            finished(i, handle::HDL_CANCELLED);
+        }
+    }
+
+    pumping__ = false;
+    pump();
+}
+
+/**
+ * @brief make_ready - Queue a node whose parents all succeeded
+ *
+ * @param id The node
+ */
+void
+dag::make_ready(node_id id) noexcept
+{
+    auto& n{ nodes__[id] };
+
+    n.result.state = NODE_READY;
+    n.ready_us     = monotonic_us();
+
+    ready__.emplace_back(n.height, id);
+    std::push_heap(std::begin(ready__), std::end(ready__));
+}
+
+/**
+ * @brief pump - Start the ready nodes, as long as concurrency slots are available
+ *
+ * Completes the execution when there is nothing left to do.
+ */
+void
+dag::pump(void) noexcept
+{
+    // A transfer may complete while being added (or a builder may fail) : the outer call does the job
+    if (pumping__) return;
+
+    pumping__ = true;
+    while (started__ && running__ < max_running__ && !std::empty(ready__))
+    {
+        std::pop_heap(std::begin(ready__), std::end(ready__));
+        const auto id{ ready__.back().second };
+        ready__.pop_back();
+
+        launch(id);
+    }
+    pumping__ = false;
+
+    if (started__ && completed__ == std::size(nodes__)) conclude();
+}
+
+/**
+ * @brief launch - Build the transfer of a node and add it to the session
+ *
+ * @param id The node
+ */
+void
+dag::launch(node_id id) noexcept
+{
+    auto&      n{ nodes__[id] };
+    const auto now{ monotonic_us() };
+    bool       built{ false };
+
+    n.result.state   = NODE_RUNNING;
+    n.result.wait_us = now - n.ready_us;
+    n.start_us       = now;
+    ++running__;
+
+    try
+    {
+        if (!n.h)
+            n.h = std::make_unique<handle>();
+        else
+            n.h->reset();
+
+        std::vector<const node_result*> inputs;
+        inputs.reserve(std::size(n.parents));
+        for (auto p : n.parents)
+            inputs.push_back(&nodes__[p].result);
+
+        auto& res{ n.result };
+        n.h->set_cb_write([&res](char* data, size_t size) -> size_t {
+            try
+            {
+                res.body.append(data, size);
+            }
+            catch (const std::bad_alloc&)
+            {
+                return 0;
+            }
+            return size;
+        });
+
+        built = n.builder(*n.h, inputs);
+    }
+    catch (...)
+    {
+        built = false;
+    }
+
+    if (!built)
+    {
+        finished(id, CURLE_FAILED_INIT);
+        return;
+    }
+
+    n.h->set_cb_done([this, id](int result) { this->finished(id, result); });
+
+    switch ((nullptr != context__) ? session__.add_handle(*n.h, *context__) : session__.add_handle(*n.h))
+    {
+        case mhandle::MHDL_OK: break;
+        case mhandle::MHDL_CONTEXT_DONE: finished(id, handle::HDL_CANCELLED); break;
+        default: finished(id, CURLE_FAILED_INIT); break;
+    }
+}
+
+/**
+ * @brief finished - Account for the completion of a node, and release (or skip) its children
+ *
+ * @param id The node
+ * @param code The result of its transfer
+ */
+void
+dag::finished(node_id id, int code) noexcept
+{
+    auto& n{ nodes__[id] };
+    if (NODE_RUNNING != n.result.state) return;
+
+    --running__;
+    ++completed__;
+
+    n.result.code        = code;
+    n.result.duration_us = monotonic_us() - n.start_us;
+    if (CURLE_OK == code)
+    {
+        if (auto info{ n.h->get_info(CURLINFO_RESPONSE_CODE) }; handle::HDL_OK == info.ret)
+            n.result.response_code = std::any_cast<long>(info.value);
+    }
+
+    const bool success{ CURLE_OK == code && n.result.response_code < 400 };
+    n.result.state = success ? NODE_SUCCEEDED : NODE_FAILED;
+
+    for (auto c : n.children)
+    {
+        if (!success)
+            skip(c);
+        else if (0 == --nodes__[c].waiting && NODE_PENDING == nodes__[c].result.state)
+            make_ready(c);
+    }
+
+    pump();
+}
+
+/**
+ * @brief skip - Skip a node (and its descendants) because one of its ancestors failed
+ *
+ * @param id The node
+ */
+void
+dag::skip(node_id id) noexcept
+{
+    auto& n{ nodes__[id] };
+    if (NODE_PENDING != n.result.state) return;
+
+    n.result.state = NODE_SKIPPED;
+    ++completed__;
+
+    for (auto c : n.children)
+        skip(c);
+}
+
+/**
+ * @brief conclude - Build the report of the execution and call the done callback
+ */
+void
+dag::conclude(void) noexcept
+{
+    started__ = false;
+
+    report__            = {};
+    report__.elapsed_us = monotonic_us() - start_us__;
+    for (const auto& n : nodes__)
+    {
+        if (NODE_SUCCEEDED == n.result.state) ++report__.succeeded;
+        if (NODE_FAILED == n.result.state) ++report__.failed;
+        if (NODE_SKIPPED == n.result.state) ++report__.skipped;
+    }
+
+    // Longest chain of executed nodes, weighted by their durations (the identifiers are a topological order)
+    try
+    {
+        std::vector<int64_t> path_us(std::size(nodes__), 0);
+        std::vector<node_id> prev(std::size(nodes__), SIZE_MAX);
+        node_id              last{ SIZE_MAX };
+
+        for (node_id i{ 0 }; i < std::size(nodes__); ++i)
+        {
+            const auto& n{ nodes__[i] };
+            if (NODE_SUCCEEDED != n.result.state && NODE_FAILED != n.result.state) continue;
+
+            for (auto p : n.parents)
+            {
+                if (SIZE_MAX == prev[i] || path_us[p] > path_us[prev[i]]) prev[i] = p;
+            }
+            path_us[i] = n.result.duration_us + ((SIZE_MAX == prev[i]) ? 0 : path_us[prev[i]]);
+
+            if (SIZE_MAX == last || path_us[i] > path_us[last]) last = i;
+        }
+
+        if (SIZE_MAX != last) report__.critical_path_us = path_us[last];
+        for (auto i{ last }; SIZE_MAX != i; i = prev[i])
+            report__.critical_path.push_back(i);
+        std::reverse(std::begin(report__.critical_path), std::end(report__.critical_path));
+    }
+    catch (const std::bad_alloc&)
+    {
+        report__.critical_path.clear();
+    }
+
+    // The graph may be destroyed (or restarted) from the callback
+    auto cb{ std::move(cb_done__) };
+    cb_done__ = nullptr;
+    if (cb) cb(report__);
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+dag::retCode2Str(dag::DAG_RetCode rc) noexcept
+{
+    static const std::map<DAG_RetCode, std::string> _retcodeMap{ { DAG_OK, "ok" },
+                                                                 { DAG_BAD_PARAM, "bad parameter" },
+                                                                 { DAG_RUNNING, "graph being executed" },
+                                                                 { DAG_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
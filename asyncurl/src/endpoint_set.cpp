@@ -0,0 +1,334 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/endpoint_set.hpp>
+#include <asyncurl/mhandle.hpp>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <stdexcept>
+
+#define ES_MAX_EJECTION_FACTOR 10
+#define ES_FAILURE_PENALTY_US 1000000
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief endpoint_set - Constructor
+ *
+ * @param host The logical host (as found in the URLs of the transfers to route)
+ * @param port The logical port (as found in the URLs of the transfers to route, or the scheme default port)
+ */
+endpoint_set::endpoint_set(const std::string& host, long port)
+  : host__{ host }
+  , port__{ port }
+{
+    if (std::empty(host__) || port__ <= 0 || port__ > 65535) throw std::invalid_argument("Invalid logical host");
+
+    std::transform(std::begin(host__), std::end(host__), std::begin(host__), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+}
+
+/**
+ * @brief ~endpoint_set - Destructor
+ *
+ * Unregisters the set from its session if necessary.
+ */
+endpoint_set::~endpoint_set() noexcept
+{
+    if (nullptr != multi_handler__) multi_handler__->remove_endpoint_set(*this);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// ENDPOINTS
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief add_endpoint - Add an endpoint to the set
+ *
+ * @param address The address (IP or hostname) of the endpoint
+ * @param port The port of the endpoint (0 to use the logical port)
+ * @return A return code described by the \a ES_RetCode enumerate
+ */
+endpoint_set::ES_RetCode
+endpoint_set::add_endpoint(const std::string& address, long port) noexcept
+{
+    if (std::empty(address) || port < 0 || port > 65535) return ES_BAD_PARAM;
+    if (0 == port) port = port__;
+
+    long free_slot{ -1 };
+    for (long i{ 0 }; i < static_cast<long>(std::size(endpoints__)); ++i)
+    {
+        const auto& ep{ endpoints__[i] };
+        if (!ep.removed && ep.address == address && ep.port == port) return ES_ALREADY;
+        if (ep.removed && 0 == ep.outstanding && -1 == free_slot) free_slot = i;
+    }
+
+    endpoint ep;
+    bool     appended{ false };
+    try
+    {
+        ep.address = address;
+        ep.port    = port;
+
+        // IPv6 addresses must be bracketed in CURLOPT_CONNECT_TO entries
+        const bool ipv6{ std::string::npos != address.find(':') && '[' != address.front() };
+        ep.connect_to = host__ + ":" + std::to_string(port__) + ":" + (ipv6 ? "[" + address + "]" : address) + ":" +
+                        std::to_string(port);
+
+        if (-1 == free_slot)
+        {
+            free_slot = static_cast<long>(std::size(endpoints__));
+            endpoints__.emplace_back(std::move(ep));
+            appended = true;
+        }
+        else
+            std::swap(endpoints__[free_slot], ep); // ep keeps the removed endpoint, for the rollback
+    }
+    catch (const std::bad_alloc&)
+    {
+        return ES_OUT_OF_MEM;
+    }
+
+    try
+    {
+        live__.push_back(free_slot);
+    }
+    catch (const std::bad_alloc&)
+    {
+        if (appended)
+            endpoints__.pop_back();
+        else
+            std::swap(endpoints__[free_slot], ep);
+        return ES_OUT_OF_MEM;
+    }
+
+    return ES_OK;
+}
+
+/**
+ * @brief remove_endpoint - Remove an endpoint from the set
+ *
+ * The transfers already routed to this endpoint are not affected.
+ * @param address The address (IP or hostname) of the endpoint
+ * @param port The port of the endpoint (0 to use the logical port)
+ * @return A return code described by the \a ES_RetCode enumerate
+ */
+endpoint_set::ES_RetCode
+endpoint_set::remove_endpoint(const std::string& address, long port) noexcept
+{
+    if (0 == port) port = port__;
+
+    for (auto it{ std::begin(live__) }; std::end(live__) != it; ++it)
+    {
+        auto& ep{ endpoints__[*it] };
+        if (ep.address != address || ep.port != port) continue;
+
+        ep.removed = true;
+        live__.erase(it);
+        return ES_OK;
+    }
+
+    return ES_UNKNOWN;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// OPTIONS
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_ewma_decay - Set the weight of the latest latency sample in the latency EWMA
+ *
+ * @param alpha The weight in ]0, 1] (the higher, the more reactive)
+ * @return A return code described by the \a ES_RetCode enumerate
+ */
+endpoint_set::ES_RetCode
+endpoint_set::set_ewma_decay(double alpha) noexcept
+{
+    if (alpha <= 0 || alpha > 1) return ES_BAD_PARAM;
+    ewma_alpha__ = alpha;
+    return ES_OK;
+}
+
+/**
+ * @brief set_outlier_ejection - Set the outlier ejection policy
+ *
+ * An endpoint is ejected after a given amount of consecutive failures (transfer error or HTTP 5xx response).
+ * The ejection lasts base_ms multiplied by the number of times the endpoint has been ejected in a row.
+ * @param consecutive_failures The number of consecutive failures triggering an ejection (0 disables ejection)
+ * @param base_ms The base ejection duration (milliseconds)
+ * @param max_ejected_ratio The maximum ratio of the endpoints that can be ejected simultaneously
+ * @return A return code described by the \a ES_RetCode enumerate
+ */
+endpoint_set::ES_RetCode
+endpoint_set::set_outlier_ejection(long consecutive_failures, long base_ms, double max_ejected_ratio) noexcept
+{
+    if (consecutive_failures < 0 || base_ms < 0 || max_ejected_ratio < 0 || max_ejected_ratio > 1)
+        return ES_BAD_PARAM;
+
+    eject_failures__  = consecutive_failures;
+    eject_base_ms__   = base_ms;
+    eject_max_ratio__ = max_ejected_ratio;
+    return ES_OK;
+}
+
+/**
+ * @brief stats - Get a snapshot of the state of the endpoints
+ *
+ * @return The state of every endpoint of the set
+ */
+std::vector<endpoint_set::endpoint_stats>
+endpoint_set::stats(void) const
+{
+    const auto                  now{ monotonic_us() };
+    std::vector<endpoint_stats> ret;
+    ret.reserve(std::size(live__));
+
+    for (auto idx : live__)
+    {
+        const auto& ep{ endpoints__[idx] };
+        ret.push_back(
+          { ep.address, ep.port, ep.outstanding, ep.ewma_us, !available(ep, now), ep.requests, ep.failures });
+    }
+
+    return ret;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// SELECTION
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief available - Check whether an endpoint can be selected (i.e. it is not ejected)
+ *
+ * @param ep The endpoint
+ * @param now_us The current monotonic time (microseconds)
+ * @return true if the endpoint can be selected
+ */
+bool
+endpoint_set::available(const endpoint& ep, int64_t now_us) noexcept
+{
+    return (0 == ep.ejected_until_us) || (ep.ejected_until_us <= now_us);
+}
+
+/**
+ * @brief pick - Select an endpoint using the power-of-two-choices algorithm
+ *
+ * Two random available endpoints are drawn and the one with the lowest (outstanding + 1) * EWMA latency is selected.
+ * Endpoints without latency sample yet are favored so that they quickly get one.
+ * If every endpoint is ejected, the ejection is ignored (panic mode).
+ * @param now_us The current monotonic time (microseconds)
+ * @return The index of the selected endpoint or -1 if the set is empty
+ */
+long
+endpoint_set::pick(int64_t now_us) noexcept
+{
+    const auto n{ std::size(live__) };
+    if (0 == n) return -1;
+
+    auto draw = [this, n, now_us]() -> long {
+        std::uniform_int_distribution<size_t> dist(0, n - 1);
+        for (size_t attempt{ 0 }; attempt < 2 * n; ++attempt)
+        {
+            auto idx{ live__[dist(rng__)] };
+            if (available(endpoints__[idx], now_us)) return idx;
+        }
+        for (auto idx : live__)
+            if (available(endpoints__[idx], now_us)) return idx;
+        return live__[dist(rng__)];
+    };
+    auto score = [this](long idx) -> double {
+        const auto& ep{ endpoints__[idx] };
+        return static_cast<double>(ep.outstanding + 1) * std::max(ep.ewma_us, 1.0);
+    };
+
+    long ret{ draw() };
+    if (1 < n)
+    {
+        if (auto other{ draw() }; other != ret && score(other) < score(ret)) ret = other;
+    }
+
+    auto& ep{ endpoints__[ret] };
+    if (0 != ep.ejected_until_us && ep.ejected_until_us <= now_us) ep.ejected_until_us = 0; // Ejection is over
+
+    ++ep.outstanding;
+    ++ep.requests;
+    return ret;
+}
+
+/**
+ * @brief release - Account for the end of a transfer routed to an endpoint
+ *
+ * @param idx The index of the endpoint
+ * @param sample Whether the transfer went to completion (otherwise it was removed and nothing is learnt from it)
+ * @param failed Whether the transfer failed
+ * @param latency_us The total time of the transfer (microseconds)
+ * @param now_us The current monotonic time (microseconds)
+ */
+void
+endpoint_set::release(long idx, bool sample, bool failed, int64_t latency_us, int64_t now_us) noexcept
+{
+    if (idx < 0 || idx >= static_cast<long>(std::size(endpoints__))) return;
+
+    auto& ep{ endpoints__[idx] };
+    if (0 < ep.outstanding) --ep.outstanding;
+    if (!sample) return;
+
+    // Failures are accounted as (at least) a penalty latency, otherwise a failing endpoint would look attractive
+    const auto lat{ static_cast<double>(failed ? std::max<int64_t>(latency_us, ES_FAILURE_PENALTY_US) : latency_us) };
+    ep.ewma_us = (0 == ep.ewma_us) ? lat : ewma_alpha__ * lat + (1 - ewma_alpha__) * ep.ewma_us;
+
+    if (!failed)
+    {
+        ep.consecutive_failures = 0;
+        ep.ejections            = 0;
+        return;
+    }
+
+    ++ep.failures;
+    ++ep.consecutive_failures;
+
+    if (0 == eject_failures__ || ep.consecutive_failures < eject_failures__ || ep.removed) return;
+    if (0 != ep.ejected_until_us && ep.ejected_until_us > now_us) return; // Already ejected
+
+    size_t ejected{ 0 };
+    for (auto i : live__)
+        if (!available(endpoints__[i], now_us)) ++ejected;
+
+    if (static_cast<double>(ejected + 1) > eject_max_ratio__ * static_cast<double>(std::size(live__))) return;
+
+    ep.ejections            = std::min<long>(ep.ejections + 1, ES_MAX_EJECTION_FACTOR);
+    ep.ejected_until_us     = now_us + ep.ejections * eject_base_ms__ * 1000;
+    ep.consecutive_failures = 0;
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+endpoint_set::retCode2Str(endpoint_set::ES_RetCode rc) noexcept
+{
+    static const std::map<ES_RetCode, std::string> _retcodeMap{ { ES_OK, "ok" },
+                                                                { ES_BAD_PARAM, "bad parameter" },
+                                                                { ES_ALREADY, "endpoint already in the set" },
+                                                                { ES_UNKNOWN, "endpoint not in the set" },
+                                                                { ES_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
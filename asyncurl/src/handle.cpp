@@ -7,10 +7,15 @@
 #include <asyncurl/handle.hpp>
 #include <asyncurl/list.hpp>
 #include <asyncurl/mhandle.hpp>
+#include <asyncurl/poller.hpp>
 #include <curl/curl.h>
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <map>
 #include <stdexcept>
+#include <unordered_map>
 
 namespace asyncurl
 {
@@ -54,7 +59,7 @@ handle::handle()
 /**
  * @brief destructor
  * Performs RAII cleaning
- * - Remove from its \a mhandle if necessary
+ * - Remove from its \a poller and its \a mhandle if necessary
  * - Clean the handle data, connections
  *
  * @note You should avoid (as much as possible) to destroy handles.
@@ -62,6 +67,7 @@ handle::handle()
  */
 handle::~handle() noexcept
 {
+    if (nullptr != poller__) poller__->remove(*this);
     if (nullptr != multi_handler__) multi_handler__->remove_handle(*this);
     if (nullptr != curl_handle__) curl_easy_cleanup(curl_handle__);
 }
@@ -70,14 +76,26 @@ handle::~handle() noexcept
  * @brief handle::copy - Perform a copy of internal data
  *
  * Allows to avoid repeating series of set_opt()...
- * @return A new handle that you are responsible for
+ * @return A new handle that you are responsible for - nullptr if it could not be created
  *
  * @note You will still need to setup the required callbacks yourself
  */
 handle*
 handle::copy() noexcept
 {
-    handle* ret{ new handle(curl_easy_duphandle(curl_handle__)) };
+    CURL* dup{ curl_easy_duphandle(curl_handle__) };
+    if (nullptr == dup) return nullptr;
+
+    handle* ret{ nullptr };
+    try
+    {
+        ret = new handle(dup);
+    }
+    catch (...)
+    {
+        curl_easy_cleanup(dup);
+        return nullptr;
+    }
 
     for (const auto& [id, l] : lists__)
         ret->set_opt_list(id, l);
@@ -100,6 +118,55 @@ handle::raw(void) noexcept
     return curl_handle__;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+// ROUTING
+// Used by the sessions to route a transfer to one of the endpoints of an endpoint set
+// \see https://curl.se/libcurl/c/CURLOPT_CONNECT_TO.html
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief route_to - Route the transfer to a specific endpoint
+ *
+ * The entry is inserted in front of the CURLOPT_CONNECT_TO list set by the user (if any), so it takes precedence.
+ * @param connect_to The CURLOPT_CONNECT_TO entry ("HOST:PORT:CONNECT-TO-HOST:CONNECT-TO-PORT")
+ * @return A return code described by the \a HDL_RetCode enumerate
+ */
+handle::HDL_RetCode
+handle::route_to(const std::string& connect_to) noexcept
+{
+    try
+    {
+        if (auto it{ lists__.find(CURLOPT_CONNECT_TO) }; std::end(lists__) != it)
+            lb_connect_to__ = it->second;
+        else
+            lb_connect_to__.clear();
+
+        lb_connect_to__.push_front(connect_to);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return HDL_OUT_OF_MEM;
+    }
+
+    return (CURLE_OK == curl_easy_setopt(curl_handle__, CURLOPT_CONNECT_TO, lb_connect_to__.head__))
+             ? HDL_OK
+             : HDL_INTERNAL_ERROR;
+}
+
+/**
+ * @brief unroute - Restore the CURLOPT_CONNECT_TO list set by the user (if any)
+ */
+void
+handle::unroute(void) noexcept
+{
+    auto it{ lists__.find(CURLOPT_CONNECT_TO) };
+    curl_easy_setopt(curl_handle__, CURLOPT_CONNECT_TO, (std::end(lists__) != it) ? it->second.head__ : nullptr);
+    lb_connect_to__.clear();
+
+    lb_set__      = nullptr;
+    lb_endpoint__ = -1;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 // UN/PAUSE TRANSFER
 // \see https://curl.se/libcurl/c/curl_easy_pause.html
@@ -116,7 +183,10 @@ handle::pause(int bitmask) noexcept
 {
     const auto prev{ flags__ };
     flags__ |= (bitmask & CURLPAUSE_ALL);
-    return (flags__ == prev) || (CURLE_OK == curl_easy_pause(curl_handle__, flags__ & CURLPAUSE_ALL));
+
+    // The directions paused by the session (bandwidth budget, overtaken straggler) stay paused
+    const auto mask{ (flags__ | bw_paused__ | strg_paused__) & CURLPAUSE_ALL };
+    return (flags__ == prev) || (CURLE_OK == curl_easy_pause(curl_handle__, mask));
 }
 
 /**
@@ -142,7 +212,10 @@ handle::unpause(int bitmask) noexcept
 {
     const auto old{ flags__ };
     flags__ &= ~(bitmask & CURLPAUSE_ALL);
-    return (flags__ == old) || (CURLE_OK == curl_easy_pause(curl_handle__, flags__ & CURLPAUSE_ALL));
+
+    // The directions paused by the session (bandwidth budget, overtaken straggler) stay paused
+    const auto mask{ (flags__ | bw_paused__ | strg_paused__) & CURLPAUSE_ALL };
+    return (flags__ == old) || (CURLE_OK == curl_easy_pause(curl_handle__, mask));
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -210,9 +283,20 @@ handle::get_info_double(int id, double& val) const noexcept
 handle::HDL_RetCode
 handle::get_info_string(int id, std::string& val) const noexcept
 {
+    char* v{ nullptr };
     if (CURLINFO_STRING != (id & CURLINFO_TYPEMASK)) return HDL_BAD_PARAM;
-    return (CURLE_OK == curl_easy_getinfo(curl_handle__, static_cast<CURLINFO>(id), &val)) ? HDL_OK
-                                                                                           : HDL_INTERNAL_ERROR;
+    if (CURLE_OK != curl_easy_getinfo(curl_handle__, static_cast<CURLINFO>(id), &v)) return HDL_INTERNAL_ERROR;
+
+    try
+    {
+        val = (nullptr != v) ? v : "";
+    }
+    catch (const std::bad_alloc&)
+    {
+        return HDL_OUT_OF_MEM;
+    }
+
+    return HDL_OK;
 }
 
 /**
@@ -459,12 +543,138 @@ handle::perform_blocking(void) noexcept
 
     if (nullptr != multi_handler__) return res;
 
-    res = (CURLE_OK == curl_easy_perform(curl_handle__)) ? HDL_OK : HDL_INTERNAL_ERROR;
+    progress__.start(progress::PRG_RUNNING);
+
+    const auto code{ curl_easy_perform(curl_handle__) };
+    progress__.finish(code, -1);
+
+    res = (CURLE_OK == code) ? HDL_OK : HDL_INTERNAL_ERROR;
     if (cb_done__) cb_done__(res);
 
     return res;
 }
 
+/**
+ * @brief perform_all Perform blocking transfers concurrently, without event loop
+ *
+ * The transfers run on an internal multi handle (driven by curl_multi_poll), until they all completed or the deadline
+ * expired. The done callback of every transfer is called with its result.
+ * @param handles The transfers - they must not be owned by a session
+ * @param max_parallel The maximum number of transfers running at once (0 for unlimited)
+ * @param results The results of the transfers, in the order of the handles (CURLcode - HDL_CANCELLED if the transfer
+ * was not started before the deadline)
+ * @param timeout_ms The time allowed to the whole set of transfers (milliseconds) - 0 for no deadline. The transfers
+ * still running when it expires complete with CURLE_OPERATION_TIMEDOUT
+ * @return A return code described by the \a HDL_RetCode enumerate - HDL_TIMEOUT if the deadline expired
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_poll.html
+ */
+handle::HDL_RetCode
+handle::perform_all(const std::vector<handle*>& handles, size_t max_parallel, std::vector<int>& results,
+                    long timeout_ms) noexcept
+{
+    std::unordered_map<CURL*, size_t> index;
+
+    if (0 > timeout_ms) return HDL_BAD_PARAM;
+    try
+    {
+        index.reserve(std::size(handles));
+        for (size_t i{ 0 }; i < std::size(handles); ++i)
+        {
+            if (nullptr == handles[i] || !index.emplace(handles[i]->curl_handle__, i).second) return HDL_BAD_PARAM;
+            if (nullptr != handles[i]->multi_handler__) return HDL_BAD_FUNCTION;
+        }
+        results.assign(std::size(handles), HDL_CANCELLED);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return HDL_OUT_OF_MEM;
+    }
+
+    CURLM* multi{ curl_multi_init() };
+    if (nullptr == multi) return HDL_INTERNAL_ERROR;
+
+    const auto deadline{ std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms) };
+    const auto limit{ (0 == max_parallel) ? std::size(handles) : max_parallel };
+    size_t     next{ 0 };
+    size_t     running{ 0 };
+    auto       ret{ HDL_OK };
+
+    auto complete = [&](size_t i, int result) {
+        results[i] = result;
+        handles[i]->progress__.finish(result, -1);
+        if (handles[i]->cb_done__) handles[i]->cb_done__(result);
+    };
+
+    while (next < std::size(handles) || 0 < running)
+    {
+        for (; next < std::size(handles) && running < limit; ++next)
+        {
+            if (CURLM_OK == curl_multi_add_handle(multi, handles[next]->curl_handle__))
+            {
+                handles[next]->progress__.start(progress::PRG_RUNNING);
+                ++running;
+            }
+            else
+                complete(next, CURLE_FAILED_INIT);
+        }
+
+        int still;
+        if (CURLM_OK != curl_multi_perform(multi, &still))
+        {
+            ret = HDL_INTERNAL_ERROR;
+            break;
+        }
+
+        int      dumb;
+        CURLMsg* msg{ nullptr };
+        while ((msg = curl_multi_info_read(multi, &dumb)))
+        {
+            if (CURLMSG_DONE != msg->msg) continue;
+
+            CURL*      hdl{ msg->easy_handle };
+            const auto result{ msg->data.result }; // msg does not survive the removal of the handle
+
+            curl_multi_remove_handle(multi, hdl);
+            --running;
+            complete(index[hdl], result);
+        }
+        if (next == std::size(handles) && 0 == running) break;
+
+        int wait_ms{ 1000 };
+        if (0 < timeout_ms)
+        {
+            const auto left{ std::chrono::duration_cast<std::chrono::milliseconds>(
+                               deadline - std::chrono::steady_clock::now())
+                               .count() };
+            if (0 >= left)
+            {
+                ret = HDL_TIMEOUT;
+                break;
+            }
+            wait_ms = static_cast<int>(std::min<long long>(wait_ms, left));
+        }
+
+        curl_multi_poll(multi, nullptr, 0, wait_ms, nullptr);
+    }
+
+    // Deadline expired (or multi error) : the running transfers are interrupted, the others never started
+    const int interrupted{ (HDL_TIMEOUT == ret) ? CURLE_OPERATION_TIMEDOUT : CURLE_FAILED_INIT };
+    for (size_t i{ 0 }; i < next && 0 < running; ++i)
+    {
+        if (HDL_CANCELLED != results[i]) continue;
+
+        curl_multi_remove_handle(multi, handles[i]->curl_handle__);
+        --running;
+        complete(i, interrupted);
+    }
+    for (size_t i{ next }; i < std::size(handles); ++i)
+        complete(i, HDL_CANCELLED);
+
+    curl_multi_cleanup(multi);
+    return ret;
+}
+
 /**
  * @brief reset - Reinitializes all options of a session
  * @note It does not change connections, session ID cache, DNS cache, cookies...
@@ -487,6 +697,10 @@ handle::reset(void) noexcept
     lists__.clear();
     strings__.clear();
 
+    bw_weight__      = 1;
+    socket_factory__ = nullptr;
+    tag__.clear(); // Unlinked from its group by the removal above
+
     flags__ = 0;
 }
 
@@ -513,7 +727,38 @@ handle::set_cb_write(const TCbWrite& cb) noexcept
 
         if (nullptr == This) return 0;
 
+        // A reissue of the transfer overtook it (\see mhandle::set_straggler_reissue) : it delivers the data instead
+        // (recorded, so that resuming the bandwidth governed transfers keeps it paused)
+        if (!This->strg_reissue__ && nullptr != This->strg_twin__ && This->strg_twin__->strg_won__)
+        {
+            This->strg_paused__ |= CURLPAUSE_RECV;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
+        // The session bandwidth budget of this period is exhausted : curl keeps the data until the next period
+        if (This->bw_governed__ && This->bw_allowance__[0] <= 0)
+        {
+            This->bw_paused__ |= CURLPAUSE_RECV;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
         if (This->cb_write__) ret = This->cb_write__(ptr, size * nmemb);
+        if (ret == size * nmemb)
+        {
+            This->rx_bytes__ += ret;
+            if (nullptr != This->multi_handler__) This->multi_handler__->rx_bytes__ += ret;
+
+            // The expected size is known once the headers are received : queried along with the first chunk
+            curl_off_t total{ -1 };
+            if (0 == This->progress__.current().dl_now)
+                curl_easy_getinfo(This->curl_handle__, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &total);
+            This->progress__.received(ret, total);
+        }
+        if (This->bw_governed__ && CURL_WRITEFUNC_PAUSE != ret)
+        {
+            This->bw_allowance__[0] -= static_cast<double>(size * nmemb);
+            This->bw_used__[0] += static_cast<double>(size * nmemb);
+        }
 
         // This is a magic return code for the write callback that, when returned, will signal libcurl to pause
         // receiving on the current transfer.
@@ -550,7 +795,27 @@ handle::set_cb_read(const TCbRead& cb) noexcept
 
         if (nullptr == This) return 0; // Abort the transfert
 
+        // The session bandwidth budget of this period is exhausted : wait for the next period
+        if (This->bw_governed__ && This->bw_allowance__[1] <= 0)
+        {
+            This->bw_paused__ |= CURLPAUSE_SEND;
+            return CURL_READFUNC_PAUSE;
+        }
+
         if (This->cb_read__) ret = This->cb_read__(buffer, size * nitems);
+        if (0 < ret && ret <= size * nitems)
+        {
+            curl_off_t total{ -1 };
+            if (0 == This->progress__.current().ul_now)
+                curl_easy_getinfo(This->curl_handle__, CURLINFO_CONTENT_LENGTH_UPLOAD_T, &total);
+            This->progress__.sent(ret, total);
+            if (nullptr != This->multi_handler__) This->multi_handler__->tx_bytes__ += ret;
+        }
+        if (This->bw_governed__ && ret <= size * nitems)
+        {
+            This->bw_allowance__[1] -= static_cast<double>(ret);
+            This->bw_used__[1] += static_cast<double>(ret);
+        }
 
         // This is a magic return code for the read callback that, when returned, will signal libcurl to pause
         // sending on the current transfer.
@@ -692,6 +957,79 @@ handle::set_cb_done(const TCbDone& cb) noexcept
     return HDL_OK;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+// SESSION PARAMETERS
+// Parameters only used when the transfer is performed by a session
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_bandwidth_weight - Set the weight of the transfer in the session bandwidth budget
+ *
+ * When the session has a bandwidth limit (\see mhandle::set_bandwidth_limit), the budget is shared between its
+ * transfers proportionally to their weights.
+ * @param weight The weight of the transfer (default 1)
+ * @return A return code described by the \a HDL_RetCode enumerate
+ */
+handle::HDL_RetCode
+handle::set_bandwidth_weight(long weight) noexcept
+{
+    if (weight <= 0) return HDL_BAD_PARAM;
+    bw_weight__ = weight;
+    return HDL_OK;
+}
+
+/**
+ * @brief set_socket_factory - Set the factory creating and tuning the sockets of the transfer
+ *
+ * Only used when the transfer is performed by a session, and only for the new connections (a connection reused from
+ * the session cache keeps its tuning).
+ * @param factory The factory (nullptr to use the session one) - it must outlive the transfer
+ * @return A return code described by the \a HDL_RetCode enumerate
+ */
+handle::HDL_RetCode
+handle::set_socket_factory(socket_factory* factory) noexcept
+{
+    socket_factory__ = factory;
+    return HDL_OK;
+}
+
+/**
+ * @brief set_tag - Tag the transfer, for the group operations of the sessions (\see mhandle::cancel_tag)
+ *
+ * @param tag The tag (empty for none)
+ * @return A return code described by the \a HDL_RetCode enumerate (HDL_BAD_FUNCTION if owned by a session)
+ */
+handle::HDL_RetCode
+handle::set_tag(std::string_view tag) noexcept
+{
+    if (nullptr != multi_handler__) return HDL_BAD_FUNCTION;
+
+    try
+    {
+        tag__ = tag;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return HDL_OUT_OF_MEM;
+    }
+    return HDL_OK;
+}
+
+/**
+ * @brief set_tag - Tag the transfer with an integer (its decimal representation)
+ *
+ * @param tag The tag
+ * @return A return code described by the \a HDL_RetCode enumerate (HDL_BAD_FUNCTION if owned by a session)
+ */
+handle::HDL_RetCode
+handle::set_tag(int64_t tag) noexcept
+{
+    char buf[24];
+    auto res{ std::to_chars(std::begin(buf), std::end(buf), tag) };
+
+    return set_tag(std::string_view{ buf, static_cast<size_t>(res.ptr - buf) });
+}
+
 /**
  * @brief retCode2Str - Gives a human readable string for each retcodes
  *
@@ -701,12 +1039,14 @@ handle::set_cb_done(const TCbDone& cb) noexcept
 std::string_view
 handle::retCode2Str(handle::HDL_RetCode rc) noexcept
 {
-    static const std::map<HDL_RetCode, std::string> _retcodeMap{ { HDL_MULTI_STOPPED, "multi-session stopped" },
+    static const std::map<HDL_RetCode, std::string> _retcodeMap{ { HDL_CANCELLED, "context cancelled" },
+                                                                 { HDL_MULTI_STOPPED, "multi-session stopped" },
                                                                  { HDL_OK, "ok" },
                                                                  { HDL_BAD_PARAM, "bad parameter" },
                                                                  { HDL_BAD_FUNCTION, "bad function call" },
                                                                  { HDL_OUT_OF_MEM, "out of memory" },
-                                                                 { HDL_INTERNAL_ERROR, "internal error" } };
+                                                                 { HDL_INTERNAL_ERROR, "internal error" },
+                                                                 { HDL_TIMEOUT, "deadline expired" } };
 
     return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
 }
@@ -0,0 +1,202 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/latency.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+
+#define LAT_LINEAR 64   // Values below are counted exactly (one bucket per microsecond)
+#define LAT_SUB_BITS 5  // Buckets per doubling of the values : 2^LAT_SUB_BITS
+#define LAT_MAX_MSB 35  // Most significant bit of the largest value counted (~19 hours) - beyond, values are clamped
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// SNAPSHOT
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief bucket_of - Get the bucket counting a value
+ *
+ * @param us The value (microseconds - negative values count as 0)
+ * @return The bucket
+ */
+size_t
+latency_snapshot::bucket_of(int64_t us) noexcept
+{
+    if (LAT_LINEAR > us) return static_cast<size_t>(std::max<int64_t>(us, 0));
+
+    const int msb{ 63 - __builtin_clzll(static_cast<uint64_t>(us)) };
+    if (LAT_MAX_MSB < msb) return BUCKETS - 1;
+
+    const auto shift{ msb - LAT_SUB_BITS };
+    const auto sub{ static_cast<size_t>(us >> shift) - (1U << LAT_SUB_BITS) };
+
+    return LAT_LINEAR + static_cast<size_t>(msb - LAT_SUB_BITS - 1) * (1U << LAT_SUB_BITS) + sub;
+}
+
+/**
+ * @brief bucket_high - Get the largest value counted by a bucket
+ *
+ * @param bucket The bucket
+ * @return The value (microseconds)
+ */
+int64_t
+latency_snapshot::bucket_high(size_t bucket) noexcept
+{
+    if (LAT_LINEAR > bucket) return static_cast<int64_t>(bucket);
+
+    const auto k{ bucket - LAT_LINEAR };
+    const auto shift{ static_cast<int>(k >> LAT_SUB_BITS) + 1 };
+    const auto top{ static_cast<int64_t>((1U << LAT_SUB_BITS) + (k & ((1U << LAT_SUB_BITS) - 1))) };
+
+    return ((top + 1) << shift) - 1;
+}
+
+/**
+ * @brief merge - Add the values of another snapshot (e.g. of another session)
+ *
+ * @param other The snapshot
+ */
+void
+latency_snapshot::merge(const latency_snapshot& other) noexcept
+{
+    if (0 == other.count) return;
+
+    for (size_t i{ 0 }; i < BUCKETS; ++i)
+        counts[i] += other.counts[i];
+
+    min = (0 == count) ? other.min : std::min(min, other.min);
+    max = std::max(max, other.max);
+    count += other.count;
+    sum += other.sum;
+}
+
+/**
+ * @brief mean - Get the mean of the values
+ *
+ * @return The mean (microseconds) - 0 when empty
+ */
+double
+latency_snapshot::mean(void) const noexcept
+{
+    return (0 == count) ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+}
+
+/**
+ * @brief percentile - Get the value below which a percentage of the values fall
+ *
+ * The value is the largest one of its bucket (within ~3%), bounded by the extrema.
+ * @param p The percentage (0 to 100)
+ * @return The value (microseconds) - negative when empty
+ */
+int64_t
+latency_snapshot::percentile(double p) const noexcept
+{
+    if (0 == count) return -1;
+
+    const auto rank{ std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * static_cast<double>(count)))) };
+
+    uint64_t seen{ 0 };
+    for (size_t i{ 0 }; i < BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen >= rank) return std::clamp(bucket_high(i), min, max);
+    }
+    return max;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// HISTOGRAM
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief record - Count a value (any thread, lock-free)
+ *
+ * @param us The value (microseconds)
+ */
+void
+latency_histogram::record(int64_t us) noexcept
+{
+    us = std::max<int64_t>(us, 0);
+
+    counts__[latency_snapshot::bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+    sum__.fetch_add(us, std::memory_order_relaxed);
+
+    auto lo{ min__.load(std::memory_order_relaxed) };
+    while ((0 > lo || us < lo) && !min__.compare_exchange_weak(lo, us, std::memory_order_relaxed))
+        ;
+
+    auto hi{ max__.load(std::memory_order_relaxed) };
+    while (us > hi && !max__.compare_exchange_weak(hi, us, std::memory_order_relaxed))
+        ;
+}
+
+/**
+ * @brief snapshot - Copy the counters (any thread, lock-free)
+ *
+ * Values recorded meanwhile may be partially accounted for (e.g. in the buckets, not in the sum yet) : the count is
+ * the sum of the buckets copied.
+ * @param s The snapshot
+ */
+void
+latency_histogram::snapshot(latency_snapshot& s) const noexcept
+{
+    s.count = 0;
+    for (size_t i{ 0 }; i < latency_snapshot::BUCKETS; ++i)
+    {
+        s.counts[i] = counts__[i].load(std::memory_order_relaxed);
+        s.count += s.counts[i];
+    }
+
+    s.sum = sum__.load(std::memory_order_relaxed);
+    s.min = min__.load(std::memory_order_relaxed);
+    s.max = max__.load(std::memory_order_relaxed);
+    if (0 == s.count) s.min = s.max = -1;
+}
+
+/**
+ * @brief reset - Forget the values counted so far
+ *
+ * @warning Values recorded meanwhile may be partially forgotten
+ */
+void
+latency_histogram::reset(void) noexcept
+{
+    for (auto& c : counts__)
+        c.store(0, std::memory_order_relaxed);
+
+    sum__.store(0, std::memory_order_relaxed);
+    min__.store(-1, std::memory_order_relaxed);
+    max__.store(-1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief phase2Str - Gives a human readable string for each phase
+ *
+ * @param phase The phase
+ * @return A human-readable representation of the phase
+ */
+std::string_view
+latency_histogram::phase2Str(latency_histogram::LAT_Phase phase) noexcept
+{
+    static const std::map<LAT_Phase, std::string> _phaseMap{ { LAT_QUEUE_WAIT, "queue wait" },
+                                                             { LAT_NAMELOOKUP, "name lookup" },
+                                                             { LAT_CONNECT, "connect" },
+                                                             { LAT_APPCONNECT, "TLS handshake" },
+                                                             { LAT_PRETRANSFER, "pre-transfer" },
+                                                             { LAT_STARTTRANSFER, "first byte" },
+                                                             { LAT_TOTAL, "total" } };
+
+    const auto it{ _phaseMap.find(phase) };
+    return (std::end(_phaseMap) == it) ? std::string_view{ "unknown" } : std::string_view{ it->second };
+}
+
+} // namespace asyncurl
@@ -4,25 +4,131 @@
  * Proprietary and confidential
  */
 
+#include <asyncurl/context.hpp>
+#include <asyncurl/coro.hpp>
+#include <asyncurl/endpoint_set.hpp>
 #include <asyncurl/handle.hpp>
 #include <asyncurl/mhandle.hpp>
+#include <asyncurl/socket_factory.hpp>
 
 #include <curl/curl.h>
 #include <miniLoop/Loop.h>
 
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <map>
 #include <stdexcept>
+#include <utility>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace loop;
 
 #define MHDL_STOPPED -1
 
+#define RAMP_TICK_MS 10  // Period of the new connections pacing
+#define RAMP_BURST_MS 50 // Maximum burst of new connections (in time worth of the current rate)
+
+#define FD_HIGH_RATIO 0.9           // Above this ratio of the descriptors budget, the connections cache is shrunk
+#define FD_LOW_RATIO 0.75           // Below this ratio of the descriptors budget, the connections cache is restored
+#define FD_RECOVERY_MS 5000         // Time the budget stays lowered after an exhaustion of the process descriptors
+#define FD_MAX_SOFT_LIMIT (1 << 20) // Maximum soft limit of the process descriptors set by the session
+
+#define STRG_EWMA_WEIGHT 0.5 // Weight of the last sample in the smoothed throughput of a transfer
+
+#define BW_SATURATION_RATIO 0.8 // A transfer using more than this ratio of its share is limited by the budget
+#define BW_GROWTH_RATIO 1.5     // Headroom granted to the transfers that are not limited by the budget
+#define BW_DECAY_RATIO 0.5      // Maximum decrease of the share of a transfer between two periods
+#define BW_MIN_RATE 4096.0      // Minimum share granted to a transfer (bytes/s)
+
 namespace asyncurl
 {
+/**
+ * @brief gather_state holds a running scatter-gather (\see mhandle::gather)
+ */
+struct gather_state
+{
+    uptr<context>          ctx{}; /*!< Context of the transfers (carries the deadline) */
+    size_t                 total{ 0 };
+    size_t                 quorum{ 0 };
+    mhandle::gather_result result{};
+    mhandle::TCbGather     cb{};
+    bool                   adding{ false }; /*!< The transfers are being added : no outcome yet */
+    bool                   fired{ false };  /*!< The outcome is known (the state is destroyed by the gc timer) */
+};
+
+/**
+ * @brief tag_group holds the transfers of a session sharing a tag (\see mhandle::cancel_tag)
+ */
+struct tag_group
+{
+    std::string_view key{};           /*!< The tag (the key of the group in the session) */
+    handle*          head{ nullptr }; /*!< First transfer linked */
+    handle*          tail{ nullptr }; /*!< Last transfer linked */
+    size_t           count{ 0 };
+    int              visiting{ 0 }; /*!< Group operations in progress : the group is kept, even empty */
+};
+
 //---------------------------------------------------------------------------------------------------------------------
 // STATIC FUNCTIONS
 //---------------------------------------------------------------------------------------------------------------------
 
+/**
+ * @brief origin_of - Get the origin ("host:port", lower case) targetted by a transfer
+ *
+ * @param h The transfer
+ * @param key The origin
+ * @return true if the URL of the transfer could be parsed
+ */
+bool
+mhandle::origin_of(const handle& h, std::string& key) noexcept
+{
+    auto url{ h.strings__.find(CURLOPT_URL) };
+    if (std::end(h.strings__) == url) return false;
+
+    CURLU* u{ curl_url() };
+    if (nullptr == u) return false;
+
+    bool  ret{ false };
+    char* host{ nullptr };
+    char* port{ nullptr };
+    if (CURLUE_OK == curl_url_set(u, CURLUPART_URL, url->second.c_str(), CURLU_GUESS_SCHEME) &&
+        CURLUE_OK == curl_url_get(u, CURLUPART_HOST, &host, 0) &&
+        CURLUE_OK == curl_url_get(u, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT))
+    {
+        try
+        {
+            key = host;
+            std::transform(std::begin(key), std::end(key), std::begin(key), [](unsigned char c) {
+                return static_cast<char>(std::tolower(c));
+            });
+            key.append(":").append(port);
+            ret = true;
+        }
+        catch (const std::bad_alloc&)
+        {
+        }
+    }
+
+    curl_free(host);
+    curl_free(port);
+    curl_url_cleanup(u);
+
+    return ret;
+}
+
 /**
  * @brief timer_callback - Callback called by curl when it is interested in setting a timer inside libevent.
  *
@@ -55,42 +161,62 @@ mhandle::timer_callback(void* /*multi_handle*/, long timeout_ms, void* userp)
  * @return A retcode indicating libcurl how its request was treated.
  */
 int
-mhandle::socket_callback(void* easy, size_t s, int what, void* clientp, void* socketp)
+mhandle::socket_callback(void* /*easy*/, size_t s, int what, void* clientp, void* socketp)
 {
     mhandle*  This{ static_cast<mhandle*>(clientp) };
     Loop::IO* io{ static_cast<Loop::IO*>(socketp) };
-    CURL*     hdl{ static_cast<CURL*>(easy) };
 
     if (CURL_POLL_REMOVE == what)
     {
-        if (nullptr != io) io->setRequestedEvents(0);
+        if (nullptr != io)
+        {
+            io->setRequestedEvents(0);
+            curl_multi_assign(This->curl_multi__, s, nullptr);
+            --This->polled_sockets__;
+            This->busy_events__.erase(static_cast<long>(s));
+            This->ev_deferred__.erase(static_cast<long>(s)); // The descriptor may be reused by another socket
+
+            // The IO may be running this very callback : it is destroyed later, out of its own callback
+            if (auto it{ This->ios__.find(static_cast<long>(s)) }; std::end(This->ios__) != it)
+            {
+                This->ios_released__[it->first] = std::move(it->second);
+                This->ios__.erase(it);
+                This->gc_timer__->set(0);
+            }
+        }
         return CURLM_OK;
     }
 
     if (nullptr == io)
     {
-        if (std::end(This->ios__) == This->ios__.find(hdl))
-            This->ios__[hdl] = std::make_unique<Loop::IO>(s, This->loop__);
+        auto& slot{ This->ios__[static_cast<long>(s)] };
+        if (auto it{ This->ios_released__.find(static_cast<long>(s)) }; std::end(This->ios_released__) != it)
+        {
+            // Same descriptor as a socket recently removed : revive its IO rather than registering the fd twice
+            slot = std::move(it->second);
+            This->ios_released__.erase(it);
+        }
+        if (nullptr == slot) slot = std::make_unique<Loop::IO>(s, This->loop__);
+
+        io = slot.get();
 
-        io = This->ios__[hdl].get();
         io->onEvent([This, io](int evt) {
             int evt_bitmask{ 0 };
-            int rhandles{ This->running_handles__ };
 
             if (evt & Loop::IO::READ) evt_bitmask |= CURL_CSELECT_IN;
             if (evt & Loop::IO::WRITE) evt_bitmask |= CURL_CSELECT_OUT;
 
-            if (auto ret =
-                  curl_multi_socket_action(This->curl_multi__, io->getFd(), evt_bitmask, &This->running_handles__);
-                CURLM_OK != ret)
+            // The budget of the iteration is exhausted : the event is handled on the next one
+            if (!This->ev_charge())
             {
-                This->handle_stop(ret);
+                This->ev_defer(io->getFd(), evt_bitmask);
                 return;
             }
-            if (This->running_handles__ != rhandles) This->handle_msgs();
+            This->socket_event(io->getFd(), evt_bitmask);
         });
 
         curl_multi_assign(This->curl_multi__, s, io);
+        ++This->polled_sockets__;
     }
 
     short int evts{ 0 };
@@ -105,9 +231,113 @@ mhandle::socket_callback(void* easy, size_t s, int what, void* clientp, void* so
     io->setFd(s);
     io->setRequestedEvents(evts);
 
+    try
+    {
+        This->busy_events__[static_cast<long>(s)] =
+          static_cast<short>(((evts & Loop::IO::READ) ? POLLIN : 0) | ((evts & Loop::IO::WRITE) ? POLLOUT : 0));
+    }
+    catch (const std::bad_alloc&)
+    {
+        // Not busy-polled : the loop still watches the socket
+    }
+
     return CURLM_OK;
 }
 
+/**
+ * @brief opensocket_callback - Callback called by curl when it needs a socket for a new connection
+ *
+ * @param clientp A private callback pointer (the transfer)
+ * @param purpose The purpose of the socket (curlsocktype)
+ * @param address The address to connect to (curl_sockaddr)
+ * @return The new socket or CURL_SOCKET_BAD on failure
+ */
+int
+mhandle::opensocket_callback(void* clientp, int /*purpose*/, void* address)
+{
+    handle*        h{ static_cast<handle*>(clientp) };
+    mhandle*       This{ h->multi_handler__ };
+    curl_sockaddr* addr{ static_cast<curl_sockaddr*>(address) };
+
+    auto factory{ (nullptr != h->socket_factory__) ? h->socket_factory__ : This->socket_factory__ };
+
+    curl_socket_t fd{ (nullptr != factory) ? factory->open(addr->family, addr->socktype, addr->protocol)
+                                           : ::socket(addr->family, addr->socktype, addr->protocol) };
+    if (CURL_SOCKET_BAD != fd && 0 != This->source_bind(fd, addr->family))
+    {
+        ::close(fd);
+        return CURL_SOCKET_BAD;
+    }
+
+    if (CURL_SOCKET_BAD != fd)
+    {
+        ++This->open_sockets__;
+
+        // Getting close to the budget : shrink the connections cache (not allowed from within a curl callback)
+        if (0 != This->fd__.limit && !This->fd__.shrunk &&
+            This->held_fds() >= static_cast<long>(FD_HIGH_RATIO * static_cast<double>(This->fd__.effective)))
+            This->admission_arm(0);
+    }
+    else if (0 != This->fd__.limit && (EMFILE == errno || ENFILE == errno))
+    {
+        // The process ran out of descriptors before the session reached its budget : lower it for a while
+        This->fd__.effective    = std::max(1L, std::min(This->fd__.effective, This->held_fds()));
+        This->fd__.exhausted_us = monotonic_us();
+        This->admission_arm(0);
+    }
+
+    return fd;
+}
+
+/**
+ * @brief closesocket_callback - Callback called by curl when it closes a socket
+ *
+ * @param clientp A private callback pointer (the session)
+ * @param fd The socket to close
+ * @return 0 on success
+ *
+ * @note Connections remember the callback they were created with, so this is called as long as the session lives.
+ */
+int
+mhandle::closesocket_callback(void* clientp, int fd)
+{
+    mhandle* This{ static_cast<mhandle*>(clientp) };
+
+    if (0 < This->open_sockets__) --This->open_sockets__;
+    This->source_unbind(fd);
+
+    // Back to a cold start : the next connections will have to ramp-up again
+    if (0 == This->open_sockets__ && nullptr == This->queue_head__) This->ramp__.active = false;
+
+    // A descriptor is released : transfers waiting for the descriptors budget may be admitted
+    if (0 != This->fd__.limit && (nullptr != This->queue_head__ || This->fd__.shrunk)) This->admission_arm(0);
+
+    return ::close(fd);
+}
+
+/**
+ * @brief sockopt_callback - Callback called by curl once it has set its own options on a new socket
+ *
+ * @param clientp A private callback pointer (the transfer)
+ * @param fd The socket
+ * @param purpose The purpose of the socket (curlsocktype)
+ * @return CURL_SOCKOPT_OK on success, CURL_SOCKOPT_ERROR to abort the connection
+ */
+int
+mhandle::sockopt_callback(void* clientp, int fd, int /*purpose*/)
+{
+    handle* h{ static_cast<handle*>(clientp) };
+
+    // Best effort : raising SO_BUSY_POLL above net.core.busy_read requires CAP_NET_ADMIN
+    if (const int busy{ h->multi_handler__->busy__.socket_us }; 0 < busy)
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy, sizeof(busy));
+
+    auto factory{ (nullptr != h->socket_factory__) ? h->socket_factory__ : h->multi_handler__->socket_factory__ };
+    if (nullptr == factory) return CURL_SOCKOPT_OK;
+
+    return (0 == factory->configure(fd)) ? CURL_SOCKOPT_OK : CURL_SOCKOPT_ERROR;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 // CONSTRUCTORS/DESTRUCTOR
 //---------------------------------------------------------------------------------------------------------------------
@@ -138,7 +368,52 @@ mhandle::mhandle(loop::Loop& loop)
         }
 
         if (this->running_handles__ != rhandles) this->handle_msgs();
+        if (0 < this->busy__.spin_us) this->busy_arm();
+    });
+    bw_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    bw_timer__->onTimeout([this]() {
+        this->bw__.armed = false;
+        this->bw_tick();
+    });
+
+    gc_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    gc_timer__->onTimeout([this]() {
+        this->ios_released__.clear();
+        for (auto it{ std::begin(this->gathers__) }; std::end(this->gathers__) != it;)
+            it = it->second->fired ? this->gathers__.erase(it) : std::next(it);
+    });
+
+    ctx_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    ctx_timer__->onTimeout([this]() {
+        this->ctx_due_us__ = 0;
+        this->ctx_tick();
+    });
+
+    strg_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    strg_timer__->onTimeout([this]() {
+        this->strg__.armed = false;
+        this->strg_tick();
+    });
+
+    ev_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    ev_timer__->onTimeout([this]() { this->ev_tick(); });
+
+    busy_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    busy_timer__->onTimeout([this]() { this->busy_spin(); });
+
+    admission_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    admission_timer__->onTimeout([this]() {
+        this->admission_due_us__ = 0;
+        this->admit_pending();
     });
+
+    completions_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    completions_timer__->onTimeout([this]() { this->completions_flush(); });
+    completions_spare__.reserve(1);
+
+    progress_timer__ = std::make_unique<Loop::Timeout>(loop__);
+    progress_timer__->onTimeout([this]() { this->progress_tick(); });
+
     curl_multi_setopt(curl_multi__, CURLMOPT_TIMERDATA, this);
     curl_multi_setopt(curl_multi__, CURLMOPT_TIMERFUNCTION, timer_callback);
 
@@ -167,6 +442,7 @@ mhandle::~mhandle() noexcept
  * By doing so, you give control of the transfer over the multi session.
  * The multi session controls a cache of connections that are shared between its transfers, so you can safely remove a
  * handler without losing connections.
+ * The transfer may wait in the session admission queue before actually starting (\see set_connection_ramp).
  * @param h The handle to add
  * @return A return code described by the \a MHDL_RetCode enumerate
  *
@@ -178,28 +454,57 @@ mhandle::add_handle(handle& h) noexcept
     if (MHDL_STOPPED == running_handles__) return MHDL_INTERNAL_ERROR;
     if (this == h.multi_handler__) return MHDL_ADD_ALREADY;
     if (nullptr != h.multi_handler__) return MHDL_ADD_OWNED;
-
-    CURL* raw{ static_cast<CURL*>(h.raw()) };
-    if (auto ret{ curl_multi_add_handle(curl_multi__, raw) }; CURLM_OK == ret)
+    if (!h.cb_done__ && cb_completions__)
     {
-        h.multi_handler__ = this;
-        handles__[raw]    = &h;
+        if (auto ret{ completions_reserve() }; MHDL_OK != ret) return ret;
+    }
+    if (auto ret{ tag_link(h) }; MHDL_OK != ret) return ret;
 
-        // Start everything if needed (first handler added)
-        if (0 == running_handles__)
+    h.progress__.start(progress::PRG_QUEUED);
+    h.added_us__ = monotonic_us();
+    progress_arm();
+
+    // Transfers are admitted in order : a transfer can only bypass the queue if it is empty
+    if (nullptr == queue_head__ && admission_granted())
+    {
+        auto ret{ admit(h) };
+        if (MHDL_OK != ret)
         {
-            if (auto ret = curl_multi_socket_action(curl_multi__, CURL_SOCKET_TIMEOUT, 0, &running_handles__);
-                CURLM_OK != ret)
-            {
-                this->handle_stop(ret);
-                return MHDL_INTERNAL_ERROR;
-            }
-            this->handle_msgs();
+            tag_unlink(h);
+            h.progress__.set_state(progress::PRG_IDLE);
         }
-        return MHDL_OK;
+        return ret;
     }
 
-    return MHDL_INTERNAL_ERROR;
+    h.multi_handler__ = this;
+    enqueue(h);
+    ramp_arm();
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief add_handle - Adds an handle (a transfer) to the multi session, within a context
+ *
+ * The transfer is completed early if the context is cancelled or expires (\see context).
+ * @param h The handle to add
+ * @param ctx The context of the transfer (it must belong to this session)
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::add_handle(handle& h, context& ctx) noexcept
+{
+    if (this != &ctx.session__) return MHDL_BAD_PARAM;
+    if (nullptr != h.multi_handler__) return add_handle(h); // Let it report the ownership
+    if (ctx.done()) return MHDL_CONTEXT_DONE;
+
+    // Attach first : the transfer may complete right away
+    ctx.attach(h);
+
+    auto ret{ add_handle(h) };
+    if (MHDL_OK != ret && &ctx == h.ctx__) ctx.detach(h);
+
+    return ret;
 }
 
 /**
@@ -216,118 +521,521 @@ mhandle::remove_handle(handle& h) noexcept
     if (nullptr == h.multi_handler__) return MHDL_REMOVE_ALREADY;
     if (this != h.multi_handler__) return MHDL_REMOVE_OWNED;
 
-    CURL* raw{ static_cast<CURL*>(h.raw()) };
+    tag_unlink(h);
+    h.progress__.set_state(progress::PRG_IDLE);
+    if (!h.strg_reissue__ && nullptr != h.strg_twin__) strg_drop(h);
+    if (nullptr != h.ctx__) h.ctx__->detach(h);
+
     h.multi_handler__ = nullptr;
+    if (h.queued__)
+    {
+        dequeue(h);
+        return MHDL_OK;
+    }
+
+    CURL* raw{ static_cast<CURL*>(h.raw()) };
+    unroute(h, false, CURLE_OK);
+    bw_release(h);
 
     auto ret = (CURLM_OK == curl_multi_remove_handle(curl_multi__, raw)) ? MHDL_OK : MHDL_INTERNAL_ERROR;
+    sockets_hook(h, false);
 
     if (std::end(handles__) != handles__.find(raw)) handles__.erase(raw);
-    if (std::end(ios__) != ios__.find(raw)) ios__.erase(raw);
 
     return ret;
 }
 
-/**
- * @brief raw get the raw curl multi-handle (CURLM::handle)
- *
- * @warning You should not be using this, unless you absolutely need to use curl features that are not provided by
- * the \a asyncurl library.
- * @return then raw multi-handle
- */
-void*
-mhandle::raw(void) noexcept
-{
-    return curl_multi__;
-}
-
 //---------------------------------------------------------------------------------------------------------------------
-// OPTIONS
-// Change specific multi handle options - allowing to control the way it will behave.
-// \see https://curl.se/libcurl/c/curl_multi_setopt.html
+// ADMISSION
+// Transfers wait in an admission queue until the session lets them start.
 //---------------------------------------------------------------------------------------------------------------------
 
 /**
- * @brief set_opt_long - Set an information element (\see CURLMOPT type) of type long
+ * @brief admit - Hand a transfer over to curl
  *
- * @param id The information's id to set
- * @param val The value to set
+ * @param h The transfer
  * @return A return code described by the \a MHDL_RetCode enumerate
- *
- * @see https://curl.se/libcurl/c/curl_multi_setopt.html
  */
 mhandle::MHDL_RetCode
-mhandle::set_opt_long(int id, long val) noexcept
+mhandle::admit(handle& h) noexcept
 {
-    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), val)) ? MHDL_OK
-                                                                                            : MHDL_INTERNAL_ERROR;
+    CURL* raw{ static_cast<CURL*>(h.raw()) };
+
+    if (!bw_reserve(std::size(handles__) + 1)) return MHDL_OUT_OF_MEM;
+
+    route(h);
+    sockets_hook(h, true);
+    if (auto ret{ curl_multi_add_handle(curl_multi__, raw) }; CURLM_OK == ret)
+    {
+        h.multi_handler__ = this;
+        handles__[raw]    = &h;
+        bw_admit(h);
+        h.progress__.set_state(progress::PRG_RUNNING);
+
+        if (0 != h.added_us__) latency__[latency_histogram::LAT_QUEUE_WAIT].record(monotonic_us() - h.added_us__);
+        h.added_us__ = 0;
+
+        // Paused while queued (\see mhandle::pause_tag)
+        if (0 != (h.flags__ & CURLPAUSE_ALL)) curl_easy_pause(raw, (h.flags__ | h.bw_paused__) & CURLPAUSE_ALL);
+
+        h.rx_bytes__      = 0;
+        h.strg_start_us__ = 0;
+        h.strg_origin__.clear();
+        h.strg_rate__     = -1;
+        h.strg_reissued__ = false;
+        h.strg_paused__   = 0;
+        strg_arm();
+
+        // Start everything if needed (first handler added)
+        if (0 == running_handles__)
+        {
+            if (auto ret = curl_multi_socket_action(curl_multi__, CURL_SOCKET_TIMEOUT, 0, &running_handles__);
+                CURLM_OK != ret)
+            {
+                this->handle_stop(ret);
+                return MHDL_INTERNAL_ERROR;
+            }
+            this->handle_msgs();
+        }
+        return MHDL_OK;
+    }
+
+    sockets_hook(h, false);
+    unroute(h, false, CURLE_OK);
+    h.multi_handler__ = nullptr;
+
+    return MHDL_INTERNAL_ERROR;
 }
 
 /**
- * @brief set_opt_ptr - Set an information element (\see CURLMOPT type) of type ptr
- *
- * @param id The information's id to set
- * @param val The value to set
- * @return A return code described by the \a MHDL_RetCode enumerate
+ * @brief admit_pending - Admit the queued transfers, as long as the session allows it
  *
- * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ * A queued transfer that can not be handed over to curl is completed with CURLE_FAILED_INIT.
  */
-mhandle::MHDL_RetCode
-mhandle::set_opt_ptr(int id, const void* val) noexcept
+void
+mhandle::admit_pending(void) noexcept
 {
-    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), val)) ? MHDL_OK
-                                                                                            : MHDL_INTERNAL_ERROR;
+    fd_pressure();
+
+    while (nullptr != queue_head__ && MHDL_STOPPED != running_handles__ && admission_granted())
+    {
+        handle* h{ queue_head__ };
+
+        dequeue(*h);
+        h->multi_handler__ = nullptr;
+        if (MHDL_OK == admit(*h)) continue;
+
+        tag_unlink(*h);
+        if (nullptr != h->ctx__) h->ctx__->detach(*h);
+        notify(*h, CURLE_FAILED_INIT);
+    }
+
+    ramp_arm();
 }
 
 /**
- * @brief set_opt_bool - Set an information element (\see CURLMOPT type) of type bool
- *
- * @param id The information's id to set
- * @param val The value to set
- * @return A return code described by the \a MHDL_RetCode enumerate
+ * @brief admission_granted - Check whether a new transfer can be handed over to curl right now
  *
- * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ * @return true if the transfer can be admitted
  */
-mhandle::MHDL_RetCode
-mhandle::set_opt_bool(int id, bool val) noexcept
+bool
+mhandle::admission_granted(void) noexcept
 {
-    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), static_cast<long>(val ? 1 : 0)))
-             ? MHDL_OK
-             : MHDL_INTERNAL_ERROR;
+    // More sockets than transfers : an idle connection can (probably) be reused, which is not throttled
+    if (static_cast<long>(std::size(handles__)) < open_sockets__) return true;
+
+    // Sockets are opened lazily : every running transfer accounts for (at least) one descriptor
+    const auto held{ std::max(held_fds(), static_cast<long>(std::size(handles__))) };
+    if (0 != fd__.limit && held >= fd__.effective) return false;
+    if (0 == ramp__.initial) return true;
+
+    ramp_refill();
+    if (ramp__.tokens < 1) return false;
+
+    ramp__.tokens -= 1;
+    return true;
 }
 
 /**
- * @brief set_opt_offset - Set an information element of type offset
- *
- * @param id The information's id to set
- * @param val The value to set
- * @return A return code described by the \a MHDL_RetCode enumerate
+ * @brief enqueue - Append a transfer to the admission queue
  *
- * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ * @param h The transfer
  */
-mhandle::MHDL_RetCode
-mhandle::set_opt_offset(int id, long val) noexcept
+void
+mhandle::enqueue(handle& h) noexcept
 {
-    if (CURLOPTTYPE_OFF_T != (id / 10000) * 10000) return MHDL_BAD_PARAM;
-    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), val)) ? MHDL_OK
-                                                                                            : MHDL_INTERNAL_ERROR;
+    h.queued__     = true;
+    h.queue_next__ = nullptr;
+    h.queue_prev__ = queue_tail__;
+
+    if (nullptr != queue_tail__)
+        queue_tail__->queue_next__ = &h;
+    else
+        queue_head__ = &h;
+
+    queue_tail__ = &h;
+    ++queued__;
 }
 
 /**
- * @brief set_opt - Set an option modifying the behaviour of the session
+ * @brief dequeue - Remove a transfer from the admission queue
  *
- * @param id The identifier of the option to set
- * @param val The value to set
- * @return A return code described by the \a MHDL_RetCode enumerate
+ * @param h The transfer
+ */
+void
+mhandle::dequeue(handle& h) noexcept
+{
+    if (!h.queued__) return;
+
+    (nullptr != h.queue_prev__ ? h.queue_prev__->queue_next__ : queue_head__) = h.queue_next__;
+    (nullptr != h.queue_next__ ? h.queue_next__->queue_prev__ : queue_tail__) = h.queue_prev__;
+
+    h.queued__     = false;
+    h.queue_prev__ = nullptr;
+    h.queue_next__ = nullptr;
+    --queued__;
+}
+
+/**
+ * @brief sockets_hook - Install (or uninstall) the session socket callbacks on a transfer
  *
- * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ * @param h The transfer
+ * @param install Whether to install or uninstall the callbacks
  */
-mhandle::MHDL_RetCode
-mhandle::set_opt(int id, std::any val) noexcept
+void
+mhandle::sockets_hook(handle& h, bool install) noexcept
 {
-    MHDL_RetCode ret{ MHDL_BAD_PARAM };
-    const auto   curType{ (id / 10000) * 10000 };
+    CURL* raw{ static_cast<CURL*>(h.raw()) };
 
-    if (!val.has_value()) return ret;
+    curl_easy_setopt(raw,
+                     CURLOPT_OPENSOCKETFUNCTION,
+                     install ? reinterpret_cast<curl_opensocket_callback>(opensocket_callback) : nullptr);
+    curl_easy_setopt(raw, CURLOPT_OPENSOCKETDATA, install ? &h : nullptr);
+    curl_easy_setopt(raw,
+                     CURLOPT_SOCKOPTFUNCTION,
+                     install ? reinterpret_cast<curl_sockopt_callback>(sockopt_callback) : nullptr);
+    curl_easy_setopt(raw, CURLOPT_SOCKOPTDATA, install ? &h : nullptr);
+
+    // The connections outlive the transfers and keep these : they refer to the session
+    curl_easy_setopt(raw,
+                     CURLOPT_CLOSESOCKETFUNCTION,
+                     install ? reinterpret_cast<curl_closesocket_callback>(closesocket_callback) : nullptr);
+    curl_easy_setopt(raw, CURLOPT_CLOSESOCKETDATA, install ? this : nullptr);
+}
+
+/**
+ * @brief admission_arm - Arm the admission timer (the queued transfers are admitted when it expires)
+ *
+ * The timer is shared by the admission policies : the earliest request wins.
+ * @param delay_ms The delay before the admission (milliseconds)
+ */
+void
+mhandle::admission_arm(long delay_ms) noexcept
+{
+    if (MHDL_STOPPED == running_handles__) return;
+
+    const auto due_us{ monotonic_us() + static_cast<int64_t>(delay_ms) * 1000 };
+    if (0 != admission_due_us__ && admission_due_us__ <= due_us) return;
+
+    admission_due_us__ = due_us;
+    admission_timer__->set(delay_ms);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// CONNECTIONS RAMP-UP
+// New connections are paced with a slow-start policy, so that a cold session does not open thousands of connections
+// (and TLS handshakes) at once.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_connection_ramp - Set the slow-start policy of the new connections
+ *
+ * When the session is cold (no open connection), the transfers needing a new connection are admitted at the given
+ * initial rate. This rate doubles every doubling_ms until it reaches the maximum rate.
+ * Transfers that can reuse an existing connection are not throttled.
+ * @param initial_per_sec The initial rate of new connections (per second) - 0 to disable the pacing
+ * @param max_per_sec The maximum rate of new connections (per second)
+ * @param doubling_ms The time needed for the rate to double (milliseconds)
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::set_connection_ramp(long initial_per_sec, long max_per_sec, long doubling_ms) noexcept
+{
+    if (initial_per_sec < 0 || doubling_ms <= 0) return MHDL_BAD_PARAM;
+    if (0 != initial_per_sec && max_per_sec < initial_per_sec) return MHDL_BAD_PARAM;
+
+    ramp__.initial     = initial_per_sec;
+    ramp__.max         = max_per_sec;
+    ramp__.doubling_ms = doubling_ms;
+
+    admit_pending();
+    return MHDL_OK;
+}
+
+/**
+ * @brief ramp_refill - Refill the new connections tokens according to the current rate
+ */
+void
+mhandle::ramp_refill(void) noexcept
+{
+    const auto now{ monotonic_us() };
+
+    if (!ramp__.active)
+    {
+        ramp__.active   = true;
+        ramp__.start_us = now;
+        ramp__.last_us  = now;
+        ramp__.tokens   = 1; // The first connection is never delayed
+        return;
+    }
+
+    const auto elapsed_ms{ static_cast<double>(now - ramp__.start_us) / 1e3 };
+    const auto doublings{ elapsed_ms / static_cast<double>(ramp__.doubling_ms) };
+    const auto rate{ std::min(static_cast<double>(ramp__.initial) * std::exp2(doublings),
+                              static_cast<double>(ramp__.max)) };
+
+    ramp__.tokens  = std::min(ramp__.tokens + rate * static_cast<double>(now - ramp__.last_us) / 1e6,
+                             std::max(1.0, rate * RAMP_BURST_MS / 1e3));
+    ramp__.last_us = now;
+}
+
+/**
+ * @brief ramp_arm - Arm the pacing timer if transfers are waiting for new connections tokens
+ */
+void
+mhandle::ramp_arm(void) noexcept
+{
+    if (nullptr != queue_head__ && 0 != ramp__.initial) admission_arm(RAMP_TICK_MS);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// LOAD BALANCING
+// Transfers targetting a logical host registered as an endpoint set are routed to one of its endpoints
+// \see asyncurl::endpoint_set
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief add_endpoint_set - Register an endpoint set in the session
+ *
+ * Every transfer added afterwards whose URL targets the logical host of the set is routed to one of its endpoints.
+ * @param set The endpoint set to register
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @warning Only one endpoint set can be registered per logical host.
+ */
+mhandle::MHDL_RetCode
+mhandle::add_endpoint_set(endpoint_set& set) noexcept
+{
+    if (this == set.multi_handler__) return MHDL_ADD_ALREADY;
+    if (nullptr != set.multi_handler__) return MHDL_ADD_OWNED;
+
+    auto [it, inserted] = endpoint_sets__.try_emplace(set.host() + ":" + std::to_string(set.port()), &set);
+    if (!inserted) return MHDL_BAD_PARAM;
+
+    set.multi_handler__ = this;
+    return MHDL_OK;
+}
+
+/**
+ * @brief remove_endpoint_set - Unregister an endpoint set from the session
+ *
+ * The transfers already routed through the set keep their endpoint, but they are no longer accounted by the set. Their
+ * routing is left untouched (curl does not support changing the options of a running transfer) : the CONNECT_TO list
+ * of the user is restored once they leave the session.
+ * @param set The endpoint set to unregister
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::remove_endpoint_set(endpoint_set& set) noexcept
+{
+    if (nullptr == set.multi_handler__) return MHDL_REMOVE_ALREADY;
+    if (this != set.multi_handler__) return MHDL_REMOVE_OWNED;
+
+    for (auto& [raw, h] : handles__)
+    {
+        if (&set != h->lb_set__) continue;
+
+        set.release(h->lb_endpoint__, false, false, 0, 0);
+        h->lb_set__      = nullptr;
+        h->lb_endpoint__ = -1;
+    }
+
+    endpoint_sets__.erase(set.host() + ":" + std::to_string(set.port()));
+    set.multi_handler__ = nullptr;
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief route - Route a transfer through the endpoint set of its logical host (if any)
+ *
+ * @param h The transfer about to be added
+ */
+void
+mhandle::route(handle& h) noexcept
+{
+    if (std::empty(endpoint_sets__)) return;
+
+    std::string key;
+    if (!origin_of(h, key)) return;
+
+    auto it{ endpoint_sets__.find(key) };
+    if (std::end(endpoint_sets__) == it) return;
+
+    endpoint_set* set{ it->second };
+    if (auto idx{ set->pick(monotonic_us()) }; -1 != idx)
+    {
+        if (handle::HDL_OK == h.route_to(set->endpoints__[idx].connect_to))
+        {
+            h.lb_set__      = set;
+            h.lb_endpoint__ = idx;
+        }
+        else
+        {
+            set->release(idx, false, false, 0, 0);
+            h.unroute();
+        }
+    }
+}
+
+/**
+ * @brief unroute - Release the endpoint a transfer was routed to (if any), and restore its routing
+ *
+ * @param h The transfer
+ * @param completed Whether the transfer went to completion (its outcome is then accounted by the endpoint set)
+ * @param result The result of the transfer (CURLcode) if it completed
+ */
+void
+mhandle::unroute(handle& h, bool completed, int result) noexcept
+{
+    if (nullptr == h.lb_set__)
+    {
+        // Its endpoint set was removed meanwhile (\see mhandle::remove_endpoint_set)
+        if (h.routed()) h.unroute();
+        return;
+    }
+
+    bool       failed{ CURLE_OK != result };
+    curl_off_t total_us{ 0 };
+
+    if (completed)
+    {
+        long code{ 0 };
+        if (!failed && handle::HDL_OK == h.get_info_long(CURLINFO_RESPONSE_CODE, code) && 500 <= code) failed = true;
+        curl_easy_getinfo(static_cast<CURL*>(h.raw()), CURLINFO_TOTAL_TIME_T, &total_us);
+    }
+
+    h.lb_set__->release(h.lb_endpoint__, completed, failed, total_us, monotonic_us());
+    h.unroute();
+}
+
+/**
+ * @brief raw get the raw curl multi-handle (CURLM::handle)
+ *
+ * @warning You should not be using this, unless you absolutely need to use curl features that are not provided by
+ * the \a asyncurl library.
+ * @return then raw multi-handle
+ */
+void*
+mhandle::raw(void) noexcept
+{
+    return curl_multi__;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// OPTIONS
+// Change specific multi handle options - allowing to control the way it will behave.
+// \see https://curl.se/libcurl/c/curl_multi_setopt.html
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_opt_long - Set an information element (\see CURLMOPT type) of type long
+ *
+ * @param id The information's id to set
+ * @param val The value to set
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ */
+mhandle::MHDL_RetCode
+mhandle::set_opt_long(int id, long val) noexcept
+{
+    if (CURLMOPT_MAXCONNECTS == id)
+    {
+        fd__.maxconnects = val;
+        if (fd__.shrunk) return MHDL_OK; // Applied once the descriptors pressure is gone
+    }
+
+    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), val)) ? MHDL_OK
+                                                                                            : MHDL_INTERNAL_ERROR;
+}
+
+/**
+ * @brief set_opt_ptr - Set an information element (\see CURLMOPT type) of type ptr
+ *
+ * @param id The information's id to set
+ * @param val The value to set
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ */
+mhandle::MHDL_RetCode
+mhandle::set_opt_ptr(int id, const void* val) noexcept
+{
+    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), val)) ? MHDL_OK
+                                                                                            : MHDL_INTERNAL_ERROR;
+}
+
+/**
+ * @brief set_opt_bool - Set an information element (\see CURLMOPT type) of type bool
+ *
+ * @param id The information's id to set
+ * @param val The value to set
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ */
+mhandle::MHDL_RetCode
+mhandle::set_opt_bool(int id, bool val) noexcept
+{
+    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), static_cast<long>(val ? 1 : 0)))
+             ? MHDL_OK
+             : MHDL_INTERNAL_ERROR;
+}
+
+/**
+ * @brief set_opt_offset - Set an information element of type offset
+ *
+ * @param id The information's id to set
+ * @param val The value to set
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ */
+mhandle::MHDL_RetCode
+mhandle::set_opt_offset(int id, long val) noexcept
+{
+    if (CURLOPTTYPE_OFF_T != (id / 10000) * 10000) return MHDL_BAD_PARAM;
+    return (CURLM_OK == curl_multi_setopt(curl_multi__, static_cast<CURLMoption>(id), val)) ? MHDL_OK
+                                                                                            : MHDL_INTERNAL_ERROR;
+}
+
+/**
+ * @brief set_opt - Set an option modifying the behaviour of the session
+ *
+ * @param id The identifier of the option to set
+ * @param val The value to set
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_setopt.html
+ */
+mhandle::MHDL_RetCode
+mhandle::set_opt(int id, std::any val) noexcept
+{
+    MHDL_RetCode ret{ MHDL_BAD_PARAM };
+    const auto   curType{ (id / 10000) * 10000 };
+
+    if (!val.has_value()) return ret;
 
     if (typeid(long) == val.type() && (CURLOPTTYPE_LONG == curType))
     {
@@ -444,77 +1152,1979 @@ mhandle::set_pipelining(long mask) noexcept
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-// CALLBACKS
-// The sessions are event-driven (by miniloop) and need to setup callbacks to miniloop in order to work properly
-// \see https://curl.se/libcurl/c/libcurl-multi.html
+// FILE DESCRIPTORS BUDGET
+// Near its budget, the session queues the transfers needing a new connection and shrinks its connections cache, so
+// that the exhaustion of the process descriptors (EMFILE) turns into queueing instead of failures.
 //---------------------------------------------------------------------------------------------------------------------
 
 /**
- * @brief set_cb_error - Set error callback
+ * @brief set_fd_budget - Set the maximum number of file descriptors the session may hold
  *
- * @param cb The callback used when the multi-session fails
+ * The budget is a ratio of the process descriptors limit (RLIMIT_NOFILE soft limit), the remaining descriptors being
+ * left to the rest of the process (listeners, files...).
+ * @param ratio The ratio of the descriptors limit granted to the session, in [0, 1] (0 disables the budget)
+ * @param raise_soft_limit Whether to raise the soft limit first, up to the hard limit (at most 2^20 - a higher soft
+ * limit is kept)
+ * @return A return code described by the \a MHDL_RetCode enumerate
  */
-void
-mhandle::set_cb_error(TCbError& cb) noexcept
+mhandle::MHDL_RetCode
+mhandle::set_fd_budget(double ratio, bool raise_soft_limit) noexcept
 {
-    cb_error__ = cb;
-}
+    if (ratio < 0 || ratio > 1) return MHDL_BAD_PARAM;
 
-/**
- * @brief mhandle::handle_stop - Manage the end of the session
- *
- * This will remove any individual transfer managed by the session (and call their done callback if any).
- * It will then cleanup its internal structures and call its error callback if any.
- * @param errCode The code associated to the stop (e.g. CURLM_OK for a 'normal' stop or another code in case of error)
- */
-void
-mhandle::handle_stop(int errCode) noexcept
-{
-    running_handles__ = MHDL_STOPPED;
+    rlimit rl{};
+    if (0 != ::getrlimit(RLIMIT_NOFILE, &rl)) return MHDL_INTERNAL_ERROR;
 
-    for (auto it{ std::cbegin(handles__) }; std::cend(handles__) != it;)
+    // Never lowered : the soft limit may be above FD_MAX_SOFT_LIMIT already
+    const auto raised{ std::max(rl.rlim_cur, std::min<rlim_t>(rl.rlim_max, FD_MAX_SOFT_LIMIT)) };
+    if (raise_soft_limit && raised != rl.rlim_cur)
     {
-        auto h{ it->second };
-
-        it                 = handles__.erase(it);
-        h->multi_handler__ = nullptr;
-
-        h->cb_done__(handle::HDL_MULTI_STOPPED);
+        rl.rlim_cur = raised;
+        if (0 != ::setrlimit(RLIMIT_NOFILE, &rl) && 0 != ::getrlimit(RLIMIT_NOFILE, &rl)) return MHDL_INTERNAL_ERROR;
     }
 
-    timeout__->cancel();
+    const auto soft{ std::min<rlim_t>(rl.rlim_cur, std::numeric_limits<long>::max()) };
 
-    curl_multi_cleanup(curl_multi__);
+    fd__.limit        = (0 == ratio) ? 0 : std::max(1L, static_cast<long>(ratio * static_cast<double>(soft)));
+    fd__.effective    = fd__.limit;
+    fd__.exhausted_us = 0;
 
-    if (CURLM_OK != errCode) cb_error__(errCode);
+    admit_pending();
+    return MHDL_OK;
 }
 
 /**
- * @brief handle_msgs - Processes messages related to transfers
+ * @brief held_fds - Get the number of file descriptors currently held by the session
  *
- * Mostly used to inform transfers when they are done :)
+ * @return The number of descriptors
+ */
+long
+mhandle::held_fds(void) const noexcept
+{
+    return std::max(open_sockets__, polled_sockets__);
+}
+
+/**
+ * @brief fd_pressure - Adapt the connections cache to the descriptors budget
  *
- * @see https://curl.se/libcurl/c/curl_multi_info_read.html
+ * Above FD_HIGH_RATIO of the budget, the cache is shrunk to the number of running transfers (idle connections are
+ * closed); it is restored below FD_LOW_RATIO.
  */
 void
-mhandle::handle_msgs(void) noexcept
+mhandle::fd_pressure(void) noexcept
 {
-    int      dumb;
-    CURLMsg* msg{ nullptr };
+    if (nullptr == curl_multi__) return;
 
-    while ((msg = curl_multi_info_read(this->curl_multi__, &dumb)))
+    if (fd__.effective < fd__.limit && monotonic_us() - fd__.exhausted_us >= FD_RECOVERY_MS * 1000)
+        fd__.effective = fd__.limit;
+
+    const auto held{ static_cast<double>(held_fds()) };
+    const auto budget{ static_cast<double>(fd__.effective) };
+
+    if (0 != fd__.limit && held >= FD_HIGH_RATIO * budget)
     {
-        if (CURLMSG_DONE != msg->msg) continue;
+        fd__.shrunk = true;
+        curl_multi_setopt(curl_multi__, CURLMOPT_MAXCONNECTS, std::max(1L, static_cast<long>(std::size(handles__))));
+    }
+    else if (fd__.shrunk && (0 == fd__.limit || held < FD_LOW_RATIO * budget))
+    {
+        fd__.shrunk = false;
+        curl_multi_setopt(curl_multi__, CURLMOPT_MAXCONNECTS, fd__.maxconnects);
+    }
 
-        CURL* hdl{ msg->easy_handle };
-        auto  it{ handles__.find(hdl) };
+    // Exhaustion recovery is time based : check again later
+    if (nullptr != queue_head__ && fd__.effective < fd__.limit) admission_arm(FD_RECOVERY_MS);
+}
 
-        if (std::end(handles__) == it) continue;
+//---------------------------------------------------------------------------------------------------------------------
+// SOCKETS
+//---------------------------------------------------------------------------------------------------------------------
 
-        handle* h{ it->second };
-        remove_handle(*h);
-        if (h->cb_done__) h->cb_done__(msg->data.result);
+/**
+ * @brief set_socket_factory - Set the default factory creating and tuning the sockets of the transfers
+ *
+ * Transfers having their own factory (\see handle::set_socket_factory) use it instead.
+ * @param factory The factory (nullptr for plain sockets) - it must outlive the session
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::set_socket_factory(socket_factory* factory) noexcept
+{
+    socket_factory__ = factory;
+    return MHDL_OK;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// SOURCE ADDRESSES
+// The new connections are spread over a pool of local addresses, each of them having its own ephemeral ports range
+// towards a given destination.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_source_addresses - Set the pool of local addresses the new connections are bound to
+ *
+ * Each new connection is bound to the least loaded address of its family (round-robin among the ties). The port
+ * selection is deferred to the connection (IP_BIND_ADDRESS_NO_PORT), so that the same port can be reused towards
+ * different destinations. The connections already open are not affected.
+ * @param addresses The local IPv4/IPv6 addresses (an empty pool disables the binding)
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @warning Do not set CURLOPT_INTERFACE on the transfers of a session having a source addresses pool
+ */
+mhandle::MHDL_RetCode
+mhandle::set_source_addresses(const std::vector<std::string>& addresses) noexcept
+{
+    try
+    {
+        std::vector<source_address> pool;
+        pool.reserve(std::size(addresses));
+
+        for (const auto& address : addresses)
+        {
+            source_address src;
+            src.address = address;
+
+            if (1 == ::inet_pton(AF_INET, address.c_str(), src.bytes))
+                src.family = AF_INET;
+            else if (1 == ::inet_pton(AF_INET6, address.c_str(), src.bytes))
+                src.family = AF_INET6;
+            else
+                return MHDL_BAD_PARAM;
+
+            auto same = [&address](const source_address& other) { return other.address == address; };
+            if (std::end(pool) != std::find_if(std::begin(pool), std::end(pool), same)) continue;
+
+            // Keep the accounting of the addresses remaining in the pool
+            if (auto it{ std::find_if(std::begin(sources__), std::end(sources__), same) }; std::end(sources__) != it)
+                src.total = it->total;
+
+            pool.emplace_back(std::move(src));
+        }
+
+        // Re-map the bound sockets (the connections of the removed addresses are no longer accounted for)
+        for (auto it{ std::begin(source_of__) }; std::end(source_of__) != it;)
+        {
+            const auto& address{ sources__[it->second].address };
+            auto        found{ std::find_if(std::begin(pool), std::end(pool), [&address](const auto& src) {
+                return src.address == address;
+            }) };
+
+            if (std::end(pool) == found)
+            {
+                it = source_of__.erase(it);
+                continue;
+            }
+
+            it->second = static_cast<size_t>(std::distance(std::begin(pool), found));
+            ++found->connections;
+            ++it;
+        }
+
+        sources__     = std::move(pool);
+        source_next__ = 0;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return MHDL_OUT_OF_MEM;
+    }
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief source_addresses - Get a snapshot of the source addresses pool
+ *
+ * @return The state of every address of the pool
+ */
+std::vector<mhandle::source_stats>
+mhandle::source_addresses(void) const
+{
+    std::vector<source_stats> ret;
+    ret.reserve(std::size(sources__));
+
+    for (const auto& src : sources__)
+        ret.push_back({ src.address, src.connections, src.total });
+
+    return ret;
+}
+
+/**
+ * @brief source_bind - Bind a new socket to the least loaded source address of its family
+ *
+ * @param fd The socket
+ * @param family The address family of the socket
+ * @return 0 on success (or if there is no source address for this family), -1 otherwise
+ */
+int
+mhandle::source_bind(int fd, int family) noexcept
+{
+    const auto n{ std::size(sources__) };
+    auto       best{ n };
+
+    for (size_t k{ 0 }; k < n; ++k)
+    {
+        const auto i{ (source_next__ + k) % n };
+        if (family != sources__[i].family) continue;
+        if (n == best || sources__[i].connections < sources__[best].connections) best = i;
+    }
+    if (n == best) return 0;
+
+    auto& src{ sources__[best] };
+    source_next__ = (best + 1) % n;
+
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    // The port is chosen at connect() time, against the (address, port, destination) tuple only
+    int on{ 1 };
+    ::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+#endif
+
+    sockaddr_storage ss{};
+    socklen_t        len{ 0 };
+    if (AF_INET == family)
+    {
+        auto sin{ reinterpret_cast<sockaddr_in*>(&ss) };
+        sin->sin_family = AF_INET;
+        std::memcpy(&sin->sin_addr, src.bytes, sizeof(sin->sin_addr));
+        len = sizeof(sockaddr_in);
+    }
+    else
+    {
+        auto sin6{ reinterpret_cast<sockaddr_in6*>(&ss) };
+        sin6->sin6_family = AF_INET6;
+        std::memcpy(&sin6->sin6_addr, src.bytes, sizeof(sin6->sin6_addr));
+        len = sizeof(sockaddr_in6);
+    }
+
+    if (0 != ::bind(fd, reinterpret_cast<sockaddr*>(&ss), len)) return -1;
+
+    try
+    {
+        source_of__[fd] = best;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return -1;
+    }
+
+    ++src.connections;
+    ++src.total;
+    return 0;
+}
+
+/**
+ * @brief source_unbind - Account for the closing of a socket bound to a source address
+ *
+ * @param fd The socket
+ */
+void
+mhandle::source_unbind(int fd) noexcept
+{
+    auto it{ source_of__.find(fd) };
+    if (std::end(source_of__) == it) return;
+
+    if (it->second < std::size(sources__) && 0 < sources__[it->second].connections) --sources__[it->second].connections;
+    source_of__.erase(it);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// CONTEXTS
+// The deadlines of the contexts are kept sorted, and a single timer is armed for the earliest one
+// \see context
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief ctx_schedule - Track the deadline of a context
+ *
+ * @param ctx The context
+ * @throw std::bad_alloc
+ */
+void
+mhandle::ctx_schedule(context& ctx)
+{
+    ctx_deadlines__.emplace(ctx.deadline_us__, &ctx);
+    ctx_arm();
+}
+
+/**
+ * @brief ctx_unschedule - Stop tracking the deadline of a context
+ *
+ * @param ctx The context
+ */
+void
+mhandle::ctx_unschedule(context& ctx) noexcept
+{
+    ctx_deadlines__.erase({ ctx.deadline_us__, &ctx });
+}
+
+/**
+ * @brief ctx_abort - Complete a transfer of a cancelled (or expired) context
+ *
+ * @param h The transfer
+ * @param result The result of the transfer
+ */
+void
+mhandle::ctx_abort(handle& h, int result) noexcept
+{
+    if (MHDL_OK != remove_handle(h)) return;
+
+    notify(h, result);
+}
+
+/**
+ * @brief ctx_arm - Arm the deadlines timer for the earliest deadline
+ */
+void
+mhandle::ctx_arm(void) noexcept
+{
+    if (std::empty(ctx_deadlines__) || MHDL_STOPPED == running_handles__) return;
+
+    const auto due{ std::begin(ctx_deadlines__)->first };
+    if (0 != ctx_due_us__ && ctx_due_us__ <= due) return;
+
+    ctx_due_us__ = due;
+    ctx_timer__->set(std::max<long>(1, static_cast<long>((due - monotonic_us() + 999) / 1000)));
+}
+
+/**
+ * @brief ctx_tick - Expire the contexts whose deadline is reached
+ */
+void
+mhandle::ctx_tick(void) noexcept
+{
+    const auto now{ monotonic_us() };
+
+    // Expiring a context unschedules it (and its children)
+    while (!std::empty(ctx_deadlines__) && std::begin(ctx_deadlines__)->first <= now)
+        std::begin(ctx_deadlines__)->second->complete(CURLE_OPERATION_TIMEDOUT);
+
+    admit_pending();
+    ctx_arm();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// TAGS
+// The transfers of the session sharing a tag are linked in a group (intrusive list, in linking order) : the group
+// operations only visit its transfers, whatever the number of transfers of the session.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief tag_key - Get the decimal representation of an integer tag
+ *
+ * @param tag The tag
+ * @param buf The buffer holding the representation
+ * @return The representation (\see handle::set_tag)
+ */
+static std::string_view
+tag_key(int64_t tag, char (&buf)[24]) noexcept
+{
+    auto res{ std::to_chars(std::begin(buf), std::end(buf), tag) };
+    return { buf, static_cast<size_t>(res.ptr - buf) };
+}
+
+/**
+ * @brief tag_link - Link a transfer being added to the group of its tag (if any)
+ *
+ * @param h The transfer
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::tag_link(handle& h) noexcept
+{
+    if (std::empty(h.tag__) || nullptr != h.tag_group__) return MHDL_OK;
+
+    tag_group* g{ nullptr };
+    try
+    {
+        auto it{ tags__.try_emplace(h.tag__).first };
+
+        if (!it->second)
+        {
+            it->second      = std::make_unique<tag_group>();
+            it->second->key = it->first;
+        }
+        g = it->second.get();
+    }
+    catch (const std::bad_alloc&)
+    {
+        if (auto it{ tags__.find(h.tag__) }; std::end(tags__) != it && !it->second) tags__.erase(it);
+        return MHDL_OUT_OF_MEM;
+    }
+
+    h.tag_group__ = g;
+    h.tag_seq__   = ++tag_seq__;
+    h.tag_next__  = nullptr;
+    h.tag_prev__  = g->tail;
+    if (nullptr != g->tail)
+        g->tail->tag_next__ = &h;
+    else
+        g->head = &h;
+    g->tail = &h;
+    ++g->count;
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief tag_unlink - Unlink a transfer leaving the session from the group of its tag (if any)
+ *
+ * @param h The transfer
+ */
+void
+mhandle::tag_unlink(handle& h) noexcept
+{
+    auto g{ h.tag_group__ };
+    if (nullptr == g) return;
+
+    if (nullptr != h.tag_prev__)
+        h.tag_prev__->tag_next__ = h.tag_next__;
+    else
+        g->head = h.tag_next__;
+    if (nullptr != h.tag_next__)
+        h.tag_next__->tag_prev__ = h.tag_prev__;
+    else
+        g->tail = h.tag_prev__;
+
+    h.tag_group__ = nullptr;
+    h.tag_prev__  = nullptr;
+    h.tag_next__  = nullptr;
+    --g->count;
+
+    tag_release(*g);
+}
+
+/**
+ * @brief tag_find - Get the group of a tag
+ *
+ * @param tag The tag
+ * @return The group (nullptr if no transfer of the session has this tag)
+ */
+tag_group*
+mhandle::tag_find(std::string_view tag) const noexcept
+{
+    auto it{ tags__.find(tag) };
+    return (std::end(tags__) == it) ? nullptr : it->second.get();
+}
+
+/**
+ * @brief tag_release - Destroy a group once empty (and not being visited by a group operation)
+ *
+ * @param g The group
+ */
+void
+mhandle::tag_release(tag_group& g) noexcept
+{
+    if (0 != g.count || 0 != g.visiting) return;
+
+    tags__.erase(tags__.find(g.key));
+}
+
+/**
+ * @brief cancel_tag - Cancel the transfers of the session having a tag
+ *
+ * The transfers are removed from the session, and their done callbacks are called with HDL_CANCELLED (\see
+ * mhandle::remove_handle to remove them silently). The transfers added by the callbacks are not cancelled.
+ * @param tag The tag
+ * @return The number of transfers cancelled
+ */
+size_t
+mhandle::cancel_tag(std::string_view tag) noexcept
+{
+    auto g{ tag_find(tag) };
+    if (nullptr == g) return 0;
+
+    const auto last{ tag_seq__ };
+    size_t     n{ 0 };
+
+    ++g->visiting;
+    while (nullptr != g->head && g->head->tag_seq__ <= last)
+    {
+        ctx_abort(*g->head, handle::HDL_CANCELLED); // Unlinks it (\see mhandle::remove_handle)
+        ++n;
+    }
+    --g->visiting;
+    tag_release(*g);
+
+    return n;
+}
+
+/**
+ * @brief cancel_tag - Cancel the transfers of the session having an integer tag
+ *
+ * @param tag The tag
+ * @return The number of transfers cancelled
+ */
+size_t
+mhandle::cancel_tag(int64_t tag) noexcept
+{
+    char buf[24];
+    return cancel_tag(tag_key(tag, buf));
+}
+
+/**
+ * @brief count_tag - Count the transfers of the session (running or queued) having a tag
+ *
+ * @param tag The tag
+ * @return The number of transfers
+ */
+size_t
+mhandle::count_tag(std::string_view tag) const noexcept
+{
+    auto g{ tag_find(tag) };
+    return (nullptr == g) ? 0 : g->count;
+}
+
+/**
+ * @brief count_tag - Count the transfers of the session (running or queued) having an integer tag
+ *
+ * @param tag The tag
+ * @return The number of transfers
+ */
+size_t
+mhandle::count_tag(int64_t tag) const noexcept
+{
+    char buf[24];
+    return count_tag(tag_key(tag, buf));
+}
+
+/**
+ * @brief pause_tag - Pause the transfers of the session having a tag
+ *
+ * The queued transfers are paused once admitted.
+ * @param tag The tag
+ * @param bitmask CURL pause mask (CURLPAUSE_RECV, CURLPAUSE_SEND, CURLPAUSE_ALL)
+ * @return The number of transfers paused
+ */
+size_t
+mhandle::pause_tag(std::string_view tag, int bitmask) noexcept
+{
+    return tag_apply(tag, [bitmask](handle& h) {
+        if (!h.queued__) return h.pause(bitmask);
+
+        h.flags__ |= (bitmask & CURLPAUSE_ALL); // Applied once admitted
+        return true;
+    });
+}
+
+/**
+ * @brief pause_tag - Pause the transfers of the session having an integer tag
+ *
+ * @param tag The tag
+ * @param bitmask CURL pause mask (CURLPAUSE_RECV, CURLPAUSE_SEND, CURLPAUSE_ALL)
+ * @return The number of transfers paused
+ */
+size_t
+mhandle::pause_tag(int64_t tag, int bitmask) noexcept
+{
+    char buf[24];
+    return pause_tag(tag_key(tag, buf), bitmask);
+}
+
+/**
+ * @brief unpause_tag - Unpause the transfers of the session having a tag
+ *
+ * @param tag The tag
+ * @param bitmask CURL pause mask (CURLPAUSE_RECV, CURLPAUSE_SEND, CURLPAUSE_ALL)
+ * @return The number of transfers unpaused
+ */
+size_t
+mhandle::unpause_tag(std::string_view tag, int bitmask) noexcept
+{
+    return tag_apply(tag, [bitmask](handle& h) {
+        if (!h.queued__) return h.unpause(bitmask);
+
+        h.flags__ &= ~(bitmask & CURLPAUSE_ALL);
+        return true;
+    });
+}
+
+/**
+ * @brief unpause_tag - Unpause the transfers of the session having an integer tag
+ *
+ * @param tag The tag
+ * @param bitmask CURL pause mask (CURLPAUSE_RECV, CURLPAUSE_SEND, CURLPAUSE_ALL)
+ * @return The number of transfers unpaused
+ */
+size_t
+mhandle::unpause_tag(int64_t tag, int bitmask) noexcept
+{
+    char buf[24];
+    return unpause_tag(tag_key(tag, buf), bitmask);
+}
+
+/**
+ * @brief tag_apply - Apply an operation to the transfers of the session having a tag
+ *
+ * Each transfer is moved to the tail of the group before the operation : the transfers removed (or added) by the
+ * callbacks run by curl meanwhile do not disturb the visit, and the transfers added are not visited.
+ * @param tag The tag
+ * @param op The operation (returns whether it succeeded)
+ * @return The number of transfers the operation succeeded on
+ */
+size_t
+mhandle::tag_apply(std::string_view tag, const std::function<bool(handle&)>& op) noexcept
+{
+    auto g{ tag_find(tag) };
+    if (nullptr == g) return 0;
+
+    const auto last{ tag_seq__ };
+    size_t     n{ 0 };
+
+    ++g->visiting;
+    while (nullptr != g->head && g->head->tag_seq__ <= last)
+    {
+        auto& h{ *g->head };
+
+        tag_unlink(h);
+        tag_link(h); // Never allocates : the group exists
+        if (op(h)) ++n;
+    }
+    --g->visiting;
+    tag_release(*g);
+
+    return n;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// SCATTER-GATHER
+// A set of transfers completes as a whole as soon as its outcome is known, the remaining transfers being removed
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief gather - Perform a set of transfers (e.g. the same query to N shards) and complete them as a whole
+ *
+ * The outcome is known as soon as enough transfers succeeded (curl success and HTTP response < 400), as soon as the
+ * policy can not be satisfied anymore, or when the deadline expires. The callback is then called once, and the
+ * remaining transfers are removed from the session right away : curl keeps their connections in its cache whenever
+ * they can be reused (e.g. HTTP/2 streams, or transfers that did not start yet).
+ * The done callbacks of the transfers are still called (HDL_CANCELLED for the removed ones).
+ * @param handles The transfers (they must not be owned by a session)
+ * @param policy The completion policy
+ * @param cb The callback called with the outcome
+ * @param parent A context whose cancellation (or deadline) applies to the transfers (if any)
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @warning The transfers must not be removed from the session (nor destroyed) until the outcome is known
+ */
+mhandle::MHDL_RetCode
+mhandle::gather(const std::vector<handle*>& handles, const gather_policy& policy, const TCbGather& cb,
+                context* parent) noexcept
+{
+    if (MHDL_STOPPED == running_handles__) return MHDL_INTERNAL_ERROR;
+    if (std::empty(handles) || policy.timeout_ms < 0) return MHDL_BAD_PARAM;
+    if (nullptr != parent && this != &parent->session__) return MHDL_BAD_PARAM;
+    if (nullptr != parent && parent->done()) return MHDL_CONTEXT_DONE;
+
+    size_t quorum{ std::size(handles) };
+    if (GATHER_FIRST_SUCCESS == policy.mode) quorum = 1;
+    if (GATHER_QUORUM == policy.mode) quorum = policy.quorum;
+    if (0 == quorum || quorum > std::size(handles)) return MHDL_BAD_PARAM;
+
+    for (auto h : handles)
+    {
+        if (nullptr == h) return MHDL_BAD_HANDLE;
+        if (this == h->multi_handler__) return MHDL_ADD_ALREADY;
+        if (nullptr != h->multi_handler__) return MHDL_ADD_OWNED;
+    }
+
+    gather_state* g{ nullptr };
+    try
+    {
+        auto state{ std::make_unique<gather_state>() };
+
+        state->ctx = (nullptr != parent) ? std::make_unique<context>(*parent, policy.timeout_ms)
+                                         : std::make_unique<context>(*this, policy.timeout_ms);
+        state->result.completed.reserve(std::size(handles));
+        state->cb = cb;
+
+        g            = state.get();
+        gathers__[g] = std::move(state);
+    }
+    catch (const std::bad_alloc&)
+    {
+        if (nullptr != g) gathers__.erase(g);
+        return MHDL_OUT_OF_MEM;
+    }
+
+    g->total  = std::size(handles);
+    g->quorum = quorum;
+    g->adding = true;
+
+    for (size_t i{ 0 }; i < std::size(handles); ++i)
+    {
+        handles[i]->gather__ = g;
+        if (auto ret{ add_handle(*handles[i], *g->ctx) }; MHDL_OK != ret)
+        {
+            // Roll back (a same handle passed twice ends up here)
+            for (size_t j{ 0 }; j <= i; ++j)
+            {
+                if (g != handles[j]->gather__) continue;
+
+                handles[j]->gather__ = nullptr;
+                remove_handle(*handles[j]);
+            }
+            gathers__.erase(g);
+            return ret;
+        }
+    }
+
+    g->adding = false;
+    gather_check(*g);
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief gather_completed - Account for the completion of a transfer of a scatter-gather
+ *
+ * @param h The transfer
+ * @param result The result of the transfer
+ */
+void
+mhandle::gather_completed(handle& h, int result) noexcept
+{
+    auto g{ h.gather__ };
+    h.gather__ = nullptr;
+
+    long code{ 0 };
+    if (CURLE_OK == result) h.get_info_long(CURLINFO_RESPONSE_CODE, code);
+
+    if (g->fired) return;
+
+    g->result.completed.emplace_back(&h, result);
+    if (CURLE_OK == result && code < 400)
+        ++g->result.succeeded;
+    else
+        ++g->result.failed;
+
+    if (!g->adding) gather_check(*g);
+}
+
+/**
+ * @brief gather_check - Complete a scatter-gather if its outcome is known
+ *
+ * @param g The scatter-gather
+ */
+void
+mhandle::gather_check(gather_state& g) noexcept
+{
+    const auto done{ g.result.succeeded + g.result.failed };
+
+    // The context (or the session) is being completed : wait for all the transfers
+    if ((g.ctx->done() || MHDL_STOPPED == running_handles__) && done < g.total) return;
+    if (g.result.succeeded < g.quorum && g.result.failed <= g.total - g.quorum && done < g.total) return;
+
+    g.fired            = true;
+    g.result.satisfied = g.result.succeeded >= g.quorum;
+    g.result.cancelled = g.ctx->size();
+
+    // The remaining transfers are removed : their done callbacks get HDL_CANCELLED
+    g.ctx->cancel();
+    gc_timer__->set(0);
+
+    auto cb{ std::move(g.cb) };
+    g.cb = nullptr;
+    if (cb) cb(g.result);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// COROUTINES
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief fetch - Get an awaitable performing a transfer : \a co_await \a session.fetch(h)
+ *
+ * The transfer is added to the session when awaited, and the coroutine is resumed once it completed (after its done
+ * callback). No allocation is made beyond the coroutine frame.
+ * @param h The transfer (it must not be owned by a session)
+ * @param ctx The context the transfer is attached to (if any)
+ * @return The awaitable (\see transfer_awaiter)
+ */
+transfer_awaiter
+mhandle::fetch(handle& h, context* ctx) noexcept
+{
+    return transfer_awaiter{ *this, h, ctx };
+}
+
+/**
+ * @brief stream - Get the asynchronous sequence of the chunks of the response body of a transfer
+ *
+ * \a while \a (auto \a chunk \a = \a co_await \a s.next()) : the transfer is added to the session by the first call
+ * to next, and paused while the coroutine does not ask for the next chunk (\see body_stream).
+ * @param h The transfer (it must not be owned by a session). Its write callback is replaced
+ * @param ctx The context the transfer is attached to (if any)
+ * @return The stream (\see body_stream)
+ */
+body_stream
+mhandle::stream(handle& h, context* ctx) noexcept
+{
+    return body_stream{ *this, h, ctx };
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// STRAGGLERS
+// The throughput of the transfers is sampled periodically and compared to the one of their peers (the transfers to
+// the same origin). A download much slower than its peers is reissued on a fresh connection, resuming where it
+// stalled, and the first of the two to complete wins.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_straggler_reissue - Reissue the transfers much slower than their peers
+ *
+ * Every sample_ms, the throughput of each transfer is compared to the median throughput of the transfers to the same
+ * origin : a transfer older than min_age_ms running below ratio * median is a straggler.
+ * A straggler is reissued once, on a fresh connection (and through a new endpoint if it is load balanced) :
+ * <ul>
+ * <li>The reissue resumes the download where the straggler is (HTTP range), unless the response is encoded or the
+ * transfer already requests a range - in which case the data already delivered is skipped</li>
+ * <li>As soon as the reissue overtakes the straggler, it delivers the data to the write callback of the straggler
+ * (which is paused), and completes it in its place</li>
+ * <li>If the straggler completes first, the reissue is dropped</li>
+ * </ul>
+ * Only the GET transfers are reissued. The reissues are internal to the session : they do not call the header,
+ * progress or debug callbacks of the stragglers.
+ * @param ratio The throughput ratio (to the origin median) below which a transfer is a straggler - 0 to disable
+ * @param min_age_ms The minimum age of a transfer before it can be considered a straggler (milliseconds)
+ * @param sample_ms The period of the throughput sampling (milliseconds)
+ * @param min_peers The minimum number of transfers to the same origin needed to compute a median
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::set_straggler_reissue(double ratio, long min_age_ms, long sample_ms, long min_peers) noexcept
+{
+    if (ratio < 0 || ratio >= 1 || min_age_ms < 0 || sample_ms <= 0 || min_peers < 2) return MHDL_BAD_PARAM;
+
+    strg__.ratio      = ratio;
+    strg__.min_age_us = static_cast<int64_t>(min_age_ms) * 1000;
+    strg__.sample_ms  = sample_ms;
+    strg__.min_peers  = static_cast<size_t>(min_peers);
+
+    strg_timer__->cancel();
+    strg__.armed = false;
+    strg_arm();
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief strg_arm - Arm the sampling timer (if there is anything to sample)
+ */
+void
+mhandle::strg_arm(void) noexcept
+{
+    if (strg__.armed || 0 == strg__.ratio || std::empty(handles__)) return;
+
+    strg__.armed = true;
+    strg_timer__->set(strg__.sample_ms);
+}
+
+/**
+ * @brief strg_tick - Sample the throughput of the transfers and reissue the stragglers
+ */
+void
+mhandle::strg_tick(void) noexcept
+{
+    const auto now{ monotonic_us() };
+
+    strg_scratch__.clear();
+    for (auto& [raw, h] : handles__)
+    {
+        // The reissues and the transfers paused by the user are not compared
+        if (h->strg_reissue__ || 0 != (h->flags__ & CURLPAUSE_RECV)) continue;
+
+        if (0 == h->strg_start_us__)
+        {
+            h->strg_start_us__   = now;
+            h->strg_last_us__    = now;
+            h->strg_last_bytes__ = h->rx_bytes__;
+            continue;
+        }
+
+        const auto elapsed{ now - h->strg_last_us__ };
+        if (elapsed <= 0) continue;
+
+        const auto bytes{ static_cast<double>(h->rx_bytes__ - h->strg_last_bytes__) };
+        const auto rate{ bytes * 1e6 / static_cast<double>(elapsed) };
+        const auto prev{ (h->strg_rate__ < 0) ? rate : h->strg_rate__ };
+
+        h->strg_rate__       = STRG_EWMA_WEIGHT * rate + (1 - STRG_EWMA_WEIGHT) * prev;
+        h->strg_last_us__    = now;
+        h->strg_last_bytes__ = h->rx_bytes__;
+
+        if (now - h->strg_start_us__ < strg__.min_age_us) continue;
+        if (std::empty(h->strg_origin__) && !origin_of(*h, h->strg_origin__)) continue;
+
+        try
+        {
+            strg_scratch__.push_back(h);
+        }
+        catch (const std::bad_alloc&)
+        {
+            break;
+        }
+    }
+
+    std::sort(std::begin(strg_scratch__), std::end(strg_scratch__), [](const handle* a, const handle* b) {
+        return a->strg_origin__ < b->strg_origin__;
+    });
+
+    for (auto first{ std::begin(strg_scratch__) }; std::end(strg_scratch__) != first;)
+    {
+        auto last{ std::find_if(first, std::end(strg_scratch__), [first](const handle* h) {
+            return h->strg_origin__ != (*first)->strg_origin__;
+        }) };
+
+        if (static_cast<size_t>(last - first) >= strg__.min_peers)
+        {
+            auto mid{ first + (last - first) / 2 };
+            std::nth_element(first, mid, last, [](const handle* a, const handle* b) {
+                return a->strg_rate__ < b->strg_rate__;
+            });
+
+            const auto threshold{ (*mid)->strg_rate__ * strg__.ratio };
+            for (auto it{ first }; last != it && MHDL_STOPPED != running_handles__; ++it)
+                if (!(*it)->strg_reissued__ && (*it)->strg_rate__ < threshold) strg_reissue(**it);
+        }
+
+        first = last;
+    }
+
+    strg_arm();
+}
+
+/**
+ * @brief strg_reissue - Reissue a straggler on a fresh connection
+ *
+ * @param h The straggler
+ */
+void
+mhandle::strg_reissue(handle& h) noexcept
+{
+    h.strg_reissued__ = true;
+
+    // Only the downloads can be replayed safely
+    char* method{ nullptr };
+    if (CURLE_OK != curl_easy_getinfo(static_cast<CURL*>(h.raw()), CURLINFO_EFFECTIVE_METHOD, &method) ||
+        nullptr == method || 0 != std::strcmp(method, "GET"))
+        return;
+
+    handle* twin{ h.copy() };
+    if (nullptr == twin) return; // Out of memory : the straggler goes on alone
+
+    CURL* raw{ static_cast<CURL*>(twin->raw()) };
+
+    // A range can not be resumed if the body is encoded, or if the transfer already requests a range
+    const bool resume{ std::end(h.strings__) == h.strings__.find(CURLOPT_ACCEPT_ENCODING) &&
+                       std::end(h.strings__) == h.strings__.find(CURLOPT_RANGE) };
+
+    twin->unroute(); // The copy is routed through the routing list of the straggler
+    twin->socket_factory__ = h.socket_factory__;
+    twin->bw_weight__      = h.bw_weight__;
+    twin->strg_reissue__   = true;
+    twin->strg_twin__      = &h;
+    twin->strg_base__      = resume ? h.rx_bytes__ : 0;
+
+    curl_easy_setopt(raw, CURLOPT_FRESH_CONNECT, 1L);
+    curl_easy_setopt(raw, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(twin->strg_base__));
+    curl_easy_setopt(raw, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(raw, CURLOPT_DEBUGFUNCTION, nullptr);
+    twin->set_cb_header([](char*, size_t size) { return size; });
+    twin->set_cb_write([this, twin](char* data, size_t size) { return this->strg_write(*twin, data, size); });
+
+    h.strg_twin__ = twin;
+    if (MHDL_OK != add_handle(*twin))
+    {
+        h.strg_twin__ = nullptr;
+        delete twin;
+        return;
+    }
+
+    ++strg__.reissues;
+}
+
+/**
+ * @brief strg_write - Write callback of a reissue
+ *
+ * The data the straggler already delivered is skipped, then the reissue delivers to the straggler write callback.
+ * @param twin The reissue
+ * @param data The received data
+ * @param size The size of the data
+ * @return The size of the data handled (\see https://curl.se/libcurl/c/CURLOPT_WRITEFUNCTION.html)
+ */
+size_t
+mhandle::strg_write(handle& twin, char* data, size_t size) noexcept
+{
+    handle* h{ twin.strg_twin__ };
+    if (nullptr == h) return size;
+
+    if (twin.strg_won__)
+    {
+        const auto ret{ h->cb_write__ ? h->cb_write__(data, size) : size };
+        if (ret == size) h->progress__.received(size, -1);
+        return ret;
+    }
+
+    // The server ignored the range : the body starts over
+    if (0 == twin.strg_received__ && 0 < twin.strg_base__)
+    {
+        long code{ 0 };
+        if (handle::HDL_OK != twin.get_info_long(CURLINFO_RESPONSE_CODE, code) || 206 != code) twin.strg_base__ = 0;
+    }
+
+    const auto position{ twin.strg_base__ + twin.strg_received__ };
+    twin.strg_received__ += size;
+    if (position + size <= h->rx_bytes__) return size; // Still behind the straggler
+
+    // Overtaking : the straggler gets paused, and the reissue delivers the data from now on
+    const auto skip{ static_cast<size_t>(h->rx_bytes__ - position) };
+    const auto left{ size - skip };
+    const auto ret{ h->cb_write__ ? h->cb_write__(data + skip, left) : left };
+
+    if (CURL_WRITEFUNC_PAUSE == ret)
+    {
+        twin.strg_received__ -= size; // The same data will be delivered again
+        return ret;
+    }
+    if (ret != left) return 0;
+
+    h->rx_bytes__ += left;
+    h->progress__.received(left, -1);
+    twin.strg_won__ = true;
+
+    return size;
+}
+
+/**
+ * @brief strg_drop - Drop the reissue of a transfer
+ *
+ * @param h The reissued transfer
+ */
+void
+mhandle::strg_drop(handle& h) noexcept
+{
+    auto twin{ h.strg_twin__ };
+
+    h.strg_twin__     = nullptr;
+    twin->strg_twin__ = nullptr;
+    remove_handle(*twin);
+    delete twin;
+}
+
+/**
+ * @brief strg_done - Complete a reissue
+ *
+ * If it overtook the straggler, the straggler is completed with the result of the reissue.
+ * @param twin The reissue
+ * @param result The result of the reissue
+ */
+void
+mhandle::strg_done(handle& twin, int result) noexcept
+{
+    auto h{ twin.strg_twin__ };
+    auto won{ twin.strg_won__ };
+
+    unroute(twin, true, result);
+    remove_handle(twin);
+    delete &twin;
+
+    if (nullptr == h) return;
+
+    h->strg_twin__ = nullptr;
+    if (!won) return;
+
+    ++strg__.wins;
+    remove_handle(*h);
+    notify(*h, result);
+}
+
+/**
+ * @brief strg_lost - Detach a straggler that completed after being overtaken by its reissue
+ *
+ * The straggler stays owned by the session until its reissue completes.
+ * @param h The completed transfer
+ * @return true if the transfer was overtaken by its reissue
+ */
+bool
+mhandle::strg_lost(handle& h) noexcept
+{
+    if (nullptr == h.strg_twin__ || !h.strg_twin__->strg_won__) return false;
+
+    CURL* raw{ static_cast<CURL*>(h.raw()) };
+    unroute(h, false, CURLE_OK);
+    bw_release(h);
+    curl_multi_remove_handle(curl_multi__, raw);
+    sockets_hook(h, false);
+    handles__.erase(raw);
+
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// BANDWIDTH
+// The session bandwidth budget is periodically distributed between the transfers as per-period allowances.
+// A transfer that exhausted its allowance is paused until the next period.
+// \see https://curl.se/libcurl/c/curl_easy_pause.html
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_bandwidth_limit - Set a session-wide bandwidth budget, shared by all the transfers of the session
+ *
+ * Every period, the budget is split between the transfers using a weighted max-min fair share (water-filling) :
+ * transfers that do not use their share (e.g. limited by the peer) only keep what they use plus some headroom, and
+ * the remainder is given to the others proportionally to their weights (\see handle::set_bandwidth_weight).
+ * A transfer that exhausted its share of the current period is paused until the next one.
+ * @param recv_bps The receive budget (bytes per second) - 0 for unlimited
+ * @param send_bps The send budget (bytes per second) - 0 for unlimited
+ * @param period_ms The period of the budget distribution (milliseconds)
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @note The send budget only applies to the data provided through the read callback (\see handle::set_cb_read).
+ */
+mhandle::MHDL_RetCode
+mhandle::set_bandwidth_limit(int64_t recv_bps, int64_t send_bps, long period_ms) noexcept
+{
+    if (recv_bps < 0 || send_bps < 0 || period_ms <= 0) return MHDL_BAD_PARAM;
+
+    // The room is only needed (and reserved) with a budget
+    const int64_t prev[2]{ bw__.bps[0], bw__.bps[1] };
+    bw__.bps[0] = recv_bps;
+    bw__.bps[1] = send_bps;
+    if (!bw_reserve(std::size(handles__)))
+    {
+        bw__.bps[0] = prev[0];
+        bw__.bps[1] = prev[1];
+        return MHDL_OUT_OF_MEM;
+    }
+
+    for (auto& [raw, h] : handles__)
+        bw_release(*h);
+
+    bw__.bps[0]    = recv_bps;
+    bw__.bps[1]    = send_bps;
+    bw__.period_ms = period_ms;
+    bw__.weights   = 0;
+
+    if (0 == recv_bps && 0 == send_bps)
+    {
+        bw_timer__->cancel();
+        bw__.armed = false;
+        return MHDL_OK;
+    }
+
+    for (auto& [raw, h] : handles__)
+        bw_admit(*h);
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief bw_reserve - Make room for the governed transfers, so that the budget distribution never allocates
+ *
+ * @param count The number of transfers the session may govern
+ * @return false if the room could not be allocated (while a budget is set)
+ */
+bool
+mhandle::bw_reserve(size_t count) noexcept
+{
+    if (0 == bw__.bps[0] && 0 == bw__.bps[1]) return true;
+
+    try
+    {
+        bw_scratch__.reserve(count);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief bw_admit - Give its initial share of the bandwidth budget to a transfer entering the session
+ *
+ * @param h The transfer
+ */
+void
+mhandle::bw_admit(handle& h) noexcept
+{
+    if (0 == bw__.bps[0] && 0 == bw__.bps[1]) return;
+
+    h.bw_governed__ = true;
+    h.bw_paused__   = 0;
+    bw__.weights += h.bw_weight__;
+
+    for (int d{ 0 }; d < 2; ++d)
+    {
+        h.bw_used__[d]      = 0;
+        h.bw_share__[d]     = static_cast<double>(bw__.bps[d] * h.bw_weight__) / static_cast<double>(bw__.weights);
+        h.bw_allowance__[d] = (0 == bw__.bps[d]) ? std::numeric_limits<double>::infinity()
+                                                 : h.bw_share__[d] * static_cast<double>(bw__.period_ms) / 1e3;
+    }
+
+    if (!bw__.armed)
+    {
+        bw__.armed        = true;
+        bw__.last_tick_us = monotonic_us();
+        bw_timer__->set(bw__.period_ms);
+    }
+}
+
+/**
+ * @brief bw_release - Stop governing a transfer leaving the session
+ *
+ * @param h The transfer
+ */
+void
+mhandle::bw_release(handle& h) noexcept
+{
+    if (!h.bw_governed__) return;
+
+    h.bw_governed__ = false;
+    bw__.weights    = std::max<long>(bw__.weights - h.bw_weight__, 0);
+
+    if (0 != h.bw_paused__)
+    {
+        h.bw_paused__ = 0;
+        curl_easy_pause(static_cast<CURL*>(h.curl_handle__), (h.flags__ | h.strg_paused__) & CURLPAUSE_ALL);
+    }
+}
+
+/**
+ * @brief bw_tick - Distribute the budget of the next period between the transfers
+ *
+ * For each direction, the transfers are sorted by normalized demand (demand / weight) and served in this order : each
+ * one is granted the minimum between its demand and its weighted share of the remaining budget.
+ * A transfer that used most of its allowance (or that has been paused) is considered limited by the budget (infinite
+ * demand), the demand of the others being their measured rate plus some headroom.
+ * The transfers paused by the budget are then resumed.
+ */
+void
+mhandle::bw_tick(void) noexcept
+{
+    static constexpr int _masks[2]{ CURLPAUSE_RECV, CURLPAUSE_SEND };
+
+    if (std::empty(handles__)) return;
+
+    const auto now{ monotonic_us() };
+    const auto elapsed{ static_cast<double>(std::max<int64_t>(now - bw__.last_tick_us, 1)) / 1e6 };
+    const auto period{ static_cast<double>(bw__.period_ms) / 1e3 };
+    bw__.last_tick_us = now;
+
+    for (int d{ 0 }; d < 2; ++d)
+    {
+        if (0 == bw__.bps[d]) continue;
+
+        double weights{ 0 };
+        bw_scratch__.clear();
+        for (auto& [raw, h] : handles__)
+        {
+            if (!h->bw_governed__) continue;
+
+            const bool limited{ (0 != (h->bw_paused__ & _masks[d])) ||
+                                (h->bw_used__[d] >= BW_SATURATION_RATIO * h->bw_share__[d] * elapsed) };
+            const auto demand{ limited ? std::numeric_limits<double>::infinity()
+                                       : std::max({ h->bw_used__[d] / elapsed * BW_GROWTH_RATIO,
+                                                    h->bw_share__[d] * BW_DECAY_RATIO,
+                                                    BW_MIN_RATE }) };
+
+            weights += static_cast<double>(h->bw_weight__);
+            // Never allocates (\see mhandle::bw_reserve)
+            bw_scratch__.emplace_back(demand / static_cast<double>(h->bw_weight__), h);
+        }
+
+        std::sort(std::begin(bw_scratch__), std::end(bw_scratch__), [](const auto& lhs, const auto& rhs) {
+            return lhs.first < rhs.first;
+        });
+
+        bw__.weights = static_cast<long>(weights);
+
+        auto budget{ static_cast<double>(bw__.bps[d]) };
+        for (auto& [normalized, h] : bw_scratch__)
+        {
+            const auto weight{ static_cast<double>(h->bw_weight__) };
+            const auto share{ std::min(budget * weight / weights, normalized * weight) };
+
+            budget -= share;
+            weights -= weight;
+
+            // Unused allowance is lost, while an overdraft (the last chunk of data may exceed the allowance) is due
+            h->bw_share__[d]     = share;
+            h->bw_allowance__[d] = share * period + std::min(h->bw_allowance__[d], 0.0);
+            h->bw_used__[d]      = 0;
+        }
+    }
+
+    for (auto& [raw, h] : handles__)
+    {
+        if (0 == h->bw_paused__) continue;
+
+        for (int d{ 0 }; d < 2; ++d)
+            if (0 < h->bw_allowance__[d]) h->bw_paused__ &= ~_masks[d];
+
+        // Resuming delivers the data kept by curl right away (it may pause the transfer again)
+        curl_easy_pause(static_cast<CURL*>(raw), (h->flags__ | h->bw_paused__ | h->strg_paused__) & CURLPAUSE_ALL);
+    }
+
+    bw__.armed = true;
+    bw_timer__->set(bw__.period_ms);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// EVENT BUDGET
+// The socket events are processed within a time/bytes budget per loop iteration : once exhausted, the remaining events
+// are deferred to the next iteration, so that a fast socket does not starve the other users of the loop.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_event_budget - Set a budget on the socket events processed per loop iteration
+ *
+ * Once the budget of an iteration is exhausted, the socket events are deferred to the next iteration (served
+ * round-robin over the sockets), giving a turn to the timers and the other IOs of the loop. A single event is never
+ * split : the budget is checked between events.
+ * @param max_us The processing time per iteration (microseconds) - 0 for unlimited
+ * @param max_bytes The body bytes received per iteration - 0 for unlimited
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::set_event_budget(long max_us, int64_t max_bytes) noexcept
+{
+    if (max_us < 0 || max_bytes < 0) return MHDL_BAD_PARAM;
+
+    ev__.max_us    = max_us;
+    ev__.max_bytes = static_cast<uint64_t>(max_bytes);
+
+    if (0 == max_us && 0 == max_bytes && !std::empty(ev_deferred__)) ev_timer__->set(0);
+    return MHDL_OK;
+}
+
+/**
+ * @brief socket_event - Hand an event of a socket to curl
+ *
+ * @param s The socket
+ * @param evt_bitmask The events (CURL_CSELECT_*)
+ */
+void
+mhandle::socket_event(long s, int evt_bitmask) noexcept
+{
+    const int rhandles{ running_handles__ };
+
+    // A deferred event of the socket is superseded
+    if (!std::empty(ev_deferred__))
+    {
+        if (auto it{ ev_deferred__.find(s) }; std::end(ev_deferred__) != it)
+        {
+            evt_bitmask |= it->second;
+            ev_deferred__.erase(it);
+        }
+    }
+
+    if (auto ret = curl_multi_socket_action(curl_multi__, static_cast<curl_socket_t>(s), evt_bitmask,
+                                            &running_handles__);
+        CURLM_OK != ret)
+    {
+        handle_stop(ret);
+        return;
+    }
+    if (running_handles__ != rhandles) handle_msgs();
+
+    if (0 < busy__.spin_us) busy_arm();
+}
+
+/**
+ * @brief ev_charge - Account a socket event in the budget of the current iteration
+ *
+ * The first event of an iteration opens its accounting, closed by a zero-delay timer (\see mhandle::ev_tick).
+ * @return Whether the event can be processed right away
+ */
+bool
+mhandle::ev_charge(void) noexcept
+{
+    if (0 == ev__.max_us && 0 == ev__.max_bytes) return true;
+
+    const auto now{ monotonic_us() };
+    if (!ev__.open)
+    {
+        ev__.open        = true;
+        ev__.start_us    = now;
+        ev__.start_bytes = rx_bytes__;
+        ev_timer__->set(0);
+        return true;
+    }
+
+    if (0 < ev__.max_us && ev__.max_us <= now - ev__.start_us) return false;
+    return 0 == ev__.max_bytes || rx_bytes__ - ev__.start_bytes < ev__.max_bytes;
+}
+
+/**
+ * @brief ev_defer - Defer a socket event to the next iteration
+ *
+ * @param s The socket
+ * @param evt_bitmask The events (CURL_CSELECT_*)
+ */
+void
+mhandle::ev_defer(long s, int evt_bitmask) noexcept
+{
+    try
+    {
+        ev_deferred__[s] |= evt_bitmask;
+        ++ev__.deferred;
+    }
+    catch (const std::bad_alloc&)
+    {
+        // Dropped : the socket is still ready, and the loop reports it again
+    }
+}
+
+/**
+ * @brief ev_tick - Close the accounting of an iteration, and process the deferred events within the new budget
+ */
+void
+mhandle::ev_tick(void) noexcept
+{
+    ev__.open = false;
+
+    while (!std::empty(ev_deferred__) && MHDL_STOPPED != running_handles__)
+    {
+        if (!ev_charge()) return; // The next tick takes over
+
+        // Resumed after the last socket served : a busy socket exhausting the budget does not starve the next ones
+        auto it{ ev_deferred__.upper_bound(ev_cursor__) };
+        if (std::end(ev_deferred__) == it) it = std::begin(ev_deferred__);
+
+        const auto [s, evt_bitmask]{ *it };
+
+        ev_deferred__.erase(it);
+        ev_cursor__ = s;
+        socket_event(s, evt_bitmask);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// BUSY POLLING
+// For latency-critical sessions on a dedicated core : after an activity of curl, the sockets of the session are polled
+// without blocking for a while, rather than going back to sleep in the loop (and paying the wakeup latency).
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_busy_poll - Set the busy-polling mode of the session
+ *
+ * After each activity of curl (socket event or timeout), the session spins on the readiness of its sockets
+ * (non-blocking poll) for up to spin_us, handling the events found right away, before letting the loop sleep. This
+ * trades a core for the sleep/wakeup latency of the loop (\see mhandle::enumerate_busy_time for the CPU cost).
+ * @param spin_us The spinning window after an activity of curl (microseconds) - 0 to disable
+ * @param socket_busy_poll_us The SO_BUSY_POLL option of the new sockets (microseconds) - 0 to leave it unset
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ *
+ * @warning Each spin holds the whole loop for up to spin_us after every activity of curl : the other IOs and timers
+ * of the loop (other sessions included) are delayed by as much, and only get a turn between two spins. Only enable it
+ * on a loop dedicated to the latency-critical session, running on its own core.
+ *
+ * @note SO_BUSY_POLL makes the kernel busy-poll the device queue on blocking reads and polls : it only applies to the
+ * NICs supporting it, and raising it above net.core.busy_read requires CAP_NET_ADMIN
+ */
+mhandle::MHDL_RetCode
+mhandle::set_busy_poll(long spin_us, int socket_busy_poll_us) noexcept
+{
+    if (spin_us < 0 || socket_busy_poll_us < 0) return MHDL_BAD_PARAM;
+
+    busy__.spin_us   = spin_us;
+    busy__.socket_us = socket_busy_poll_us;
+
+    if (0 == spin_us)
+    {
+        busy_timer__->cancel();
+        busy__.armed = false;
+    }
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief busy_arm - Spin on the next loop iteration
+ */
+void
+mhandle::busy_arm(void) noexcept
+{
+    if (busy__.armed || MHDL_STOPPED == running_handles__) return;
+
+    busy__.armed = true;
+    busy_timer__->set(0);
+}
+
+/**
+ * @brief busy_spin - Poll the sockets of the session until one is ready, or the spinning window expires
+ *
+ * The events found are handled (and spinning goes on with the next iteration) ; otherwise the loop sleeps until the
+ * next event.
+ */
+void
+mhandle::busy_spin(void) noexcept
+{
+    busy__.armed = false;
+    if (0 == busy__.spin_us || std::empty(busy_events__)) return;
+
+    try
+    {
+        busy_fds__.resize(std::size(busy_events__));
+    }
+    catch (const std::bad_alloc&)
+    {
+        return;
+    }
+
+    size_t i{ 0 };
+    for (const auto& [s, events] : busy_events__)
+        busy_fds__[i++] = { static_cast<int>(s), events, 0 };
+
+    const auto start{ monotonic_us() };
+    auto       now{ start };
+    int        ready{ 0 };
+    do
+    {
+        ready = ::poll(busy_fds__.data(), std::size(busy_fds__), 0);
+        ++busy__.polls;
+        now = monotonic_us();
+    } while (0 == ready && now - start < busy__.spin_us);
+
+    busy__.spent_us += static_cast<uint64_t>(now - start);
+    if (0 >= ready) return;
+
+    for (const auto& p : busy_fds__)
+    {
+        if (0 == p.revents) continue;
+        if (MHDL_STOPPED == running_handles__) return;
+
+        int evt_bitmask{ 0 };
+        if (p.revents & (POLLIN | POLLHUP)) evt_bitmask |= CURL_CSELECT_IN;
+        if (p.revents & POLLOUT) evt_bitmask |= CURL_CSELECT_OUT;
+        if (p.revents & POLLERR) evt_bitmask |= CURL_CSELECT_ERR;
+
+        ++busy__.hits;
+        if (ev_charge())
+            socket_event(p.fd, evt_bitmask);
+        else
+            ev_defer(p.fd, evt_bitmask);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// PROGRESS
+// A single timer reports the progress of all the transfers of the session at once, from the progress records they
+// keep up to date anyway (\see handle::get_progress) : the progress callbacks of the transfers can stay disabled.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_cb_progress - Set the session progress callback
+ *
+ * While transfers are running (or queued), the callback is called once per period with the progress of all of them,
+ * the session throughput and totals - and once more when the session gets idle.
+ * @param cb The callback (nullptr to stop the reports)
+ * @param period_ms The period of the reports (milliseconds)
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::set_cb_progress(const TCbProgress& cb, long period_ms) noexcept
+{
+    if (0 >= period_ms) return MHDL_BAD_PARAM;
+
+    cb_progress__        = cb;
+    progress_period_ms__ = period_ms;
+
+    progress_timer__->cancel();
+    progress_armed__ = false;
+    progress_idle__  = true;
+    progress_arm();
+
+    return MHDL_OK;
+}
+
+/**
+ * @brief progress_arm - Arm the progress timer, if there is a callback (and it is not armed yet)
+ */
+void
+mhandle::progress_arm(void) noexcept
+{
+    if (!cb_progress__ || progress_armed__ || MHDL_STOPPED == running_handles__) return;
+
+    // Coming back from idle : the throughput is measured from now on
+    if (progress_idle__)
+    {
+        progress_last_us__ = monotonic_us();
+        progress_last_rx__ = rx_bytes__;
+        progress_last_tx__ = tx_bytes__;
+    }
+
+    progress_armed__ = true;
+    progress_timer__->set(progress_period_ms__);
+}
+
+/**
+ * @brief progress_tick - Report the progress of the transfers of the session
+ */
+void
+mhandle::progress_tick(void) noexcept
+{
+    progress_armed__ = false;
+    if (!cb_progress__) return;
+
+    auto&      r{ progress_report__ };
+    const auto now{ monotonic_us() };
+    const auto elapsed{ static_cast<double>(std::max<int64_t>(now - progress_last_us__, 1)) / 1e6 };
+
+    r.running  = 0;
+    r.queued   = 0;
+    r.rx_bytes = rx_bytes__;
+    r.tx_bytes = tx_bytes__;
+    r.rx_rate  = static_cast<double>(rx_bytes__ - progress_last_rx__) / elapsed;
+    r.tx_rate  = static_cast<double>(tx_bytes__ - progress_last_tx__) / elapsed;
+    r.transfers.clear();
+
+    progress_last_us__ = now;
+    progress_last_rx__ = rx_bytes__;
+    progress_last_tx__ = tx_bytes__;
+
+    for (auto h{ queue_head__ }; nullptr != h; h = h->queue_next__)
+        if (!h->strg_reissue__) ++r.queued; // Reissues are internal to the session
+
+    try
+    {
+        r.transfers.reserve(std::size(handles__) + queued__);
+        for (const auto& [raw, h] : handles__)
+        {
+            if (h->strg_reissue__) continue; // Internal to the session
+
+            ++r.running;
+            r.transfers.push_back({ h, h->progress__.current() });
+        }
+        for (auto h{ queue_head__ }; nullptr != h; h = h->queue_next__)
+            if (!h->strg_reissue__) r.transfers.push_back({ h, h->progress__.current() });
+    }
+    catch (const std::bad_alloc&)
+    {
+        // Reported with the transfers collected so far
+    }
+
+    const auto idle{ 0 == r.running && 0 == r.queued };
+    const auto report{ !idle || !progress_idle__ };
+
+    progress_idle__ = idle;
+    if (!idle) progress_arm();
+
+    if (report) cb_progress__(r);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// LATENCY
+// The timings of the transfers completed successfully are counted per phase, in log-linear histograms that any
+// thread may snapshot (\see latency_histogram)
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief latency_record - Count the timings of a completed transfer
+ *
+ * The timings are the ones of curl : from the hand-over of the transfer to the end of each phase. A phase is counted
+ * only if it actually happened, i.e. it ended after the previous one : the phases skipped (e.g. name lookup and connect
+ * on a reused connection, TLS handshake in clear) are reported as 0 or as the end of the previous phase, and would
+ * drag the percentiles down.
+ * @param h The transfer
+ */
+void
+mhandle::latency_record(handle& h) noexcept
+{
+    static const std::pair<latency_histogram::LAT_Phase, CURLINFO> _timings[]{
+        { latency_histogram::LAT_NAMELOOKUP, CURLINFO_NAMELOOKUP_TIME_T },
+        { latency_histogram::LAT_CONNECT, CURLINFO_CONNECT_TIME_T },
+        { latency_histogram::LAT_APPCONNECT, CURLINFO_APPCONNECT_TIME_T },
+        { latency_histogram::LAT_PRETRANSFER, CURLINFO_PRETRANSFER_TIME_T },
+        { latency_histogram::LAT_STARTTRANSFER, CURLINFO_STARTTRANSFER_TIME_T },
+        { latency_histogram::LAT_TOTAL, CURLINFO_TOTAL_TIME_T }
+    };
+
+    CURL*      raw{ static_cast<CURL*>(h.curl_handle__) };
+    curl_off_t prev{ 0 }; // End of the last phase that happened
+    for (const auto& [phase, id] : _timings)
+    {
+        curl_off_t us{ 0 };
+        if (CURLE_OK != curl_easy_getinfo(raw, id, &us) || 0 >= us) continue;
+        if (us <= prev && latency_histogram::LAT_TOTAL != phase) continue; // The total is always counted
+
+        latency__[phase].record(us);
+        prev = std::max(prev, us);
+    }
+}
+
+/**
+ * @brief get_latency - Get the latency histogram of a phase of the transfers
+ *
+ * The histogram may be read (\see latency_histogram::snapshot) from any thread, while the session records.
+ * @param phase The phase
+ * @return The histogram
+ */
+const latency_histogram&
+mhandle::get_latency(latency_histogram::LAT_Phase phase) const noexcept
+{
+    return latency__[(latency_histogram::LAT_PHASES > phase) ? phase : latency_histogram::LAT_TOTAL];
+}
+
+/**
+ * @brief reset_latency - Forget the latencies counted so far
+ */
+void
+mhandle::reset_latency(void) noexcept
+{
+    for (auto& l : latency__)
+        l.reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// CALLBACKS
+// The sessions are event-driven (by miniloop) and need to setup callbacks to miniloop in order to work properly
+// \see https://curl.se/libcurl/c/libcurl-multi.html
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_cb_error - Set error callback
+ *
+ * @param cb The callback used when the multi-session fails
+ */
+void
+mhandle::set_cb_error(TCbError& cb) noexcept
+{
+    cb_error__ = cb;
+}
+
+/**
+ * @brief set_cb_completions - Set the batched completion callback
+ *
+ * The completions of the transfers having no done callback of their own (nor awaited by a coroutine) are gathered,
+ * and handed to the callback in a single call per loop iteration, in completion order. The other transfers are
+ * notified as usual : the components of the library relying on done callbacks keep working.
+ * The completions not delivered yet are handed to the previous callback first.
+ * The room of the completions is reserved as the transfers are added (mhandle::add_handle fails with MHDL_OUT_OF_MEM
+ * otherwise) : a completion is never lost.
+ * @param cb The callback (nullptr to get back to per-transfer notifications)
+ *
+ * @warning The transfers must outlive the delivery of their completion
+ */
+void
+mhandle::set_cb_completions(const TCbCompletions& cb) noexcept
+{
+    completions_flush();
+    cb_completions__ = cb;
+
+    // The transfers already added (a failure is handled by mhandle::notify)
+    if (cb_completions__) completions_reserve();
+}
+
+/**
+ * @brief completions_reserve - Make room for the completion of every transfer of the session, so that it is never lost
+ *
+ * The list being delivered (if any) gets its room once delivered (\see mhandle::completions_flush).
+ * @return A return code described by the \a MHDL_RetCode enumerate
+ */
+mhandle::MHDL_RetCode
+mhandle::completions_reserve(void) noexcept
+{
+    const auto room{ std::size(completions__) + std::size(handles__) + queued__ + 1 };
+
+    try
+    {
+        completions__.reserve(room);
+        if (std::empty(completions_out__)) completions_out__.reserve(room);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return MHDL_OUT_OF_MEM;
+    }
+    return MHDL_OK;
+}
+
+/**
+ * @brief completions_flush - Hand the completions gathered so far to the batched completion callback
+ */
+void
+mhandle::completions_flush(void) noexcept
+{
+    if (std::empty(completions__)) return;
+
+    // Called back from the batched completion callback : the completions are delivered on the next loop iteration
+    if (!std::empty(completions_out__))
+    {
+        completions_timer__->set(0);
+        return;
+    }
+
+    completions__.swap(completions_out__);
+    if (cb_completions__) cb_completions__(completions_out__);
+    completions_out__.clear();
+
+    // The lists are swapped on each delivery : both keep the room of the transfers added meanwhile
+    try
+    {
+        completions_out__.reserve(completions__.capacity());
+    }
+    catch (const std::bad_alloc&)
+    {
+        // The next completions beyond the room are delivered on their own (\see mhandle::notify)
+    }
+}
+
+/**
+ * @brief mhandle::handle_stop - Manage the end of the session
+ *
+ * This will remove any individual transfer managed by the session (and call their done callback if any).
+ * It will then cleanup its internal structures and call its error callback if any.
+ * @param errCode The code associated to the stop (e.g. CURLM_OK for a 'normal' stop or another code in case of error)
+ */
+void
+mhandle::handle_stop(int errCode) noexcept
+{
+    running_handles__ = MHDL_STOPPED;
+
+    for (auto it{ std::cbegin(handles__) }; std::cend(handles__) != it;)
+    {
+        auto h{ it->second };
+
+        it                 = handles__.erase(it);
+        h->multi_handler__ = nullptr;
+        unroute(*h, false, CURLE_OK);
+        bw_release(*h);
+
+        // The reissues belong to the session : the original transfers are stopped as if they were never reissued
+        if (h->strg_reissue__)
+        {
+            delete h;
+            continue;
+        }
+        h->strg_twin__ = nullptr;
+        tag_unlink(*h);
+        if (nullptr != h->ctx__) h->ctx__->detach(*h);
+
+        notify(*h, handle::HDL_MULTI_STOPPED);
+    }
+
+    while (nullptr != queue_head__)
+    {
+        auto h{ queue_head__ };
+
+        dequeue(*h);
+        h->multi_handler__ = nullptr;
+
+        // A reissue waiting for its admission belongs to the session too (its original transfer was stopped above)
+        if (h->strg_reissue__)
+        {
+            delete h;
+            continue;
+        }
+        tag_unlink(*h);
+        if (nullptr != h->ctx__) h->ctx__->detach(*h);
+
+        notify(*h, handle::HDL_MULTI_STOPPED);
+    }
+
+    for (auto& [key, set] : endpoint_sets__)
+        set->multi_handler__ = nullptr;
+    endpoint_sets__.clear();
+
+    timeout__->cancel();
+    bw_timer__->cancel();
+    strg_timer__->cancel();
+    ctx_timer__->cancel();
+    admission_timer__->cancel();
+    ev_timer__->cancel();
+    ev_deferred__.clear();
+    busy_timer__->cancel();
+    busy_events__.clear();
+
+    progress_timer__->cancel();
+    progress_armed__ = false;
+
+    completions_timer__->cancel();
+    completions_flush();
+
+    if (nullptr != curl_multi__) curl_multi_cleanup(curl_multi__);
+    curl_multi__ = nullptr;
+
+    if (CURLM_OK != errCode && cb_error__) cb_error__(errCode);
+}
+
+/**
+ * @brief notify - Call the completion callbacks of a transfer
+ *
+ * @param h The transfer
+ * @param result The result of the transfer (CURLcode or HDL_RetCode)
+ */
+void
+mhandle::notify(handle& h, int result) noexcept
+{
+    auto awaiter{ std::exchange(h.awaiter__, nullptr) };
+
+    // The bytes sent from a buffer (e.g. CURLOPT_POSTFIELDS) do not go through the read callback
+    curl_off_t sent{ -1 };
+    curl_easy_getinfo(static_cast<CURL*>(h.curl_handle__), CURLINFO_SIZE_UPLOAD_T, &sent);
+    h.progress__.finish(result, sent);
+
+    if (h.cb_notify__) h.cb_notify__(result);
+    if (nullptr != h.gather__) gather_completed(h, result);
+    if (h.cb_done__) h.cb_done__(result);
+    else if (nullptr == awaiter && cb_completions__)
+    {
+        try
+        {
+            completions__.push_back({ &h, result });
+            if (1 == std::size(completions__)) completions_timer__->set(0);
+        }
+        catch (const std::bad_alloc&)
+        {
+            // Beyond the room reserved (\see mhandle::completions_reserve) : delivered on its own rather than lost
+            completions_spare__.assign(1, { &h, result });
+            cb_completions__(completions_spare__);
+            completions_spare__.clear();
+        }
     }
+
+    // Last : the coroutine may reuse (or destroy) the transfer
+    if (nullptr != awaiter) awaiter->completed(result);
+}
+
+/**
+ * @brief handle_msgs - Processes messages related to transfers
+ *
+ * Mostly used to inform transfers when they are done :)
+ *
+ * @see https://curl.se/libcurl/c/curl_multi_info_read.html
+ */
+void
+mhandle::handle_msgs(void) noexcept
+{
+    int      dumb;
+    CURLMsg* msg{ nullptr };
+
+    while ((msg = curl_multi_info_read(this->curl_multi__, &dumb)))
+    {
+        if (CURLMSG_DONE != msg->msg) continue;
+
+        CURL* hdl{ msg->easy_handle };
+        auto  it{ handles__.find(hdl) };
+
+        if (std::end(handles__) == it) continue;
+
+        handle*    h{ it->second };
+        const auto result{ msg->data.result }; // msg does not survive the removal of the handle
+
+        if (h->strg_reissue__)
+        {
+            strg_done(*h, result);
+            continue;
+        }
+        if (strg_lost(*h)) continue;
+
+        if (CURLE_OK == result) latency_record(*h);
+        unroute(*h, true, result);
+        remove_handle(*h);
+        notify(*h, result);
+    }
+
+    admit_pending();
 }
 
 /**
@@ -535,7 +3145,8 @@ mhandle::retCode2Str(mhandle::MHDL_RetCode rc) noexcept
         { MHDL_REMOVE_ALREADY, "handle not owned by this session" },
         { MHDL_BAD_HANDLE, "invalid handle" },
         { MHDL_OUT_OF_MEM, "out of memory" },
-        { MHDL_INTERNAL_ERROR, "internal error" }
+        { MHDL_INTERNAL_ERROR, "internal error" },
+        { MHDL_CONTEXT_DONE, "context already cancelled or expired" }
     };
 
     return _retcodeMap.at(rc);
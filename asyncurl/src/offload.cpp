@@ -0,0 +1,402 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/handle.hpp>
+#include <asyncurl/offload.hpp>
+
+#include <miniLoop/Loop.h>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace loop;
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief offload - Constructor
+ *
+ * @param loop The event loop the transfers are handed back to
+ * @param workers The number of worker threads
+ * @param max_queue The maximum number of works handed to the workers and not handed back yet (beyond, they run on
+ * the loop thread)
+ *
+ * @warning The attached transfers must not complete once the offload is destroyed (detach them, or destroy them
+ * first)
+ */
+offload::offload(Loop& loop, size_t workers, size_t max_queue)
+  : max_queue__{ max_queue }
+{
+    if (0 == workers || 0 == max_queue) throw std::invalid_argument("Invalid offload parameters");
+
+    // The jobs handed back never exceed the ones in flight (\see offload::completed) : the workers never allocate to
+    // hand them back
+    done__.reserve(max_queue);
+    returned__.reserve(max_queue);
+
+    efd__ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == efd__) throw std::runtime_error("Unable to create the offload eventfd");
+
+    try
+    {
+        io__ = std::make_unique<Loop::IO>(efd__, loop);
+        io__->onEvent([this](int) { this->drain(); });
+        io__->setRequestedEvents(Loop::IO::READ);
+
+        workers__.reserve(workers);
+        for (size_t i{ 0 }; i < workers; ++i)
+            workers__.emplace_back([this]() { this->worker(); });
+    }
+    catch (...)
+    {
+        shutdown();
+        throw;
+    }
+}
+
+/**
+ * @brief ~offload - Destructor
+ *
+ * The works not started yet are dropped, the running ones are waited for. The return callbacks are not called, and
+ * the attached transfers are left untouched (they may be destroyed already).
+ */
+offload::~offload() noexcept
+{
+    shutdown();
+}
+
+/**
+ * @brief shutdown - Stop the workers and release the eventfd
+ */
+void
+offload::shutdown(void) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock{ mtx__ };
+
+        stopping__ = true;
+        queue__.clear();
+    }
+    cv__.notify_all();
+
+    for (auto& w : workers__)
+        w.join();
+    workers__.clear();
+
+    io__.reset();
+    if (-1 != efd__) close(efd__);
+    efd__ = -1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// TRANSFERS
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief attach - Offload the completion processing of a transfer
+ *
+ * The done callback of the transfer is replaced (and its write callback too, if the body is buffered) : attach it
+ * before adding it to a session. It stays attached across its reuses, until detached.
+ * @param h The transfer
+ * @param work The work run on a worker thread once the transfer completed
+ * @param back The callback run on the loop thread once the work is done (if any)
+ * @param buffer_body Whether the response body is buffered and handed to the work
+ * @return A return code described by the \a OFL_RetCode enumerate
+ */
+offload::OFL_RetCode
+offload::attach(handle& h, const TWork& work, const TCbReturn& back, bool buffer_body) noexcept
+{
+    if (!work) return OFL_BAD_PARAM;
+
+    entry* e{ nullptr };
+    try
+    {
+        auto& slot{ entries__[&h] };
+
+        if (!slot) slot = std::make_unique<entry>();
+        if (slot->busy) return OFL_BUSY;
+
+        slot->work = work;
+        slot->back = back;
+        e          = slot.get();
+    }
+    catch (const std::bad_alloc&)
+    {
+        if (auto it{ entries__.find(&h) }; std::end(entries__) != it && !it->second) entries__.erase(it);
+        return OFL_OUT_OF_MEM;
+    }
+
+    e->h = &h;
+    h.set_cb_done([this, e](int result) { this->completed(*e, result); });
+
+    if (buffer_body)
+    {
+        h.set_cb_write([e](char* data, size_t size) -> size_t {
+            try
+            {
+                e->body.append(data, size);
+            }
+            catch (const std::bad_alloc&)
+            {
+                return 0;
+            }
+            return size;
+        });
+    }
+    else if (e->buffered)
+        h.set_cb_write(nullptr);
+    e->buffered = buffer_body;
+
+    return OFL_OK;
+}
+
+/**
+ * @brief detach - Stop offloading the completion processing of a transfer
+ *
+ * Its done callback (and write callback, if the body was buffered) are reset.
+ * @param h The transfer
+ * @return A return code described by the \a OFL_RetCode enumerate
+ */
+offload::OFL_RetCode
+offload::detach(handle& h) noexcept
+{
+    auto it{ entries__.find(&h) };
+    if (std::end(entries__) == it) return OFL_BAD_PARAM;
+    if (it->second->busy) return OFL_BUSY;
+
+    // The entry is destroyed later : this may be its own return callback
+    try
+    {
+        retired__.push_back(std::move(it->second));
+    }
+    catch (const std::bad_alloc&)
+    {
+        return OFL_OUT_OF_MEM;
+    }
+    entries__.erase(it);
+
+    h.set_cb_done(nullptr);
+    if (retired__.back()->buffered) h.set_cb_write(nullptr);
+
+    return OFL_OK;
+}
+
+/**
+ * @brief completed - Queue the work of a completed transfer (loop thread)
+ *
+ * The work runs right away on the loop thread if max_queue works are in flight already (queued, running, or done
+ * and not handed back yet) : this bounds the jobs handed back between two drains.
+ * @param e The transfer
+ * @param result The result of the transfer
+ */
+void
+offload::completed(entry& e, int result) noexcept
+{
+    job j;
+
+    j.e         = &e;
+    j.result    = result;
+    j.body      = std::move(e.body);
+    j.queued_us = monotonic_us();
+    e.body.clear();
+    e.busy = true;
+
+    bool queued{ false };
+    if (in_flight__ < max_queue__)
+    {
+        std::lock_guard<std::mutex> lock{ mtx__ };
+
+        try
+        {
+            queue__.push_back(std::move(j));
+            queued = true;
+        }
+        catch (const std::bad_alloc&)
+        {
+            // Run on the loop thread, as if the queue was full (j is untouched by a failed push)
+        }
+    }
+    ++in_flight__;
+
+    if (queued)
+    {
+        cv__.notify_one();
+        return;
+    }
+
+    ++overflowed__;
+    if (!run(j))
+    {
+        std::lock_guard<std::mutex> lock{ mtx__ };
+        ++failed__;
+    }
+    j.done_us = monotonic_us();
+    returned(j);
+}
+
+/**
+ * @brief run - Run the work of a transfer
+ *
+ * @param j The job
+ * @return Whether the work succeeded (did not throw)
+ */
+bool
+offload::run(job& j) noexcept
+{
+    try
+    {
+        j.e->work(*j.e->h, j.result, j.body);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief returned - Hand a transfer back, once its work is done (loop thread)
+ *
+ * @param j The job
+ */
+void
+offload::returned(job& j) noexcept
+{
+    const auto delay{ monotonic_us() - j.done_us };
+
+    ++return_delays__;
+    return_delay_sum_us__ += delay;
+    return_delay_max_us__ = std::max(return_delay_max_us__, delay);
+
+    auto& e{ *j.e };
+
+    e.busy = false;
+    --in_flight__;
+
+    if (e.back) e.back(*e.h, j.result);
+}
+
+/**
+ * @brief worker - Run the queued works, until the offload is destroyed (worker threads)
+ */
+void
+offload::worker(void) noexcept
+{
+    for (;;)
+    {
+        job j;
+        {
+            std::unique_lock<std::mutex> lock{ mtx__ };
+
+            cv__.wait(lock, [this]() { return stopping__ || !std::empty(queue__); });
+            if (stopping__) return;
+
+            j = std::move(queue__.front());
+            queue__.pop_front();
+
+            const auto delay{ monotonic_us() - j.queued_us };
+
+            ++dispatched__;
+            ++queue_delays__;
+            queue_delay_sum_us__ += delay;
+            queue_delay_max_us__ = std::max(queue_delay_max_us__, delay);
+        }
+
+        const auto ok{ run(j) };
+        bool       wake{ false };
+        {
+            std::lock_guard<std::mutex> lock{ mtx__ };
+
+            if (!ok) ++failed__;
+            j.done_us = monotonic_us();
+            wake      = std::empty(done__);
+            done__.push_back(std::move(j)); // Never allocates (\see offload::offload)
+        }
+
+        if (wake)
+        {
+            const uint64_t one{ 1 };
+            while (-1 == write(efd__, &one, sizeof(one)) && EINTR == errno)
+                ;
+        }
+    }
+}
+
+/**
+ * @brief drain - Hand back the transfers whose work is done (loop thread, on the eventfd)
+ */
+void
+offload::drain(void) noexcept
+{
+    uint64_t count;
+    while (0 < read(efd__, &count, sizeof(count)))
+        ;
+
+    retired__.clear();
+    {
+        std::lock_guard<std::mutex> lock{ mtx__ };
+        returned__.swap(done__);
+    }
+
+    for (auto& j : returned__)
+        returned(j);
+    returned__.clear();
+}
+
+/**
+ * @brief stats - Get a snapshot of the activity of the offload
+ *
+ * @return The snapshot
+ */
+offload::offload_stats
+offload::stats(void) noexcept
+{
+    std::lock_guard<std::mutex> lock{ mtx__ };
+
+    const auto avg{ [](int64_t sum, uint64_t n) { return (0 == n) ? 0.0 : static_cast<double>(sum) / n; } };
+
+    return { dispatched__,
+             overflowed__,
+             failed__,
+             std::size(queue__),
+             in_flight__,
+             avg(queue_delay_sum_us__, queue_delays__),
+             queue_delay_max_us__,
+             avg(return_delay_sum_us__, return_delays__),
+             return_delay_max_us__ };
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+offload::retCode2Str(offload::OFL_RetCode rc) noexcept
+{
+    static const std::map<OFL_RetCode, std::string> _retcodeMap{ { OFL_OK, "ok" },
+                                                                 { OFL_BAD_PARAM, "bad parameter" },
+                                                                 { OFL_BUSY, "work being processed" },
+                                                                 { OFL_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
@@ -0,0 +1,1034 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/handle.hpp>
+#include <asyncurl/list.hpp>
+#include <asyncurl/mhandle.hpp>
+#include <asyncurl/outbox.hpp>
+
+#include <curl/curl.h>
+#include <miniLoop/Loop.h>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <any>
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace loop;
+
+#define OB_FILE_MAGIC "ACOUTBX1"  // First bytes of a log
+#define OB_RECORD_MAGIC 0x584f424fU // First bytes of a record
+#define OB_GROWTH (1024 * 1024)   // Minimum growth of the log file
+#define OB_MAX_SHIFT 20           // Maximum exponent of the retry backoff
+
+namespace asyncurl
+{
+namespace
+{
+/**
+ * @brief file_header heads the log
+ */
+struct file_header
+{
+    char     magic[8];
+    uint64_t first_id; /*!< Identifiers below it were compacted away */
+};
+
+/**
+ * @brief record_header heads every record (8-bytes aligned) of the log
+ */
+struct record_header
+{
+    uint32_t magic;
+    uint32_t size; /*!< Size of the encoded request */
+    uint64_t id;
+    uint32_t crc;   /*!< CRC-32 of the identifier and of the encoded request */
+    uint8_t  acked; /*!< Not covered by the CRC : written in place once the request is acknowledged */
+    uint8_t  pad[3];
+};
+
+constexpr size_t
+record_size(size_t payload) noexcept
+{
+    return (sizeof(record_header) + payload + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * @brief crc32 - Compute (or continue) a CRC-32 (IEEE 802.3)
+ *
+ * @param crc The CRC of the previous data (0 to start)
+ * @param data The data
+ * @param size The size of the data
+ * @return The CRC
+ */
+uint32_t
+crc32(uint32_t crc, const void* data, size_t size) noexcept
+{
+    static const auto table{ []() {
+        std::array<uint32_t, 256> ret{};
+        for (uint32_t i{ 0 }; i < 256; ++i)
+        {
+            uint32_t c{ i };
+            for (int k{ 0 }; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            ret[i] = c;
+        }
+        return ret;
+    }() };
+
+    auto p{ static_cast<const uint8_t*>(data) };
+
+    crc = ~crc;
+    while (0 < size--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+uint32_t
+record_crc(uint64_t id, const char* payload, size_t size) noexcept
+{
+    return crc32(crc32(0, &id, sizeof(id)), payload, size);
+}
+
+void
+put_string(std::string& out, const std::string& str)
+{
+    const auto size{ static_cast<uint32_t>(std::size(str)) };
+
+    out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.append(str);
+}
+
+bool
+get_string(const char*& cur, const char* end, std::string& str)
+{
+    uint32_t size;
+
+    if (static_cast<size_t>(end - cur) < sizeof(size)) return false;
+    std::memcpy(&size, cur, sizeof(size));
+    cur += sizeof(size);
+
+    if (static_cast<size_t>(end - cur) < size) return false;
+    str.assign(cur, size);
+    cur += size;
+
+    return true;
+}
+
+/**
+ * @brief encode - Serialize a request (may throw std::bad_alloc)
+ */
+std::string
+encode(const outbox::request& req)
+{
+    std::string ret;
+
+    put_string(ret, req.method);
+    put_string(ret, req.url);
+
+    const auto count{ static_cast<uint32_t>(std::size(req.headers)) };
+    ret.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& h : req.headers)
+        put_string(ret, h);
+
+    put_string(ret, req.body);
+    return ret;
+}
+
+/**
+ * @brief decode - Deserialize a request (may throw std::bad_alloc)
+ */
+bool
+decode(const char* cur, size_t size, outbox::request& req)
+{
+    const char* end{ cur + size };
+    uint32_t    count;
+
+    if (!get_string(cur, end, req.method) || !get_string(cur, end, req.url)) return false;
+
+    if (static_cast<size_t>(end - cur) < sizeof(count)) return false;
+    std::memcpy(&count, cur, sizeof(count));
+    cur += sizeof(count);
+
+    req.headers.clear();
+    for (uint32_t i{ 0 }; i < count; ++i)
+    {
+        if (!get_string(cur, end, req.headers.emplace_back())) return false;
+    }
+
+    return get_string(cur, end, req.body);
+}
+
+/**
+ * @brief sync_dir - Make the entries of the directory of a file durable (creation, rename)
+ */
+bool
+sync_dir(const std::string& path) noexcept
+{
+    const auto  slash{ path.find_last_of('/') };
+    std::string dir;
+
+    try
+    {
+        dir = (std::string::npos == slash) ? "." : (0 == slash ? "/" : path.substr(0, slash));
+    }
+    catch (const std::bad_alloc&)
+    {
+        return false;
+    }
+
+    int fd{ ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+    if (0 > fd) return false;
+
+    const bool ret{ 0 == ::fsync(fd) };
+    ::close(fd);
+    return ret;
+}
+
+} // namespace
+
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief outbox - Constructor
+ *
+ * @param loop The event loop driving the commits and the retries
+ * @param session The session delivering the requests
+ * @param commit_interval_ms The maximum time an appended request waits for its commit (milliseconds) - 0 commits at
+ * the next loop iteration
+ * @param max_in_flight The maximum number of requests being delivered at once
+ *
+ * @warning The session should outlive the outbox
+ */
+outbox::outbox(Loop& loop, mhandle& session, long commit_interval_ms, size_t max_in_flight)
+  : session__{ session }
+  , max_in_flight__{ max_in_flight }
+  , commit_interval_ms__{ commit_interval_ms }
+{
+    if (0 > commit_interval_ms || 0 == max_in_flight) throw std::invalid_argument("Invalid outbox parameters");
+
+    commit_timer__ = std::make_unique<Loop::Timeout>(loop);
+    commit_timer__->onTimeout([this]() {
+        this->commit_armed__ = false;
+        this->recycle();
+        if (OB_OK != this->commit()) return;
+
+        const auto dead{ this->write_pos__ - sizeof(file_header) - this->live_bytes__ };
+        if (dead >= this->compact_min__ && dead > this->live_bytes__) this->compact();
+    });
+
+    retry_timer__ = std::make_unique<Loop::Timeout>(loop);
+    retry_timer__->onTimeout([this]() {
+        this->recycle();
+        this->retry_tick();
+    });
+}
+
+/**
+ * @brief ~outbox - Destructor
+ *
+ * The log is committed and closed. The requests being delivered are removed from the session : not acknowledged, they
+ * will be replayed when the log is opened again.
+ */
+outbox::~outbox() noexcept
+{
+    close();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// LOG
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief open - Open (or create) a log, and replay its requests not acknowledged yet
+ *
+ * @param path The path of the log
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::open(const std::string& path) noexcept
+{
+    if (is_open()) return OB_ALREADY_OPEN;
+    if (std::empty(path)) return OB_BAD_PARAM;
+
+    try
+    {
+        path__ = path;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return OB_OUT_OF_MEM;
+    }
+
+    fd__ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (0 > fd__) return OB_IO_ERROR;
+
+    struct stat st;
+    if (0 != ::fstat(fd__, &st))
+    {
+        close();
+        return OB_IO_ERROR;
+    }
+
+    appended__ = replayed__ = commits__ = delivered__ = retries__ = compacted__ = 0;
+    next_id__                                                                  = 1;
+    live_bytes__                                                               = 0;
+
+    OB_RetCode ret{ OB_OK };
+    if (0 == st.st_size)
+    {
+        // New log : its header (and its directory entry) must be durable before any record
+        if (OB_OK != (ret = reserve(sizeof(file_header))))
+        {
+            close();
+            return ret;
+        }
+
+        file_header hdr{};
+        std::memcpy(hdr.magic, OB_FILE_MAGIC, sizeof(hdr.magic));
+        hdr.first_id = next_id__;
+        std::memcpy(map__, &hdr, sizeof(hdr));
+        write_pos__ = sizeof(hdr);
+
+        if (0 != ::msync(map__, sizeof(hdr), MS_SYNC) || !sync_dir(path__))
+        {
+            close();
+            return OB_IO_ERROR;
+        }
+        return OB_OK;
+    }
+
+    void* map{ ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd__, 0) };
+    if (MAP_FAILED == map)
+    {
+        close();
+        return OB_IO_ERROR;
+    }
+    map__      = static_cast<char*>(map);
+    capacity__ = static_cast<size_t>(st.st_size);
+
+    if (OB_OK != (ret = replay()))
+    {
+        close();
+        return ret;
+    }
+
+    pump();
+    return OB_OK;
+}
+
+/**
+ * @brief replay - Rebuild the requests not acknowledged yet out of the log
+ *
+ * The log ends at the first invalid record (torn by a crash) : the rest of the file is discarded.
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::replay(void) noexcept
+{
+    file_header hdr;
+
+    if (capacity__ < sizeof(hdr)) return OB_BAD_FORMAT;
+    std::memcpy(&hdr, map__, sizeof(hdr));
+    if (0 != std::memcmp(hdr.magic, OB_FILE_MAGIC, sizeof(hdr.magic))) return OB_BAD_FORMAT;
+
+    next_id__ = std::max<uint64_t>(1, hdr.first_id);
+
+    size_t pos{ sizeof(hdr) };
+    try
+    {
+        for (record_header rec; capacity__ - pos >= sizeof(rec); pos += record_size(rec.size))
+        {
+            std::memcpy(&rec, map__ + pos, sizeof(rec));
+            if (OB_RECORD_MAGIC != rec.magic || capacity__ - pos < record_size(rec.size)) break;
+            if (rec.crc != record_crc(rec.id, map__ + pos + sizeof(rec), rec.size)) break;
+
+            next_id__ = std::max(next_id__, rec.id + 1);
+            if (0 != rec.acked) continue;
+
+            auto e{ std::make_unique<entry>() };
+            e->id     = rec.id;
+            e->offset = pos;
+            e->size   = record_size(rec.size);
+            e->state  = ENTRY_READY;
+
+            ready__.push_back(e.get());
+            live_bytes__ += e->size;
+            entries__.emplace(rec.id, std::move(e));
+            ++replayed__;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return OB_OUT_OF_MEM;
+    }
+
+    // Drop the tail (torn record, preallocated space) : the next records must not be followed by stale data
+    write_pos__ = pos;
+    if (pos != capacity__)
+    {
+        ::munmap(map__, capacity__);
+        map__      = nullptr;
+        capacity__ = 0;
+
+        if (0 != ::ftruncate(fd__, static_cast<off_t>(pos)) || 0 != ::fsync(fd__)) return OB_IO_ERROR;
+
+        void* map{ ::mmap(nullptr, pos, PROT_READ | PROT_WRITE, MAP_SHARED, fd__, 0) };
+        if (MAP_FAILED == map) return OB_IO_ERROR;
+        map__      = static_cast<char*>(map);
+        capacity__ = pos;
+    }
+
+    return OB_OK;
+}
+
+/**
+ * @brief reserve - Grow the log so that it can hold more bytes after its last record
+ *
+ * @param size The number of bytes
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::reserve(size_t size) noexcept
+{
+    if (capacity__ - write_pos__ >= size) return OB_OK;
+
+    const auto page{ static_cast<size_t>(::sysconf(_SC_PAGESIZE)) };
+    auto       capacity{ std::max({ capacity__ * 2, write_pos__ + size, capacity__ + OB_GROWTH }) };
+    capacity = (capacity + page - 1) / page * page;
+
+    if (0 != ::ftruncate(fd__, static_cast<off_t>(capacity))) return OB_IO_ERROR;
+
+    void* map{ ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd__, 0) };
+    if (MAP_FAILED == map) return OB_IO_ERROR;
+
+    // The dirty pages belong to the file : they survive the unmapping, and are flushed by the next commit
+    if (nullptr != map__) ::munmap(map__, capacity__);
+    map__      = static_cast<char*>(map);
+    capacity__ = capacity;
+
+    return OB_OK;
+}
+
+/**
+ * @brief dirty - Account for a modification of the mapping, to be flushed by the next commit
+ *
+ * @param offset The offset of the modification
+ * @param size The size of the modification
+ */
+void
+outbox::dirty(size_t offset, size_t size) noexcept
+{
+    if (dirty_lo__ == dirty_hi__)
+    {
+        dirty_lo__ = offset;
+        dirty_hi__ = offset + size;
+    }
+    else
+    {
+        dirty_lo__ = std::min(dirty_lo__, offset);
+        dirty_hi__ = std::max(dirty_hi__, offset + size);
+    }
+
+    arm_commit();
+}
+
+/**
+ * @brief close - Commit and close the log
+ */
+void
+outbox::close(void) noexcept
+{
+    commit_timer__->cancel();
+    retry_timer__->cancel();
+    commit_armed__ = false;
+
+    for (auto& [id, e] : entries__)
+    {
+        if (ENTRY_RUNNING == e->state) session__.remove_handle(*e->h);
+    }
+
+    if (nullptr != map__)
+    {
+        if (dirty_lo__ != dirty_hi__) ::msync(map__, capacity__, MS_SYNC);
+        ::munmap(map__, capacity__);
+    }
+    if (0 <= fd__) ::close(fd__);
+
+    fd__         = -1;
+    map__        = nullptr;
+    capacity__   = 0;
+    write_pos__  = 0;
+    dirty_lo__   = 0;
+    dirty_hi__   = 0;
+    in_flight__  = 0;
+    ready_head__ = 0;
+    entries__.clear();
+    uncommitted__.clear();
+    ready__.clear();
+    backoff__.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// APPEND/COMMIT
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief append - Append a request to the log
+ *
+ * The request is dispatched once durable, at the next group commit (\see outbox::commit).
+ * @param req The request
+ * @param id The identifier of the request (if not null)
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::append(const request& req, uint64_t* id) noexcept
+{
+    if (!is_open()) return OB_NOT_OPEN;
+    if (std::empty(req.url)) return OB_BAD_PARAM;
+
+    std::string            payload;
+    std::unique_ptr<entry> e;
+    try
+    {
+        payload = encode(req);
+        e       = std::make_unique<entry>();
+        uncommitted__.reserve(std::size(uncommitted__) + 1);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return OB_OUT_OF_MEM;
+    }
+    if (std::size(payload) > UINT32_MAX) return OB_BAD_PARAM;
+
+    const auto size{ record_size(std::size(payload)) };
+    if (auto ret{ reserve(size) }; OB_OK != ret) return ret;
+
+    e->id     = next_id__;
+    e->offset = write_pos__;
+    e->size   = size;
+    try
+    {
+        entries__.emplace(e->id, std::move(e));
+    }
+    catch (const std::bad_alloc&)
+    {
+        return OB_OUT_OF_MEM;
+    }
+
+    auto&         ent{ *entries__[next_id__] };
+    record_header rec{};
+    rec.magic = OB_RECORD_MAGIC;
+    rec.size  = static_cast<uint32_t>(std::size(payload));
+    rec.id    = ent.id;
+    rec.crc   = record_crc(ent.id, payload.data(), std::size(payload));
+
+    std::memcpy(map__ + write_pos__, &rec, sizeof(rec));
+    std::memcpy(map__ + write_pos__ + sizeof(rec), payload.data(), std::size(payload));
+    dirty(write_pos__, size);
+
+    uncommitted__.push_back(&ent);
+    write_pos__ += size;
+    live_bytes__ += size;
+    ++next_id__;
+    ++appended__;
+
+    if (nullptr != id) *id = ent.id;
+    return OB_OK;
+}
+
+/**
+ * @brief commit - Make the appended requests (and the acknowledgements) durable, then dispatch the requests
+ *
+ * Called by the commit timer : only needed to commit before the end of the commit interval.
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::commit(void) noexcept
+{
+    if (!is_open()) return OB_NOT_OPEN;
+
+    if (dirty_lo__ != dirty_hi__)
+    {
+        const auto page{ static_cast<size_t>(::sysconf(_SC_PAGESIZE)) };
+        const auto lo{ dirty_lo__ / page * page };
+
+        if (0 != ::msync(map__ + lo, dirty_hi__ - lo, MS_SYNC))
+        {
+            arm_commit(); // Retried at the next interval
+            return OB_IO_ERROR;
+        }
+
+        dirty_lo__ = dirty_hi__ = 0;
+        ++commits__;
+    }
+
+    try
+    {
+        ready__.reserve(std::size(ready__) + std::size(uncommitted__));
+    }
+    catch (const std::bad_alloc&)
+    {
+        arm_commit();
+        return OB_OUT_OF_MEM;
+    }
+
+    for (auto e : uncommitted__)
+    {
+        e->state = ENTRY_READY;
+        ready__.push_back(e);
+    }
+    uncommitted__.clear();
+
+    pump();
+    return OB_OK;
+}
+
+/**
+ * @brief arm_commit - Schedule the next group commit (if not yet)
+ */
+void
+outbox::arm_commit(void) noexcept
+{
+    if (commit_armed__) return;
+
+    commit_armed__ = true;
+    commit_timer__->set(commit_interval_ms__);
+}
+
+/**
+ * @brief compact - Rewrite the log without the acknowledged requests
+ *
+ * The compacted log is written aside, made durable, then atomically renamed over the log.
+ * Called by the commit timer once the acknowledged requests make up most of the log (\see outbox::set_compaction).
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::compact(void) noexcept
+{
+    if (!is_open()) return OB_NOT_OPEN;
+    if (auto ret{ commit() }; OB_OK != ret) return ret;
+
+    std::string         tmp;
+    std::vector<size_t> offsets;
+    try
+    {
+        tmp = path__ + ".compact";
+        offsets.reserve(std::size(entries__));
+    }
+    catch (const std::bad_alloc&)
+    {
+        return OB_OUT_OF_MEM;
+    }
+
+    const auto size{ sizeof(file_header) + live_bytes__ };
+    int        fd{ ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) };
+    if (0 > fd) return OB_IO_ERROR;
+
+    void* map{ MAP_FAILED };
+    if (0 == ::ftruncate(fd, static_cast<off_t>(size)))
+        map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == map)
+    {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        return OB_IO_ERROR;
+    }
+
+    auto        out{ static_cast<char*>(map) };
+    file_header hdr{};
+    std::memcpy(hdr.magic, OB_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.first_id = next_id__;
+    std::memcpy(out, &hdr, sizeof(hdr));
+
+    size_t pos{ sizeof(hdr) };
+    for (const auto& [id, e] : entries__)
+    {
+        std::memcpy(out + pos, map__ + e->offset, e->size);
+        offsets.push_back(pos);
+        pos += e->size;
+    }
+
+    if (0 != ::msync(out, size, MS_SYNC) || 0 != ::rename(tmp.c_str(), path__.c_str()))
+    {
+        ::munmap(out, size);
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        return OB_IO_ERROR;
+    }
+    sync_dir(path__); // At worst, the uncompacted log is found again after a crash
+
+    ::munmap(map__, capacity__);
+    ::close(fd__);
+    fd__        = fd;
+    map__       = out;
+    capacity__  = size;
+    write_pos__ = size;
+
+    size_t i{ 0 };
+    for (auto& [id, e] : entries__)
+        e->offset = offsets[i++];
+
+    ++compacted__;
+    return OB_OK;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// DELIVERY
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief pump - Dispatch the ready requests, as long as delivery slots are available
+ */
+void
+outbox::pump(void) noexcept
+{
+    // An attempt may complete while being added : the outer call does the job
+    if (pumping__) return;
+
+    pumping__ = true;
+    while (in_flight__ < max_in_flight__ && ready_head__ < std::size(ready__))
+        launch(*ready__[ready_head__++]);
+
+    if (ready_head__ == std::size(ready__))
+    {
+        ready__.clear();
+        ready_head__ = 0;
+    }
+    pumping__ = false;
+}
+
+/**
+ * @brief launch - Build the transfer of a request and add it to the session
+ *
+ * @param e The request
+ */
+void
+outbox::launch(entry& e) noexcept
+{
+    const auto id{ e.id };
+
+    e.state = ENTRY_RUNNING;
+    ++e.attempts;
+    ++in_flight__;
+
+    request req;
+    bool    built{ false };
+    try
+    {
+        if (!e.h && !std::empty(pool__))
+        {
+            e.h = std::move(pool__.back());
+            pool__.pop_back();
+        }
+        if (!e.h) e.h = std::make_unique<handle>();
+
+        const auto& rec{ *reinterpret_cast<const record_header*>(map__ + e.offset) };
+        built = decode(map__ + e.offset + sizeof(rec), rec.size, req);
+    }
+    catch (...)
+    {
+        built = false;
+    }
+
+    if (built)
+    {
+        auto&      h{ *e.h };
+        const bool post{ !std::empty(req.body) || "POST" == req.method };
+
+        h.set_cb_write([](char*, size_t size) -> size_t { return size; });
+        h.set_cb_done([this, id](int result) { this->completed(id, result); });
+
+        built = handle::HDL_OK == h.set_opt(CURLOPT_URL, req.url);
+        if (built && post)
+        {
+            built = handle::HDL_OK == h.set_opt(CURLOPT_POSTFIELDSIZE, static_cast<long>(std::size(req.body))) &&
+                    handle::HDL_OK == h.set_opt(CURLOPT_COPYPOSTFIELDS, static_cast<void*>(req.body.data()));
+        }
+        if (built && req.method != (post ? "POST" : "GET"))
+            built = handle::HDL_OK == h.set_opt(CURLOPT_CUSTOMREQUEST, req.method);
+
+        try
+        {
+            if (built && !std::empty(req.headers))
+            {
+                list headers;
+                for (const auto& hdr : req.headers)
+                    headers.push_back(hdr);
+                built = handle::HDL_OK == h.set_opt(CURLOPT_HTTPHEADER, headers);
+            }
+            if (built && configure__) configure__(h, req);
+        }
+        catch (...)
+        {
+            built = false;
+        }
+    }
+
+    if (!built || mhandle::MHDL_OK != session__.add_handle(*e.h)) completed(id, CURLE_FAILED_INIT);
+}
+
+/**
+ * @brief completed - Account for the completion of a delivery attempt
+ *
+ * The request is acknowledged if it was delivered (2xx or 3xx response) or definitively rejected (4xx response, but
+ * 408 and 429). It is retried after a backoff otherwise.
+ * @param id The identifier of the request
+ * @param result The result of the transfer
+ */
+void
+outbox::completed(uint64_t id, int result) noexcept
+{
+    auto it{ entries__.find(id) };
+    if (std::end(entries__) == it || ENTRY_RUNNING != it->second->state) return;
+
+    auto& e{ *it->second };
+    long  response_code{ 0 };
+
+    --in_flight__;
+    if (CURLE_OK == result)
+    {
+        if (auto info{ e.h->get_info(CURLINFO_RESPONSE_CODE) }; handle::HDL_OK == info.ret)
+            response_code = std::any_cast<long>(info.value);
+    }
+
+    // This may be the done callback of the handle : it is recycled later, out of any callback
+    // (there is none if it could not be allocated, \see outbox::launch)
+    if (e.h)
+    {
+        try
+        {
+            spent__.push_back(std::move(e.h));
+        }
+        catch (const std::bad_alloc&)
+        {
+            gc__ = std::move(e.h);
+        }
+    }
+
+    const bool rejected{ 400 <= response_code && response_code < 500 && 408 != response_code && 429 != response_code };
+    if (CURLE_OK == result && (response_code < 400 || rejected))
+    {
+        acknowledge(e, result, response_code);
+    }
+    else
+    {
+        const auto shift{ std::min<long>(e.attempts - 1, OB_MAX_SHIFT) };
+        const auto delay_ms{ std::min(retry_max_ms__, retry_ms__ << shift) };
+
+        ++retries__;
+        e.state  = ENTRY_BACKOFF;
+        e.due_us = monotonic_us() + static_cast<int64_t>(delay_ms) * 1000;
+        try
+        {
+            backoff__.emplace(e.due_us, id);
+        }
+        catch (const std::bad_alloc&)
+        {
+            e.state = ENTRY_READY; // Retried right away
+            ready__.push_back(&e);
+        }
+        arm_retry();
+    }
+
+    pump();
+}
+
+/**
+ * @brief acknowledge - Mark a request as acknowledged in the log (made durable by the next commit), and forget it
+ *
+ * @param e The request
+ * @param code The result of its last transfer
+ * @param response_code The last response code of its last transfer
+ */
+void
+outbox::acknowledge(entry& e, int code, long response_code) noexcept
+{
+    const auto id{ e.id };
+    const auto acked{ e.offset + offsetof(record_header, acked) };
+
+    map__[acked] = 1;
+    dirty(acked, 1);
+
+    live_bytes__ -= e.size;
+    ++delivered__;
+    entries__.erase(id);
+
+    if (cb_delivered__) cb_delivered__(id, code, response_code);
+}
+
+/**
+ * @brief arm_retry - Arm the retry timer on the earliest retry
+ */
+void
+outbox::arm_retry(void) noexcept
+{
+    if (std::empty(backoff__))
+    {
+        retry_timer__->cancel();
+        return;
+    }
+
+    const auto delay_us{ std::begin(backoff__)->first - monotonic_us() };
+    retry_timer__->set(std::max<int64_t>(0, (delay_us + 999) / 1000));
+}
+
+/**
+ * @brief retry_tick - Make the requests whose backoff expired ready again
+ */
+void
+outbox::retry_tick(void) noexcept
+{
+    const auto now{ monotonic_us() };
+
+    while (!std::empty(backoff__) && std::begin(backoff__)->first <= now)
+    {
+        const auto id{ std::begin(backoff__)->second };
+        backoff__.erase(std::begin(backoff__));
+
+        if (auto it{ entries__.find(id) }; std::end(entries__) != it)
+        {
+            try
+            {
+                ready__.push_back(it->second.get());
+                it->second->state = ENTRY_READY;
+            }
+            catch (const std::bad_alloc&)
+            {
+                it->second->due_us = now + 1000 * 1000; // Retried later
+                backoff__.emplace(it->second->due_us, id);
+                break;
+            }
+        }
+    }
+
+    arm_retry();
+    pump();
+}
+
+/**
+ * @brief recycle - Make the handles of the completed attempts available again
+ *
+ * Called from the timers only : the done callbacks of these handles are over.
+ */
+void
+outbox::recycle(void) noexcept
+{
+    gc__.reset();
+
+    while (!std::empty(spent__))
+    {
+        auto h{ std::move(spent__.back()) };
+        spent__.pop_back();
+
+        h->reset();
+        if (std::size(pool__) < max_in_flight__)
+        {
+            try
+            {
+                pool__.push_back(std::move(h));
+            }
+            catch (const std::bad_alloc&)
+            {
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// SETTINGS
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_retry - Set the backoff of the failed requests
+ *
+ * The delay doubles after every failed attempt.
+ * @param retry_ms The delay before the first retry (milliseconds)
+ * @param retry_max_ms The maximum delay between two attempts (milliseconds)
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::set_retry(long retry_ms, long retry_max_ms) noexcept
+{
+    if (0 >= retry_ms || retry_max_ms < retry_ms || retry_max_ms > LONG_MAX >> OB_MAX_SHIFT) return OB_BAD_PARAM;
+
+    retry_ms__     = retry_ms;
+    retry_max_ms__ = retry_max_ms;
+    return OB_OK;
+}
+
+/**
+ * @brief set_compaction - Set the threshold of the compaction
+ *
+ * The log is compacted once the acknowledged requests weigh more than the threshold, and more than the live ones.
+ * @param min_bytes The threshold (bytes)
+ * @return A return code described by the \a OB_RetCode enumerate
+ */
+outbox::OB_RetCode
+outbox::set_compaction(size_t min_bytes) noexcept
+{
+    if (0 == min_bytes) return OB_BAD_PARAM;
+
+    compact_min__ = min_bytes;
+    return OB_OK;
+}
+
+/**
+ * @brief stats - Get a snapshot of the state of the outbox
+ *
+ * @return The snapshot
+ */
+outbox::outbox_stats
+outbox::stats(void) const noexcept
+{
+    return { std::size(entries__),
+             in_flight__,
+             appended__,
+             replayed__,
+             commits__,
+             delivered__,
+             retries__,
+             compacted__,
+             (0 < write_pos__) ? write_pos__ - sizeof(file_header) : 0,
+             live_bytes__ };
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+outbox::retCode2Str(outbox::OB_RetCode rc) noexcept
+{
+    static const std::map<OB_RetCode, std::string> _retcodeMap{ { OB_OK, "ok" },
+                                                                { OB_BAD_PARAM, "bad parameter" },
+                                                                { OB_NOT_OPEN, "no log open" },
+                                                                { OB_ALREADY_OPEN, "a log is already open" },
+                                                                { OB_BAD_FORMAT, "not an outbox log" },
+                                                                { OB_IO_ERROR, "log i/o error" },
+                                                                { OB_OUT_OF_MEM, "out of memory" } };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
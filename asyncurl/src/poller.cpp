@@ -0,0 +1,387 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/handle.hpp>
+#include <asyncurl/mhandle.hpp>
+#include <asyncurl/poller.hpp>
+
+#include <curl/curl.h>
+#include <miniLoop/Loop.h>
+
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using namespace loop;
+
+#define PLR_SPREAD_RATIO 0.6180339887498949 // Golden ratio conjugate : low-discrepancy spreading of the first polls
+#define PLR_MAX_BACKOFF_SHIFT 30
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// CONSTRUCTORS/DESTRUCTOR
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief poller - Constructor
+ *
+ * The wheel covers tick_ms * slots milliseconds : longer intervals are supported, but their entries are visited once
+ * per wheel revolution.
+ * @param loop The event loop driving the poller
+ * @param session The session the polls are performed by
+ * @param tick_ms The resolution of the scheduling (milliseconds)
+ * @param slots The number of slots of the timing wheel
+ */
+poller::poller(Loop& loop, mhandle& session, long tick_ms, size_t slots)
+  : session__{ session }
+  , wheel__(slots, nullptr)
+  , tick_us__{ static_cast<int64_t>(tick_ms) * 1000 }
+  , origin_us__{ monotonic_us() }
+{
+    if (tick_ms <= 0 || 0 == slots) throw std::invalid_argument("Invalid poller wheel");
+
+    timer__ = std::make_unique<Loop::Timeout>(loop);
+    timer__->onTimeout([this]() {
+        this->armed__ = false;
+        this->tick();
+    });
+}
+
+/**
+ * @brief ~poller - Destructor
+ *
+ * The polls currently running are not interrupted, but they will not be rescheduled.
+ */
+poller::~poller() noexcept
+{
+    timer__->cancel();
+
+    for (auto& [h, e] : entries__)
+    {
+        h->cb_notify__ = nullptr;
+        h->poller__    = nullptr;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// REGISTRATION
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief add - Poll a transfer periodically
+ *
+ * The first poll is spread over the interval (the successive registrations fill the interval evenly), then the
+ * transfer is re-added to the session every interval_ms, plus a random delay in [0, jitter_ms].
+ * The done callback of the handle is called after every poll.
+ * @param h The handle to poll (it must not be owned by a session)
+ * @param interval_ms The polling interval (milliseconds)
+ * @param jitter_ms The maximum random delay added to every poll (milliseconds)
+ * @return A return code described by the \a PLR_RetCode enumerate
+ */
+poller::PLR_RetCode
+poller::add(handle& h, long interval_ms, long jitter_ms) noexcept
+{
+    if (interval_ms <= 0 || jitter_ms < 0) return PLR_BAD_PARAM;
+    if (this == h.poller__) return PLR_ALREADY;
+    if (nullptr != h.poller__ || nullptr != h.multi_handler__) return PLR_OWNED;
+
+    entry* e{ nullptr };
+    try
+    {
+        auto& slot{ entries__[&h] };
+        slot = std::make_unique<entry>();
+        e    = slot.get();
+
+        // A tick fires each entry at most once : it never allocates (\see poller::tick)
+        fired__.reserve(std::size(entries__));
+
+        h.cb_notify__ = [this, e](int result) { this->completed(*e, result); };
+    }
+    catch (const std::bad_alloc&)
+    {
+        entries__.erase(&h);
+        return PLR_OUT_OF_MEM;
+    }
+
+    const auto now{ monotonic_us() };
+    const auto phase{ std::fmod(static_cast<double>(sequence__++) * PLR_SPREAD_RATIO, 1.0) };
+
+    e->h           = &h;
+    e->interval_ms = interval_ms;
+    e->jitter_ms   = jitter_ms;
+    e->nominal_us  = now + static_cast<int64_t>(phase * static_cast<double>(interval_ms) * 1000);
+    h.poller__     = this;
+
+    schedule(*e, now);
+    return PLR_OK;
+}
+
+/**
+ * @brief remove - Stop polling a transfer
+ *
+ * If a poll is running, it is not interrupted (\see mhandle::remove_handle) but it will not be rescheduled.
+ * @param h The polled handle
+ * @return A return code described by the \a PLR_RetCode enumerate
+ */
+poller::PLR_RetCode
+poller::remove(handle& h) noexcept
+{
+    if (this != h.poller__) return PLR_UNKNOWN;
+
+    auto it{ entries__.find(&h) };
+    if (std::end(entries__) == it) return PLR_UNKNOWN;
+
+    auto& e{ *it->second };
+    if (e.scheduled) unschedule(e);
+    if (0 < e.failures) --backed_off__;
+
+    h.cb_notify__ = nullptr;
+    h.poller__    = nullptr;
+    entries__.erase(it);
+
+    return PLR_OK;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// OPTIONS
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief set_backoff - Set the backoff policy of the failing transfers
+ *
+ * After n consecutive failures (curl error or HTTP 5xx response), a transfer is polled every interval * 2^n, up to
+ * interval * max_factor. A successful poll restores the nominal interval.
+ * @param max_factor The maximum factor applied to the interval (1 disables the backoff)
+ * @return A return code described by the \a PLR_RetCode enumerate
+ */
+poller::PLR_RetCode
+poller::set_backoff(long max_factor) noexcept
+{
+    if (max_factor < 1) return PLR_BAD_PARAM;
+
+    backoff_max__ = max_factor;
+    return PLR_OK;
+}
+
+/**
+ * @brief stats - Get a snapshot of the state of the poller
+ *
+ * The schedule lag is the delay between the time a poll was due and the time it was actually handed to the session.
+ * @return The state of the poller
+ */
+poller::poller_stats
+poller::stats(void) const noexcept
+{
+    return { std::size(entries__),
+             std::size(entries__) - scheduled__,
+             backed_off__,
+             polls__,
+             failures__,
+             late__,
+             (0 == polls__) ? 0 : lag_sum_us__ / static_cast<int64_t>(polls__),
+             lag_max_us__ };
+}
+
+/**
+ * @brief reset_stats - Reset the counters reported by \a stats
+ */
+void
+poller::reset_stats(void) noexcept
+{
+    polls__      = 0;
+    failures__   = 0;
+    late__       = 0;
+    lag_sum_us__ = 0;
+    lag_max_us__ = 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// TIMING WHEEL
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief schedule - Insert an entry in the wheel, at its nominal time plus a random jitter
+ *
+ * @param e The entry
+ * @param now_us The current monotonic time (microseconds)
+ */
+void
+poller::schedule(entry& e, int64_t now_us) noexcept
+{
+    // An idle wheel does not tick : skip the elapsed slots instead of walking them at the next tick
+    if (0 == scheduled__) cursor__ = std::max(cursor__, (now_us - origin_us__) / tick_us__);
+
+    e.due_us = e.nominal_us;
+    if (0 < e.jitter_ms) e.due_us += std::uniform_int_distribution<int64_t>(0, e.jitter_ms * 1000)(rng__);
+
+    e.due_tick = std::max((e.due_us - origin_us__ + tick_us__ - 1) / tick_us__, cursor__ + 1);
+
+    auto& head{ wheel__[static_cast<size_t>(e.due_tick) % std::size(wheel__)] };
+    e.prev = nullptr;
+    e.next = head;
+    if (nullptr != head) head->prev = &e;
+    head = &e;
+
+    e.scheduled = true;
+    ++scheduled__;
+
+    arm(now_us);
+}
+
+/**
+ * @brief unschedule - Remove an entry from the wheel
+ *
+ * @param e The entry
+ */
+void
+poller::unschedule(entry& e) noexcept
+{
+    auto& head{ wheel__[static_cast<size_t>(e.due_tick) % std::size(wheel__)] };
+
+    (nullptr != e.prev ? e.prev->next : head) = e.next;
+    if (nullptr != e.next) e.next->prev = e.prev;
+
+    e.prev      = nullptr;
+    e.next      = nullptr;
+    e.scheduled = false;
+    --scheduled__;
+}
+
+/**
+ * @brief arm - Arm the wheel timer for the next tick (if there is anything to poll)
+ *
+ * @param now_us The current monotonic time (microseconds)
+ */
+void
+poller::arm(int64_t now_us) noexcept
+{
+    if (armed__ || 0 == scheduled__) return;
+
+    const auto next_us{ origin_us__ + (cursor__ + 1) * tick_us__ };
+
+    armed__ = true;
+    timer__->set(std::max<long>(1, static_cast<long>((next_us - now_us + 999) / 1000)));
+}
+
+/**
+ * @brief tick - Start the polls of the elapsed slots
+ */
+void
+poller::tick(void) noexcept
+{
+    const auto now{ monotonic_us() };
+    const auto target{ (now - origin_us__) / tick_us__ };
+
+    // Collect first : starting a poll calls back user code, which may add or remove polled transfers
+    fired__.clear();
+    const auto steps{ std::min<int64_t>(target - cursor__, static_cast<int64_t>(std::size(wheel__))) };
+    for (int64_t i{ 1 }; i <= steps; ++i)
+    {
+        for (auto e{ wheel__[static_cast<size_t>(cursor__ + i) % std::size(wheel__)] }; nullptr != e;)
+        {
+            auto next{ e->next };
+            if (e->due_tick <= target)
+            {
+                unschedule(*e);
+                fired__.push_back(e->h); // Never allocates (\see poller::add)
+            }
+            e = next;
+        }
+    }
+    cursor__ = std::max(cursor__, target);
+
+    // Indexed : the transfers added meanwhile (\see poller::add) may move the list
+    for (size_t i{ 0 }; i < std::size(fired__); ++i)
+    {
+        auto h{ fired__[i] };
+        auto it{ entries__.find(h) };
+        if (std::end(entries__) == it || it->second->scheduled) continue; // Removed (or re-added) meanwhile
+
+        auto&      e{ *it->second };
+        const auto lag{ std::max<int64_t>(0, now - e.due_us) };
+
+        ++polls__;
+        lag_sum_us__ += lag;
+        lag_max_us__ = std::max(lag_max_us__, lag);
+        if (lag > tick_us__) ++late__;
+
+        switch (session__.add_handle(*h))
+        {
+            case mhandle::MHDL_OK: break;
+            case mhandle::MHDL_ADD_ALREADY: // The previous poll is still running : try again at the next interval
+                completed(e, CURLE_OK);
+                break;
+            default: completed(e, CURLE_FAILED_INIT); break;
+        }
+    }
+
+    arm(monotonic_us());
+}
+
+/**
+ * @brief completed - Reschedule a transfer after a poll
+ *
+ * @param e The entry of the transfer
+ * @param result The result of the poll (CURLcode or HDL_MULTI_STOPPED)
+ */
+void
+poller::completed(entry& e, int result) noexcept
+{
+    if (e.scheduled) return;
+
+    long code{ 0 };
+    if (CURLE_OK == result) e.h->get_info_long(CURLINFO_RESPONSE_CODE, code);
+
+    if (CURLE_OK != result || code >= 500)
+    {
+        ++failures__;
+        if (0 == e.failures++) ++backed_off__;
+    }
+    else if (0 < e.failures)
+    {
+        e.failures = 0;
+        --backed_off__;
+    }
+
+    const auto shift{ std::min<long>(e.failures, PLR_MAX_BACKOFF_SHIFT) };
+    const auto factor{ std::min<int64_t>(int64_t{ 1 } << shift, backoff_max__) };
+    const auto step_us{ static_cast<int64_t>(e.interval_ms) * 1000 * factor };
+    const auto now{ monotonic_us() };
+
+    // Keep the phase of the transfer : a poll outlasting its interval skips the missed periods
+    e.nominal_us += step_us;
+    if (e.nominal_us <= now) e.nominal_us += ((now - e.nominal_us) / step_us + 1) * step_us;
+
+    schedule(e, now);
+}
+
+/**
+ * @brief retCode2Str - Gives a human readable string for each retcodes
+ *
+ * @param rc The retcode
+ * @return A human-readable representation of the retcode meaning
+ */
+std::string_view
+poller::retCode2Str(poller::PLR_RetCode rc) noexcept
+{
+    static const std::map<PLR_RetCode, std::string> _retcodeMap{
+        { PLR_OK, "ok" },
+        { PLR_BAD_PARAM, "bad parameter" },
+        { PLR_ALREADY, "handle already polled by this poller" },
+        { PLR_OWNED, "handle already polled by another poller or owned by a session" },
+        { PLR_UNKNOWN, "handle not polled by this poller" },
+        { PLR_OUT_OF_MEM, "out of memory" }
+    };
+
+    return (std::end(_retcodeMap) == _retcodeMap.find(rc)) ? "unknown" : _retcodeMap.at(rc);
+}
+
+} // namespace asyncurl
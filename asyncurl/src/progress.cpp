@@ -0,0 +1,167 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/progress.hpp>
+
+#include "clock.hpp"
+
+#include <map>
+#include <string>
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// WRITER
+// A single thread (the one driving the transfer) updates the working copy and publishes it : the sequence is odd
+// while the fields are being stored, so that the readers retry instead of seeing a torn snapshot.
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief publish - Publish the working copy to the readers
+ */
+void
+progress::publish(void) noexcept
+{
+    const auto seq{ seq__.load(std::memory_order_relaxed) };
+
+    seq__.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    state__.store(current__.state, std::memory_order_relaxed);
+    result__.store(current__.result, std::memory_order_relaxed);
+    dl_now__.store(current__.dl_now, std::memory_order_relaxed);
+    dl_total__.store(current__.dl_total, std::memory_order_relaxed);
+    ul_now__.store(current__.ul_now, std::memory_order_relaxed);
+    ul_total__.store(current__.ul_total, std::memory_order_relaxed);
+    last_activity_us__.store(current__.last_activity_us, std::memory_order_relaxed);
+
+    seq__.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * @brief start - Reset the progress for a new transfer
+ *
+ * @param state The state of the new transfer
+ */
+void
+progress::start(PRG_State state) noexcept
+{
+    current__       = {};
+    current__.state = state;
+    publish();
+}
+
+/**
+ * @brief finish - Record the completion of the transfer
+ *
+ * @param result The result of the transfer
+ * @param ul_now The body bytes sent, as reported by curl (negative to keep the bytes counted so far)
+ */
+void
+progress::finish(int result, int64_t ul_now) noexcept
+{
+    current__.state  = PRG_DONE;
+    current__.result = result;
+    if (0 <= ul_now) current__.ul_now = ul_now;
+    publish();
+}
+
+/**
+ * @brief set_state - Change the state of the transfer
+ *
+ * @param state The new state
+ */
+void
+progress::set_state(PRG_State state) noexcept
+{
+    if (state == current__.state) return;
+
+    current__.state = state;
+    publish();
+}
+
+/**
+ * @brief received - Account for body bytes received
+ *
+ * @param bytes The bytes received
+ * @param total The body bytes expected (negative to keep the current value)
+ */
+void
+progress::received(size_t bytes, int64_t total) noexcept
+{
+    current__.dl_now += static_cast<int64_t>(bytes);
+    current__.last_activity_us = monotonic_us();
+    if (0 <= total) current__.dl_total = total;
+    publish();
+}
+
+/**
+ * @brief sent - Account for body bytes sent
+ *
+ * @param bytes The bytes sent
+ * @param total The body bytes to send (negative to keep the current value)
+ */
+void
+progress::sent(size_t bytes, int64_t total) noexcept
+{
+    current__.ul_now += static_cast<int64_t>(bytes);
+    current__.last_activity_us = monotonic_us();
+    if (0 <= total) current__.ul_total = total;
+    publish();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// READER
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief read - Get a consistent snapshot of the progress (any thread, lock-free)
+ *
+ * The reader retries while a snapshot is being published (a few stores on the writer side).
+ * @return The snapshot
+ */
+progress::snapshot
+progress::read(void) const noexcept
+{
+    snapshot s;
+
+    for (;;)
+    {
+        const auto before{ seq__.load(std::memory_order_acquire) };
+        if (0 != (before & 1)) continue;
+
+        s.state            = static_cast<PRG_State>(state__.load(std::memory_order_relaxed));
+        s.result           = result__.load(std::memory_order_relaxed);
+        s.dl_now           = dl_now__.load(std::memory_order_relaxed);
+        s.dl_total         = dl_total__.load(std::memory_order_relaxed);
+        s.ul_now           = ul_now__.load(std::memory_order_relaxed);
+        s.ul_total         = ul_total__.load(std::memory_order_relaxed);
+        s.last_activity_us = last_activity_us__.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq__.load(std::memory_order_relaxed) == before) return s;
+    }
+}
+
+/**
+ * @brief state2Str - Gives a human readable string for each state
+ *
+ * @param state The state
+ * @return A human-readable representation of the state
+ */
+std::string_view
+progress::state2Str(progress::PRG_State state) noexcept
+{
+    static const std::map<PRG_State, std::string> _stateMap{ { PRG_IDLE, "idle" },
+                                                             { PRG_QUEUED, "queued" },
+                                                             { PRG_RUNNING, "running" },
+                                                             { PRG_DONE, "done" } };
+
+    const auto it{ _stateMap.find(state) };
+    return (std::end(_stateMap) == it) ? std::string_view{ "unknown" } : std::string_view{ it->second };
+}
+
+} // namespace asyncurl
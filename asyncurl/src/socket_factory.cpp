@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2023 Osmozis SA - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <asyncurl/socket_factory.hpp>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace asyncurl
+{
+//---------------------------------------------------------------------------------------------------------------------
+// FACTORY
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief open - Create the socket of a new connection
+ *
+ * Called by the session for every new connection (the socket is then bound, tuned and connected by curl).
+ * @param family The address family (AF_INET, AF_INET6...)
+ * @param socktype The socket type (SOCK_STREAM, SOCK_DGRAM)
+ * @param protocol The protocol
+ * @return The new socket, or -1 on failure (errno set)
+ */
+int
+socket_factory::open(int family, int socktype, int protocol) noexcept
+{
+    return ::socket(family, socktype, protocol);
+}
+
+/**
+ * @brief configure - Tune a socket before it gets connected
+ *
+ * Called after curl applied its own socket options, so the factory has the last word.
+ * @param fd The socket
+ * @return 0 on success, -1 to abort the connection
+ */
+int
+socket_factory::configure(int fd) noexcept
+{
+    auto set = [fd](int level, int name, int val) { return ::setsockopt(fd, level, name, &val, sizeof(val)); };
+
+    if (0 <= options__.nodelay) set(IPPROTO_TCP, TCP_NODELAY, options__.nodelay);
+    if (0 <= options__.sndbuf) set(SOL_SOCKET, SO_SNDBUF, options__.sndbuf);
+    if (0 <= options__.rcvbuf) set(SOL_SOCKET, SO_RCVBUF, options__.rcvbuf);
+#ifdef TCP_NOTSENT_LOWAT
+    if (0 <= options__.notsent_lowat) set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, options__.notsent_lowat);
+#endif
+#ifdef SO_BUSY_POLL
+    if (0 <= options__.busy_poll_us) set(SOL_SOCKET, SO_BUSY_POLL, options__.busy_poll_us);
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+    if (options__.fastopen) set(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+#endif
+#ifdef SO_PRIORITY
+    if (0 <= options__.priority) set(SOL_SOCKET, SO_PRIORITY, options__.priority);
+#endif
+#ifdef SO_MARK
+    if (0 <= options__.mark) set(SOL_SOCKET, SO_MARK, options__.mark);
+#endif
+    // The family of the socket is unknown here : IPv6 sockets refuse IP_TOS
+    if (0 <= options__.tos && 0 != set(IPPROTO_IP, IP_TOS, options__.tos))
+        set(IPPROTO_IPV6, IPV6_TCLASS, options__.tos);
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+// PRESETS
+//---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief low_latency - Options for small, latency-sensitive exchanges (RPCs, polling)
+ *
+ * No Nagle delay, a small unsent queue (the application data is not stuck behind a large socket buffer), busy polling
+ * of the receive queue and TCP Fast Open.
+ * @return The options
+ */
+socket_factory::options
+socket_factory::low_latency(void) noexcept
+{
+    options ret;
+    ret.nodelay       = 1;
+    ret.notsent_lowat = 16 * 1024;
+    ret.busy_poll_us  = 50;
+    ret.tos           = 0x10; // IPTOS_LOWDELAY
+    ret.fastopen      = true;
+    return ret;
+}
+
+/**
+ * @brief bulk_throughput - Options for large transfers (downloads, uploads)
+ *
+ * Large fixed socket buffers (setting them disables the kernel autotuning) and coalesced segments.
+ * @return The options
+ */
+socket_factory::options
+socket_factory::bulk_throughput(void) noexcept
+{
+    options ret;
+    ret.nodelay = 0;
+    ret.sndbuf  = 4 * 1024 * 1024;
+    ret.rcvbuf  = 4 * 1024 * 1024;
+    ret.tos     = 0x08; // IPTOS_THROUGHPUT
+    return ret;
+}
+
+} // namespace asyncurl
@@ -6,6 +6,7 @@ add_library(${PROJECT_NAME}::${LIBRARY_NAME}
 find_package(OpenSSL      REQUIRED)
 find_package(CURL         REQUIRED)
 find_package(miniLoop 1.0 REQUIRED)
+find_package(Threads      REQUIRED)
 
 set_target_properties(${LIBRARY_NAME} PROPERTIES LINK_FLAGS      "-Wl,-rpath,${CMAKE_INSTALL_PREFIX}/lib" )
 set_target_properties(${LIBRARY_NAME} PROPERTIES LINKER_LANGUAGE CXX                                      )
@@ -40,6 +41,7 @@ target_link_libraries(
     PUBLIC
         miniLoop
         ${CURL_LIBRARIES}
+        Threads::Threads
 )
 
 install(